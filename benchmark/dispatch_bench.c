@@ -0,0 +1,198 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Reactor dispatch latency benchmark over loopback.
+ *
+ * Sends timestamped datagrams round-robin to a set of udpserver channels
+ * and measures the time from send to the write into the linked channel.
+ * Runs with one reactor thread and with one thread per core. Reports
+ * process CPU time used while all channels are idle.
+ *
+ * usage: dispatch_bench [channels] [packets] [rate_per_s]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stub_context.h"
+#include "socket_reactor.h"
+
+void init_socket_channels (const struct context_rmcios *context);
+
+static uint64_t *latencies;
+static volatile long received;
+static long max_samples;
+
+static void latency_sink (void *arg, int sender, const char *data,
+                          int length, int num_values)
+{
+   uint64_t now = io_clock_ns ();
+   uint64_t sent;
+   long n;
+   if (length < (int) sizeof (sent))
+      return;
+   memcpy (&sent, data, sizeof (sent));
+   n = __atomic_fetch_add (&received, 1, __ATOMIC_RELAXED);
+   if (n < max_samples)
+      latencies[n] = now - sent;
+}
+
+static int compare_u64 (const void *a, const void *b)
+{
+   uint64_t x = *(const uint64_t *) a;
+   uint64_t y = *(const uint64_t *) b;
+   return x < y ? -1 : x > y;
+}
+
+static double percentile_us (long count, double p)
+{
+   long index = (long) (p * (count - 1));
+   return latencies[index] / 1000.0;
+}
+
+// Free udp port for a channel
+static int free_port (void)
+{
+   struct sockaddr_in local;
+   socklen_t len = sizeof (local);
+   SOCKET s = socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+   int port;
+   memset (&local, 0, sizeof (local));
+   local.sin_family = AF_INET;
+   local.sin_addr.s_addr = inet_addr ("127.0.0.1");
+   bind (s, (struct sockaddr *) &local, sizeof (local));
+   getsockname (s, (struct sockaddr *) &local, &len);
+   port = ntohs (local.sin_port);
+   closesocket (s);
+   return port;
+}
+
+static void run (int threads, int channels, long packets, long rate)
+{
+   static int runs;
+   struct sockaddr_in *to;
+   SOCKET tx = socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+   char threads_str[16];
+   const char *setup_threads[] = { threads_str };
+   char data[64];
+   char status[32];
+   uint64_t start;
+   clock_t cpu;
+   long i, count;
+   int c;
+
+   snprintf (threads_str, sizeof (threads_str), "%d", threads);
+   stub_call (stub_channel ("socketreactor"), setup_rmcios, 1,
+              setup_threads, 0, 0);
+   stub_call (stub_channel ("socketreactor"), read_rmcios, 0, NULL,
+              status, sizeof (status));
+
+   // New channels are spread over the configured threads
+   to = (struct sockaddr_in *) calloc (channels, sizeof (*to));
+   for (c = 0; c < channels; c++)
+   {
+      char name[32], port[16];
+      const char *create[] = { name };
+      const char *setup[] = { port };
+      int id;
+      snprintf (name, sizeof (name), "bench_%d_%d", runs, c);
+      snprintf (port, sizeof (port), "%d", free_port ());
+      stub_call (stub_channel ("udpserver"), create_rmcios, 1, create, 0, 0);
+      id = stub_channel (name);
+      stub_link (id, latency_sink, NULL);
+      stub_call (id, setup_rmcios, 1, setup, 0, 0);
+      to[c].sin_family = AF_INET;
+      to[c].sin_addr.s_addr = inet_addr ("127.0.0.1");
+      to[c].sin_port = htons (atoi (port));
+   }
+
+   // Idle cost of the registered channels
+   cpu = clock ();
+   io_sleep_ms (1000);
+   cpu = clock () - cpu;
+
+   received = 0;
+   memset (data, 'x', sizeof (data));
+   start = io_clock_ns ();
+   for (i = 0; i < packets; i++)
+   {
+      uint64_t now;
+      if (rate > 0)
+      {
+         uint64_t due = start + (uint64_t) i * 1000000000ULL / rate;
+         while (io_clock_ns () < due);
+      }
+      now = io_clock_ns ();
+      memcpy (data, &now, sizeof (now));
+      c = (int) (i % channels);
+      sendto (tx, data, sizeof (data), 0, (struct sockaddr *) &to[c],
+              sizeof (to[c]));
+   }
+   // Wait for stragglers
+   for (i = 0; i < 200 && received < packets; i++)
+      io_sleep_ms (1);
+
+   count = received < max_samples ? received : max_samples;
+   qsort (latencies, count, sizeof (uint64_t), compare_u64);
+   printf ("threads %-3s channels %4d  received %8ld/%-8ld", status,
+           channels, received, packets);
+   if (count > 0)
+      printf ("  p50 %7.1f us  p99 %7.1f us  p999 %7.1f us",
+              percentile_us (count, 0.5), percentile_us (count, 0.99),
+              percentile_us (count, 0.999));
+   printf ("  idle cpu %.1f ms/s\n", cpu * 1000.0 / CLOCKS_PER_SEC);
+   free (to);
+   closesocket (tx);
+   runs++;
+}
+
+int main (int argc, char *argv[])
+{
+   int channels = argc > 1 ? atoi (argv[1]) : 64;
+   long packets = argc > 2 ? atol (argv[2]) : 200000;
+   long rate = argc > 3 ? atol (argv[3]) : 100000;
+
+#ifdef _WIN32
+   WSADATA wsa;
+   WSAStartup (MAKEWORD (2, 2), &wsa);
+#endif
+   if (channels < 1)
+      channels = 1;
+   max_samples = packets;
+   latencies = (uint64_t *) malloc (sizeof (uint64_t) * max_samples);
+   init_socket_channels (&stub_context);
+
+   printf ("%ld datagrams to %d udpserver channels, rate %ld/s\n",
+           packets, channels, rate);
+   run (1, channels, packets, rate);
+   if (io_cpu_count () > 1)
+      run (io_cpu_count (), channels, packets, rate);
+   return 0;
+}
@@ -0,0 +1,322 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Loopback throughput and latency suite for the socket channels.
+ *
+ * Echo servers are tcpserver and udpserver channels whose linked channel
+ * writes every received message back to its sender. Clients are
+ * tcpclient and udpclient channels, each driven by its own thread with
+ * one request in flight. Every case runs for a fixed time and reports
+ * round trips per second, payload MB/s per direction, round trip
+ * percentiles and process CPU time per round trip. The CPU time covers
+ * both the client and the server side.
+ *
+ * usage: loopback_bench [seconds_per_case] [max_clients]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stub_context.h"
+#include "socket_reactor.h"
+#include "io_stats.h"
+
+#define MAX_CLIENTS 64
+#define MAX_PAYLOAD 8192
+#define RESPONSE_TIMEOUT_MS 100
+#define NAME_LENGTH 64
+// Room for channel name and subchannel suffix
+#define SUBCHANNEL_LENGTH (NAME_LENGTH + 16)
+
+void init_socket_channels (const struct context_rmcios *context);
+
+struct bench_client
+{
+   int id;                      // Client channel
+   int size;                    // Payload bytes
+   io_event response;
+   long round_trips;
+   long timeouts;
+   int finished;
+};
+
+static struct io_histogram rtt;
+static volatile int stop;
+static int runs;
+
+// Free port for a server channel
+static int free_port (int type)
+{
+   struct sockaddr_in local;
+   socklen_t len = sizeof (local);
+   SOCKET s = socket (AF_INET, type, 0);
+   int port;
+   memset (&local, 0, sizeof (local));
+   local.sin_family = AF_INET;
+   local.sin_addr.s_addr = inet_addr ("127.0.0.1");
+   bind (s, (struct sockaddr *) &local, sizeof (local));
+   getsockname (s, (struct sockaddr *) &local, &len);
+   port = ntohs (local.sin_port);
+   closesocket (s);
+   return port;
+}
+
+// Linked channel of tcpserver. Sends the frame back to the client that
+// sent it like a script would: read the slot and write to it.
+static void tcp_echo_sink (void *arg, int sender, const char *data,
+                           int length, int num_values)
+{
+   int client_channel = (int) (intptr_t) arg;
+   char slot[16];
+   const char *params[2];
+   int lengths[2];
+   if (length == 0)
+      return;                   // New connection
+   stub_call (client_channel, read_rmcios, 0, NULL, slot, sizeof (slot));
+   params[0] = slot;
+   lengths[0] = strlen (slot);
+   params[1] = data;
+   lengths[1] = length;
+   stub_write_buffers (client_channel, 2, params, lengths);
+}
+
+// Linked channel of udpserver. Writes to the server reply to the sender
+// of the latest datagram.
+static void udp_echo_sink (void *arg, int sender, const char *data,
+                           int length, int num_values)
+{
+   stub_write_buffer ((int) (intptr_t) arg, data, length);
+}
+
+// Linked channel of a client. Called with one complete response.
+static void response_sink (void *arg, int sender, const char *data,
+                           int length, int num_values)
+{
+   struct bench_client *c = (struct bench_client *) arg;
+   if (length > 0)
+      io_event_set (&c->response);
+}
+
+static IO_THREAD_FUNC (client_thread, arg)
+{
+   struct bench_client *c = (struct bench_client *) arg;
+   static char request[MAX_PAYLOAD];
+   while (!stop)
+   {
+      uint64_t start = io_clock_ns ();
+      stub_write_buffer (c->id, request, c->size);
+      if (!io_event_wait (&c->response, RESPONSE_TIMEOUT_MS))
+      {
+         c->timeouts++;
+         continue;
+      }
+      io_histogram_record (&rtt, io_clock_ns () - start);
+      c->round_trips++;
+   }
+   __atomic_store_n (&c->finished, 1, __ATOMIC_RELEASE);
+   IO_THREAD_RETURN;
+}
+
+static void wait_connected (int id)
+{
+   char status[64];
+   do
+   {
+      io_sleep_ms (1);
+      stub_call (id, read_rmcios, 0, NULL, status, sizeof (status));
+   }
+   while (status[0] != '2');
+}
+
+// Create channel name_suffix and call setup on its subchannel
+static void setup_sub (const char *name, const char *suffix, int num_params,
+                       const char *const *params)
+{
+   char sub[SUBCHANNEL_LENGTH];
+   snprintf (sub, sizeof (sub), "%s%s", name, suffix);
+   stub_call (stub_channel (sub), setup_rmcios, num_params, params, 0, 0);
+}
+
+// Echo server channel. Returns the port it listens on.
+static int create_server (int tcp, int size, char *name, int namelen)
+{
+   char port[16], frame_length[16];
+   const char *create[] = { name };
+   const char *setup[] = { port };
+   const char *frame[] = { "fixed", frame_length };
+   const char *recv_size[] = { "65536" };
+   int id;
+
+   snprintf (name, namelen, "%s_srv_%d", tcp ? "tcp" : "udp", runs);
+   snprintf (port, sizeof (port), "%d",
+             free_port (tcp ? SOCK_STREAM : SOCK_DGRAM));
+   snprintf (frame_length, sizeof (frame_length), "%d", size);
+   stub_call (stub_channel (tcp ? "tcpserver" : "udpserver"), create_rmcios,
+              1, create, 0, 0);
+   id = stub_channel (name);
+   setup_sub (name, "_buffer", 1, recv_size);
+   if (tcp)
+   {
+      char client[SUBCHANNEL_LENGTH];
+      snprintf (client, sizeof (client), "%s_client", name);
+      setup_sub (name, "_frame", 2, frame);
+      stub_link (id, tcp_echo_sink, (void *) (intptr_t) stub_channel (client));
+   }
+   else
+      stub_link (id, udp_echo_sink, (void *) (intptr_t) id);
+   stub_call (id, setup_rmcios, 1, setup, 0, 0);
+   return atoi (port);
+}
+
+static void create_client (struct bench_client *c, int tcp, int size,
+                           int port, int index)
+{
+   char name[NAME_LENGTH], port_str[16], frame_length[16];
+   const char *create[] = { name };
+   const char *setup[] = { "127.0.0.1", port_str };
+   const char *frame[] = { "fixed", frame_length };
+   const char *recv_size[] = { "65536" };
+   const char *nodelay[] = { "1" };
+
+   snprintf (name, sizeof (name), "%s_cli_%d_%d", tcp ? "tcp" : "udp",
+             runs, index);
+   snprintf (port_str, sizeof (port_str), "%d", port);
+   snprintf (frame_length, sizeof (frame_length), "%d", size);
+   stub_call (stub_channel (tcp ? "tcpclient" : "udpclient"), create_rmcios,
+              1, create, 0, 0);
+   c->id = stub_channel (name);
+   c->size = size;
+   c->round_trips = 0;
+   c->timeouts = 0;
+   c->finished = 0;
+   io_event_init (&c->response);
+   setup_sub (name, "_buffer", 1, recv_size);
+   if (tcp)
+   {
+      setup_sub (name, "_frame", 2, frame);
+      setup_sub (name, "_send", 1, nodelay);
+   }
+   stub_link (c->id, response_sink, c);
+   stub_call (c->id, setup_rmcios, 2, setup, 0, 0);
+   if (tcp)
+      wait_connected (c->id);
+}
+
+static void run (int tcp, int size, int clients, int seconds)
+{
+   static struct bench_client c[MAX_CLIENTS];
+   char server[NAME_LENGTH];
+   long round_trips = 0, timeouts = 0;
+   uint64_t start, elapsed;
+   clock_t cpu;
+   double seconds_run;
+   int port, i;
+
+   port = create_server (tcp, size, server, sizeof (server));
+   for (i = 0; i < clients; i++)
+      create_client (&c[i], tcp, size, port, i);
+
+   memset (&rtt, 0, sizeof (rtt));
+   stop = 0;
+   cpu = clock ();
+   start = io_clock_ns ();
+   for (i = 0; i < clients; i++)
+      io_thread_start (client_thread, &c[i]);
+   io_sleep_ms (seconds * 1000);
+   stop = 1;
+   for (i = 0; i < clients; i++)
+   {
+      while (!__atomic_load_n (&c[i].finished, __ATOMIC_ACQUIRE))
+         io_sleep_ms (1);
+      round_trips += c[i].round_trips;
+      timeouts += c[i].timeouts;
+   }
+   elapsed = io_clock_ns () - start;
+   cpu = clock () - cpu;
+   seconds_run = elapsed / 1e9;
+
+   printf ("%-5s %6d %7d %10.0f %8.2f %8.1f %8.1f %8.1f %8.2f %8ld\n",
+           tcp ? "tcp" : "udp", size, clients, round_trips / seconds_run,
+           round_trips * (double) size / seconds_run / 1e6,
+           io_histogram_percentile (&rtt, 0.5) / 1e3,
+           io_histogram_percentile (&rtt, 0.99) / 1e3,
+           io_histogram_percentile (&rtt, 0.999) / 1e3,
+           round_trips > 0 ?
+           cpu * 1e6 / CLOCKS_PER_SEC / round_trips : 0.0, timeouts);
+
+   // Disconnect so idle channels do not load the next cases
+   for (i = 0; tcp && i < clients; i++)
+      stub_call (c[i].id, setup_rmcios, 0, NULL, 0, 0);
+   if (tcp)
+      stub_call (stub_channel (server), setup_rmcios, 0, NULL, 0, 0);
+   runs++;
+}
+
+int main (int argc, char *argv[])
+{
+   static const int sizes[] = { 16, 256, 1400, 8192 };
+   static const int client_counts[] = { 1, 4, 16, 64 };
+   int seconds = argc > 1 ? atoi (argv[1]) : 1;
+   int max_clients = argc > 2 ? atoi (argv[2]) : 16;
+   char threads[16];
+   unsigned int proto, s, n;
+
+#ifdef _WIN32
+   WSADATA wsa;
+   WSAStartup (MAKEWORD (2, 2), &wsa);
+#endif
+   if (seconds < 1)
+      seconds = 1;
+   if (max_clients > MAX_CLIENTS)
+      max_clients = MAX_CLIENTS;
+   init_socket_channels (&stub_context);
+   stub_call (stub_channel ("socketreactor"), read_rmcios, 0, NULL,
+              threads, sizeof (threads));
+
+   printf ("%d s per case, %s reactor threads\n", seconds, threads);
+   printf ("%-5s %6s %7s %10s %8s %8s %8s %8s %8s %8s\n", "proto", "size",
+           "clients", "rt/s", "MB/s", "p50_us", "p99_us", "p999_us",
+           "cpu_us", "timeouts");
+   for (proto = 0; proto < 2; proto++)
+   {
+      int tcp = proto == 0;
+      for (s = 0; s < sizeof (sizes) / sizeof (sizes[0]); s++)
+      {
+         for (n = 0; n < sizeof (client_counts) / sizeof (client_counts[0]);
+              n++)
+         {
+            if (client_counts[n] > max_clients)
+               break;
+            run (tcp, sizes[s], client_counts[n], seconds);
+         }
+      }
+   }
+   return 0;
+}
@@ -0,0 +1,217 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Request/response round-trip benchmark over loopback.
+ *
+ * Each request is written to a tcpclient channel as a header write
+ * followed by a payload write. The echo server answers when the whole
+ * request has arrived. Compares default send (Nagle), TCP_NODELAY and
+ * TCP_NODELAY with a write coalescing window.
+ *
+ * usage: rtt_bench [requests_per_size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stub_context.h"
+#include "socket_reactor.h"
+
+#define HEADER_SIZE 8
+
+void init_socket_channels (const struct context_rmcios *context);
+
+static int request_size;
+static io_event response;
+
+static int recv_all (SOCKET s, char *buffer, int length)
+{
+   int got = 0;
+   while (got < length)
+   {
+      int bytes = recv (s, buffer + got, length - got, 0);
+      if (bytes <= 0)
+         return -1;
+      got += bytes;
+   }
+   return 0;
+}
+
+static IO_THREAD_FUNC (echo_thread, arg)
+{
+   SOCKET s = (SOCKET) (intptr_t) arg;
+   static char buffer[1 << 16];
+   sock_set_nodelay (s, 1);
+   while (recv_all (s, buffer, request_size) == 0)
+   {
+      if (send (s, buffer, request_size, SOCK_SEND_FLAGS) != request_size)
+         break;
+   }
+   closesocket (s);
+   IO_THREAD_RETURN;
+}
+
+static IO_THREAD_FUNC (accept_thread, arg)
+{
+   SOCKET listener = (SOCKET) (intptr_t) arg;
+   SOCKET s;
+   while ((s = accept (listener, NULL, NULL)) != INVALID_SOCKET)
+      io_thread_start (echo_thread, (void *) (intptr_t) s);
+   IO_THREAD_RETURN;
+}
+
+// Linked channel of tcpclient. Called with one complete response frame.
+static void response_sink (void *arg, int sender, const char *data,
+                           int length, int num_values)
+{
+   io_event_set (&response);
+}
+
+static int compare_u64 (const void *a, const void *b)
+{
+   uint64_t x = *(const uint64_t *) a;
+   uint64_t y = *(const uint64_t *) b;
+   return x < y ? -1 : x > y;
+}
+
+static void wait_connected (int id)
+{
+   char status[64];
+   do
+   {
+      io_sleep_ms (1);
+      stub_call (id, read_rmcios, 0, NULL, status, sizeof (status));
+   }
+   while (status[0] != '2');
+}
+
+static void run (int id, const char *mode, int payload_size, int requests,
+                 uint64_t * samples)
+{
+   static char request[1 << 16];
+   uint64_t total = 0;
+   int timeouts = 0;
+   int i;
+
+   for (i = 0; i < requests; i++)
+   {
+      uint64_t start = io_clock_ns ();
+      stub_write_buffer (id, request, HEADER_SIZE);
+      stub_write_buffer (id, request + HEADER_SIZE, payload_size);
+      if (!io_event_wait (&response, 1000))
+         timeouts++;
+      samples[i] = io_clock_ns () - start;
+      total += samples[i];
+   }
+   qsort (samples, requests, sizeof (samples[0]), compare_u64);
+   printf ("%8d  %-22s %9.1f %9.1f %9.1f %9.1f us %d timeouts\n",
+           payload_size, mode, total / 1e3 / requests,
+           samples[requests / 2] / 1e3, samples[requests * 99 / 100] / 1e3,
+           samples[requests - 1] / 1e3, timeouts);
+}
+
+int main (int argc, char *argv[])
+{
+   static const int sizes[] = { 16, 256, 1400 };
+   int requests = argc > 1 ? atoi (argv[1]) : 200;
+   uint64_t *samples;
+   struct sockaddr_in addr;
+   socklen_t alen = sizeof (addr);
+   SOCKET listener;
+   char port[16];
+   unsigned int i;
+
+#ifdef _WIN32
+   WSADATA wsa;
+   WSAStartup (MAKEWORD (2, 2), &wsa);
+#endif
+   if (requests < 1)
+      requests = 1;
+   samples = (uint64_t *) malloc (sizeof (uint64_t) * requests);
+   io_event_init (&response);
+   init_socket_channels (&stub_context);
+
+   listener = socket (AF_INET, SOCK_STREAM, 0);
+   memset (&addr, 0, sizeof (addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+   bind (listener, (struct sockaddr *) &addr, sizeof (addr));
+   listen (listener, 8);
+   getsockname (listener, (struct sockaddr *) &addr, &alen);
+   snprintf (port, sizeof (port), "%d", ntohs (addr.sin_port));
+   io_thread_start (accept_thread, (void *) (intptr_t) listener);
+
+   printf ("    size  mode                        mean       p50       p99"
+           "       max\n");
+   for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++)
+   {
+      char name[32];
+      char frame_length[16];
+      char request_bytes[16];
+      int id;
+
+      // New connection per size so the echo server knows request size
+      request_size = HEADER_SIZE + sizes[i];
+      snprintf (name, sizeof (name), "rtt%d", sizes[i]);
+      snprintf (frame_length, sizeof (frame_length), "%d", request_size);
+      snprintf (request_bytes, sizeof (request_bytes), "%d", request_size);
+      {
+         const char *create[] = { name };
+         const char *frame[] = { "fixed", frame_length };
+         const char *setup[] = { "127.0.0.1", port };
+         char sub[48];
+         stub_call (stub_channel ("tcpclient"), create_rmcios, 1, create,
+                    0, 0);
+         id = stub_channel (name);
+         snprintf (sub, sizeof (sub), "%s_frame", name);
+         stub_call (stub_channel (sub), setup_rmcios, 2, frame, 0, 0);
+         stub_link (id, response_sink, NULL);
+         stub_call (id, setup_rmcios, 2, setup, 0, 0);
+         wait_connected (id);
+      }
+      {
+         char sub[48];
+         const char *nagle[] = { "0", "0", "0" };
+         const char *nodelay[] = { "1", "0", "0" };
+         const char *coalesce[] = { "1", "200", request_bytes };
+         int send_id;
+         snprintf (sub, sizeof (sub), "%s_send", name);
+         send_id = stub_channel (sub);
+
+         stub_call (send_id, setup_rmcios, 3, nagle, 0, 0);
+         run (id, "default (Nagle)", sizes[i], requests, samples);
+         stub_call (send_id, setup_rmcios, 3, nodelay, 0, 0);
+         run (id, "nodelay", sizes[i], requests, samples);
+         stub_call (send_id, setup_rmcios, 3, coalesce, 0, 0);
+         run (id, "nodelay + coalesce", sizes[i], requests, samples);
+      }
+      stub_call (id, setup_rmcios, 0, NULL, 0, 0);
+   }
+   return 0;
+}
@@ -0,0 +1,194 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Socket write path benchmark over loopback.
+ *
+ * Writes messages of 64 B to 1 MB through a tcpclient channel and
+ * reports throughput and bytes copied per message. Compared against the
+ * previous write path that copied every parameter to a stack buffer
+ * before send.
+ *
+ * usage: send_bench [total_megabytes_per_size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stub_context.h"
+#include "socket_reactor.h"
+
+void init_socket_channels (const struct context_rmcios *context);
+
+static volatile long long received;
+
+static IO_THREAD_FUNC (drain_thread, arg)
+{
+   SOCKET s = (SOCKET) (intptr_t) arg;
+   static char buffer[1 << 16];
+   int bytes;
+   while ((bytes = recv (s, buffer, sizeof (buffer), 0)) > 0)
+      __atomic_fetch_add (&received, bytes, __ATOMIC_RELAXED);
+   closesocket (s);
+   IO_THREAD_RETURN;
+}
+
+static IO_THREAD_FUNC (accept_thread, arg)
+{
+   SOCKET listener = (SOCKET) (intptr_t) arg;
+   SOCKET s;
+   while ((s = accept (listener, NULL, NULL)) != INVALID_SOCKET)
+      io_thread_start (drain_thread, (void *) (intptr_t) s);
+   IO_THREAD_RETURN;
+}
+
+static void wait_received (long long total)
+{
+   while (__atomic_load_n (&received, __ATOMIC_RELAXED) < total);
+}
+
+// tcpclient connects in background after setup
+static void wait_connected (int id)
+{
+   char status[64];
+   do
+   {
+      io_sleep_ms (1);
+      stub_call (id, read_rmcios, 0, NULL, status, sizeof (status));
+   }
+   while (status[0] != '2');
+}
+
+static void report (const char *mode, int size, long messages,
+                    uint64_t ns, double copied)
+{
+   double seconds = ns / 1e9;
+   printf ("%8d  %-18s %10.0f msg/s %10.1f MB/s %12.0f copied B/msg\n",
+           size, mode, messages / seconds,
+           (double) size * messages / seconds / 1e6, copied);
+}
+
+int main (int argc, char *argv[])
+{
+   static const int sizes[] = { 64, 1024, 16384, 65536, 1048576 };
+   long long total_mb = argc > 1 ? atoll (argv[1]) : 256;
+   struct sockaddr_in addr;
+   socklen_t alen = sizeof (addr);
+   SOCKET listener, legacy;
+   char port[16];
+   char *payload;
+   int id;
+   unsigned int i;
+
+#ifdef _WIN32
+   WSADATA wsa;
+   WSAStartup (MAKEWORD (2, 2), &wsa);
+#endif
+   init_socket_channels (&stub_context);
+
+   listener = socket (AF_INET, SOCK_STREAM, 0);
+   memset (&addr, 0, sizeof (addr));
+   addr.sin_family = AF_INET;
+   addr.sin_addr.s_addr = inet_addr ("127.0.0.1");
+   bind (listener, (struct sockaddr *) &addr, sizeof (addr));
+   listen (listener, 8);
+   getsockname (listener, (struct sockaddr *) &addr, &alen);
+   snprintf (port, sizeof (port), "%d", ntohs (addr.sin_port));
+   io_thread_start (accept_thread, (void *) (intptr_t) listener);
+
+   legacy = socket (AF_INET, SOCK_STREAM, 0);
+   connect (legacy, (struct sockaddr *) &addr, sizeof (addr));
+
+   {
+      const char *create[] = { "bench_tcp" };
+      const char *setup[] = { "127.0.0.1", port };
+      stub_call (stub_channel ("tcpclient"), create_rmcios, 1, create, 0, 0);
+      id = stub_channel ("bench_tcp");
+      stub_call (id, setup_rmcios, 2, setup, 0, 0);
+      wait_connected (id);
+   }
+
+   payload = (char *) malloc (sizes[4]);
+   memset (payload, 'x', sizes[4]);
+   printf ("    size  mode\n");
+   for (i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++)
+   {
+      int size = sizes[i];
+      long messages = total_mb * 1000000 / size;
+      long m;
+      long long start_copied;
+      uint64_t start;
+      char *copy = (char *) malloc (size);
+
+      if (messages > 1000000)
+         messages = 1000000;
+      if (messages < 16)
+         messages = 16;
+
+      // Previous write path: copy parameter, then send
+      received = 0;
+      start = io_clock_ns ();
+      for (m = 0; m < messages; m++)
+      {
+         sock_buf buf;
+         memcpy (copy, payload, size);
+         SOCK_BUF_SET (buf, copy, size);
+         sock_sendv_all (legacy, &buf, 1);
+      }
+      wait_received ((long long) size * messages);
+      report ("copy + send", size, messages, io_clock_ns () - start, size);
+
+      // Channel write from caller buffer
+      received = 0;
+      start_copied = sock_copied_bytes ();
+      start = io_clock_ns ();
+      for (m = 0; m < messages; m++)
+         stub_write_buffer (id, payload, size);
+      wait_received ((long long) size * messages);
+      report ("tcpclient write", size, messages, io_clock_ns () - start,
+              (double) (sock_copied_bytes () - start_copied) / messages);
+
+      // Header + payload + trailer as one scatter/gather write
+      {
+         static const char header[16] = "HEADER";
+         const char *parts[] = { header, payload, "\r\n" };
+         int lengths[] = { sizeof (header), size, 2 };
+         received = 0;
+         start_copied = sock_copied_bytes ();
+         start = io_clock_ns ();
+         for (m = 0; m < messages; m++)
+            stub_write_buffers (id, 3, parts, lengths);
+         wait_received ((long long) (size + 18) * messages);
+         report ("tcpclient 3 params", size, messages,
+                 io_clock_ns () - start,
+                 (double) (sock_copied_bytes () - start_copied) / messages);
+      }
+      free (copy);
+   }
+   return 0;
+}
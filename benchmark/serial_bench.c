@@ -0,0 +1,182 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Serial receive dispatch benchmark over a pseudo terminal.
+ *
+ * A writer thread feeds the master side of a pty at the byte rate of a
+ * serial line (baud / 10 for 8N1) in 1 ms slices. The serial channel
+ * opens the slave side. Reports writes into the linked channel per
+ * second, bytes per write, and process CPU time without the writer
+ * thread with and without receive batching. Runs on linux.
+ *
+ * usage: serial_bench [seconds_per_case]
+ */
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "stub_context.h"
+#include "io_platform.h"
+
+void init_serial_channels (const struct context_rmcios *context);
+
+struct writer
+{
+   int fd;
+   long bytes_per_s;
+   volatile int running;
+   long written;
+   double cpu_s;                // Writer thread CPU time
+};
+
+static volatile long dispatches;
+static volatile long received;
+
+static void count_sink (void *arg, int sender, const char *data,
+                        int length, int num_values)
+{
+   __atomic_fetch_add (&dispatches, 1, __ATOMIC_RELAXED);
+   __atomic_fetch_add (&received, length, __ATOMIC_RELAXED);
+}
+
+// Write at line rate. Keeps the average on schedule over sleep jitter.
+static IO_THREAD_FUNC (line_writer, arg)
+{
+   struct writer *w = (struct writer *) arg;
+   char data[8192];
+   struct timespec cpu;
+   uint64_t start = io_clock_ns ();
+   long due, n;
+   memset (data, 0x55, sizeof (data));
+   while (w->running)
+   {
+      due = (long) ((io_clock_ns () - start) / 1000 * w->bytes_per_s
+                    / 1000000);
+      n = due - w->written;
+      if (n > (long) sizeof (data))
+         n = sizeof (data);
+      if (n > 0)
+      {
+         n = write (w->fd, data, n);
+         if (n > 0)
+            w->written += n;
+      }
+      io_sleep_ms (1);
+   }
+   clock_gettime (CLOCK_THREAD_CPUTIME_ID, &cpu);
+   w->cpu_s = cpu.tv_sec + cpu.tv_nsec / 1e9;
+   IO_THREAD_RETURN;
+}
+
+static void run_case (const char *name, long baud, const char *latency_us,
+                      int seconds)
+{
+   char channel[32], sub[40];
+   const char *params[2];
+   struct writer w;
+   uint64_t start, elapsed;
+   clock_t cpu;
+   double s, mb, cpu_s;
+   int master, id;
+
+   master = posix_openpt (O_RDWR | O_NOCTTY);
+   if (master < 0 || grantpt (master) != 0 || unlockpt (master) != 0)
+   {
+      printf ("Error! No pseudo terminal\n");
+      exit (1);
+   }
+
+   snprintf (channel, sizeof (channel), "%s%ld_%s", name, baud, latency_us);
+   params[0] = channel;
+   params[1] = ptsname (master);
+   stub_call (stub_channel ("serial"), create_rmcios, 2, params, NULL, 0);
+   id = stub_channel (channel);
+   stub_link (id, count_sink, NULL);
+   snprintf (sub, sizeof (sub), "%s_batch", channel);
+   params[0] = latency_us;
+   stub_call (stub_channel (sub), setup_rmcios, 1, params, NULL, 0);
+   io_sleep_ms (100);           // Let receive thread open the port
+
+   dispatches = 0;
+   received = 0;
+   w.fd = master;
+   w.bytes_per_s = baud / 10;
+   w.running = 1;
+   w.written = 0;
+   start = io_clock_ns ();
+   cpu = clock ();
+   io_thread_start (line_writer, &w);
+   io_sleep_ms (seconds * 1000);
+   w.running = 0;
+   io_sleep_ms (50);
+   cpu = clock () - cpu;
+   elapsed = io_clock_ns () - start;
+
+   s = elapsed / 1e9;
+   mb = received / 1e6;
+   cpu_s = (double) cpu / CLOCKS_PER_SEC - w.cpu_s;
+   printf ("%8ld %10s %12.0f %10.1f %12.0f %10.1f %10.2f\n",
+           baud, latency_us, dispatches / s,
+           dispatches ? (double) received / dispatches : 0.0,
+           received / s,
+           100.0 * cpu_s / s, mb > 0 ? 1000.0 * cpu_s / mb : 0.0);
+
+   // Pty numbers are reused. Leave channel without port.
+   snprintf (sub, sizeof (sub), "%s_port", channel);
+   params[0] = "";
+   stub_call (stub_channel (sub), setup_rmcios, 1, params, NULL, 0);
+   io_sleep_ms (50);
+   close (master);
+}
+
+int main (int argc, char *argv[])
+{
+   static const long bauds[] = { 115200, 921600 };
+   static const char *latencies[] = { "0", "1000", "10000" };
+   int seconds = 3;
+   unsigned int b, l;
+
+   if (argc > 1)
+      seconds = atoi (argv[1]);
+
+   init_serial_channels (&stub_context);
+   printf ("%8s %10s %12s %10s %12s %10s %10s\n",
+           "baud", "batch_us", "writes/s", "bytes/wr", "bytes/s",
+           "cpu_%", "cpu_ms/MB");
+   for (b = 0; b < sizeof (bauds) / sizeof (bauds[0]); b++)
+   {
+      for (l = 0; l < sizeof (latencies) / sizeof (latencies[0]); l++)
+         run_case ("pty", bauds[b], latencies[l], seconds);
+   }
+   return 0;
+}
@@ -0,0 +1,165 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Minimal stand-in for RMCIOS-interface/RMCIOS-functions.h.
+ * Only the part of the channel API used by the benchmarked modules.
+ */
+#ifndef RMCIOS_FUNCTIONS_STUB_H
+#define RMCIOS_FUNCTIONS_STUB_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef VERSION_STR
+#define VERSION_STR "benchmark"
+#endif
+#define API_ENTRY_FUNC
+
+enum function_rmcios
+{
+   help_rmcios = 1,
+   setup_rmcios,
+   write_rmcios,
+   read_rmcios,
+   create_rmcios,
+   link_rmcios
+};
+
+enum type_rmcios
+{
+   float_rmcios = 1,
+   int_rmcios,
+   buffer_rmcios,
+   channel_rmcios,
+   combo_rmcios
+};
+
+struct buffer_rmcios
+{
+   char *data;
+   int length;
+   int size;
+   short required_size;
+   char trailing_zero;
+};
+
+union param_rmcios
+{
+   const void *p;
+   const int *iv;
+   const float *fv;
+   const struct buffer_rmcios *bv;
+};
+
+struct combo_rmcios
+{
+   enum type_rmcios paramtype;
+   int num_params;
+   union param_rmcios param;
+   struct combo_rmcios *next;
+};
+
+struct context_rmcios
+{
+   int version;
+   void *data;
+};
+
+typedef void (*class_rmcios) (void *data,
+                              const struct context_rmcios *context, int id,
+                              enum function_rmcios function,
+                              enum type_rmcios paramtype,
+                              struct combo_rmcios *returnv,
+                              int num_params,
+                              const union param_rmcios param);
+
+int run_channel (const struct context_rmcios *context, int id,
+                 enum function_rmcios function, enum type_rmcios paramtype,
+                 struct combo_rmcios *returnv, int num_params,
+                 const union param_rmcios param);
+
+int create_channel_param (const struct context_rmcios *context,
+                          enum type_rmcios paramtype,
+                          const union param_rmcios param, int index,
+                          class_rmcios class_func, void *data);
+int create_channel_str (const struct context_rmcios *context,
+                        const char *name, class_rmcios class_func,
+                        void *data);
+int create_subchannel_str (const struct context_rmcios *context, int parent,
+                           const char *name, class_rmcios class_func,
+                           void *data);
+int linked_channels (const struct context_rmcios *context, int id);
+
+void write_buffer (const struct context_rmcios *context, int destination,
+                   const char *data, int length, int sender);
+void write_str (const struct context_rmcios *context, int destination,
+                const char *str, int sender);
+void write_iv (const struct context_rmcios *context, int destination,
+               int num_params, const int *values);
+void write_i (const struct context_rmcios *context, int destination,
+              int value);
+void write_f (const struct context_rmcios *context, int destination,
+              float value);
+
+void return_string (const struct context_rmcios *context,
+                    struct combo_rmcios *returnv, const char *str);
+void return_buffer (const struct context_rmcios *context,
+                    struct combo_rmcios *returnv, const char *data,
+                    int length);
+void return_int (const struct context_rmcios *context,
+                 struct combo_rmcios *returnv, int value);
+void return_float (const struct context_rmcios *context,
+                   struct combo_rmcios *returnv, float value);
+
+int param_to_integer (const struct context_rmcios *context,
+                      enum type_rmcios paramtype,
+                      const union param_rmcios param, int index);
+int param_to_int (const struct context_rmcios *context,
+                  enum type_rmcios paramtype,
+                  const union param_rmcios param, int index);
+float param_to_float (const struct context_rmcios *context,
+                      enum type_rmcios paramtype,
+                      const union param_rmcios param, int index);
+int param_to_string (const struct context_rmcios *context,
+                     enum type_rmcios paramtype,
+                     const union param_rmcios param, int index,
+                     int maxlen, char *to);
+int param_buffer_alloc_size (const struct context_rmcios *context,
+                             enum type_rmcios paramtype,
+                             const union param_rmcios param, int index);
+int param_string_alloc_size (const struct context_rmcios *context,
+                             enum type_rmcios paramtype,
+                             const union param_rmcios param, int index);
+struct buffer_rmcios param_to_buffer (const struct context_rmcios *context,
+                                      enum type_rmcios paramtype,
+                                      const union param_rmcios param,
+                                      int index, int maxlen, char *buffer);
+
+#endif
@@ -0,0 +1,406 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Stub RMCIOS context. Implements the subset of RMCIOS-functions used by
+ * the I/O modules on top of a small channel table.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "stub_context.h"
+
+#define STUB_MAX_CHANNELS 8192
+#define STUB_LINKED 0x10000
+
+struct stub_channel
+{
+   char name[128];
+   class_rmcios func;
+   void *data;
+   stub_sink sink;
+   void *sink_arg;
+};
+
+struct stub_return
+{
+   char *text;
+   int length;
+   int size;
+};
+
+static struct stub_channel channels[STUB_MAX_CHANNELS];
+static int num_channels = 1;    // id 0 is reserved
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+const struct context_rmcios stub_context = { 1, NULL };
+
+static int stub_add (const char *name, class_rmcios func, void *data)
+{
+   int id;
+   pthread_mutex_lock (&table_lock);
+   if (num_channels >= STUB_MAX_CHANNELS)
+   {
+      pthread_mutex_unlock (&table_lock);
+      printf ("stub: too many channels\n");
+      return 0;
+   }
+   id = num_channels++;
+   snprintf (channels[id].name, sizeof (channels[id].name), "%s", name);
+   channels[id].func = func;
+   channels[id].data = data;
+   pthread_mutex_unlock (&table_lock);
+   return id;
+}
+
+int stub_channel (const char *name)
+{
+   int i;
+   for (i = 1; i < num_channels; i++)
+   {
+      if (strcmp (channels[i].name, name) == 0)
+         return i;
+   }
+   return 0;
+}
+
+void stub_link (int id, stub_sink sink, void *arg)
+{
+   channels[id].sink_arg = arg;
+   channels[id].sink = sink;
+}
+
+static void stub_return_append (struct combo_rmcios *returnv,
+                                const char *data, int length)
+{
+   struct stub_return *r;
+   if (returnv == NULL)
+      return;
+   r = (struct stub_return *) returnv->param.p;
+   if (r == NULL || r->size <= 0)
+      return;
+   if (length > r->size - 1 - r->length)
+      length = r->size - 1 - r->length;
+   memcpy (r->text + r->length, data, length);
+   r->length += length;
+   r->text[r->length] = 0;
+}
+
+int run_channel (const struct context_rmcios *context, int id,
+                 enum function_rmcios function, enum type_rmcios paramtype,
+                 struct combo_rmcios *returnv, int num_params,
+                 const union param_rmcios param)
+{
+   if (id <= 0 || id >= num_channels || channels[id].func == NULL)
+      return 0;
+   channels[id].func (channels[id].data, context, id, function, paramtype,
+                      returnv, num_params, param);
+   return 0;
+}
+
+int stub_call (int id, enum function_rmcios function, int num_params,
+               const char *const *params, char *ret, int retlen)
+{
+   struct buffer_rmcios buffers[num_params > 0 ? num_params : 1];
+   struct stub_return r = { ret, 0, retlen };
+   struct combo_rmcios returnv;
+   union param_rmcios param;
+   int i;
+
+   for (i = 0; i < num_params; i++)
+   {
+      buffers[i].data = (char *) params[i];
+      buffers[i].length = strlen (params[i]);
+      buffers[i].size = 0;
+      buffers[i].required_size = buffers[i].length + 1;
+      buffers[i].trailing_zero = 1;
+   }
+   if (ret != NULL && retlen > 0)
+      ret[0] = 0;
+   returnv.paramtype = buffer_rmcios;
+   returnv.num_params = 1;
+   returnv.param.p = &r;
+   returnv.next = NULL;
+   param.bv = buffers;
+   return run_channel (&stub_context, id, function, buffer_rmcios,
+                       &returnv, num_params, param);
+}
+
+void stub_write_buffers (int id, int num_params, const char *const *data,
+                         const int *lengths)
+{
+   struct buffer_rmcios buffers[num_params > 0 ? num_params : 1];
+   union param_rmcios param;
+   int i;
+   for (i = 0; i < num_params; i++)
+   {
+      buffers[i].data = (char *) data[i];
+      buffers[i].length = lengths[i];
+      buffers[i].size = lengths[i];
+      buffers[i].required_size = lengths[i];
+      buffers[i].trailing_zero = 0;
+   }
+   param.bv = buffers;
+   run_channel (&stub_context, id, write_rmcios, buffer_rmcios, NULL,
+                num_params, param);
+}
+
+void stub_write_buffer (int id, const char *data, int length)
+{
+   stub_write_buffers (id, 1, &data, &length);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Channel management
+////////////////////////////////////////////////////////////////////////
+int create_channel_param (const struct context_rmcios *context,
+                          enum type_rmcios paramtype,
+                          const union param_rmcios param, int index,
+                          class_rmcios class_func, void *data)
+{
+   char name[64];
+   param_to_string (context, paramtype, param, index, sizeof (name), name);
+   return stub_add (name, class_func, data);
+}
+
+int create_channel_str (const struct context_rmcios *context,
+                        const char *name, class_rmcios class_func,
+                        void *data)
+{
+   return stub_add (name, class_func, data);
+}
+
+int create_subchannel_str (const struct context_rmcios *context, int parent,
+                           const char *name, class_rmcios class_func,
+                           void *data)
+{
+   char fullname[128];
+   snprintf (fullname, sizeof (fullname), "%s%s", channels[parent].name,
+             name);
+   return stub_add (fullname, class_func, data);
+}
+
+int linked_channels (const struct context_rmcios *context, int id)
+{
+   return id | STUB_LINKED;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Writes to linked channels
+////////////////////////////////////////////////////////////////////////
+void write_buffer (const struct context_rmcios *context, int destination,
+                   const char *data, int length, int sender)
+{
+   struct stub_channel *c;
+   if (!(destination & STUB_LINKED))
+      return;
+   c = &channels[destination & ~STUB_LINKED];
+   if (c->sink != NULL)
+      c->sink (c->sink_arg, sender, data, length, 0);
+}
+
+void write_str (const struct context_rmcios *context, int destination,
+                const char *str, int sender)
+{
+   write_buffer (context, destination, str, strlen (str), sender);
+}
+
+void write_iv (const struct context_rmcios *context, int destination,
+               int num_params, const int *values)
+{
+   struct stub_channel *c;
+   if (!(destination & STUB_LINKED))
+      return;
+   c = &channels[destination & ~STUB_LINKED];
+   if (c->sink != NULL)
+      c->sink (c->sink_arg, 0, NULL, 0, num_params);
+}
+
+void write_i (const struct context_rmcios *context, int destination,
+              int value)
+{
+   write_iv (context, destination, 1, &value);
+}
+
+void write_f (const struct context_rmcios *context, int destination,
+              float value)
+{
+   char text[32];
+   snprintf (text, sizeof (text), "%g", value);
+   write_str (context, destination, text, 0);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Return values
+////////////////////////////////////////////////////////////////////////
+void return_string (const struct context_rmcios *context,
+                    struct combo_rmcios *returnv, const char *str)
+{
+   stub_return_append (returnv, str, strlen (str));
+}
+
+void return_buffer (const struct context_rmcios *context,
+                    struct combo_rmcios *returnv, const char *data,
+                    int length)
+{
+   stub_return_append (returnv, data, length);
+}
+
+void return_int (const struct context_rmcios *context,
+                 struct combo_rmcios *returnv, int value)
+{
+   char text[32];
+   snprintf (text, sizeof (text), "%d", value);
+   return_string (context, returnv, text);
+}
+
+void return_float (const struct context_rmcios *context,
+                   struct combo_rmcios *returnv, float value)
+{
+   char text[32];
+   snprintf (text, sizeof (text), "%g", value);
+   return_string (context, returnv, text);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Parameter conversions
+////////////////////////////////////////////////////////////////////////
+int param_to_string (const struct context_rmcios *context,
+                     enum type_rmcios paramtype,
+                     const union param_rmcios param, int index,
+                     int maxlen, char *to)
+{
+   int length = 0;
+   if (maxlen <= 0)
+      return 0;
+   switch (paramtype)
+   {
+   case buffer_rmcios:
+      length = param.bv[index].length;
+      if (length > maxlen - 1)
+         length = maxlen - 1;
+      memcpy (to, param.bv[index].data, length);
+      break;
+   case int_rmcios:
+      length = snprintf (to, maxlen, "%d", param.iv[index]);
+      break;
+   case float_rmcios:
+      length = snprintf (to, maxlen, "%g", param.fv[index]);
+      break;
+   default:
+      break;
+   }
+   if (length > maxlen - 1)
+      length = maxlen - 1;
+   to[length] = 0;
+   return length;
+}
+
+float param_to_float (const struct context_rmcios *context,
+                      enum type_rmcios paramtype,
+                      const union param_rmcios param, int index)
+{
+   char text[64];
+   switch (paramtype)
+   {
+   case int_rmcios:
+      return param.iv[index];
+   case float_rmcios:
+      return param.fv[index];
+   default:
+      param_to_string (context, paramtype, param, index, sizeof (text),
+                       text);
+      return strtof (text, NULL);
+   }
+}
+
+int param_to_integer (const struct context_rmcios *context,
+                      enum type_rmcios paramtype,
+                      const union param_rmcios param, int index)
+{
+   char text[64];
+   switch (paramtype)
+   {
+   case int_rmcios:
+      return param.iv[index];
+   case float_rmcios:
+      return (int) param.fv[index];
+   default:
+      param_to_string (context, paramtype, param, index, sizeof (text),
+                       text);
+      return (int) strtol (text, NULL, 0);
+   }
+}
+
+int param_to_int (const struct context_rmcios *context,
+                  enum type_rmcios paramtype,
+                  const union param_rmcios param, int index)
+{
+   return param_to_integer (context, paramtype, param, index);
+}
+
+int param_buffer_alloc_size (const struct context_rmcios *context,
+                             enum type_rmcios paramtype,
+                             const union param_rmcios param, int index)
+{
+   if (paramtype == buffer_rmcios)
+      return param.bv[index].length + 1;
+   return 64;
+}
+
+int param_string_alloc_size (const struct context_rmcios *context,
+                             enum type_rmcios paramtype,
+                             const union param_rmcios param, int index)
+{
+   return param_buffer_alloc_size (context, paramtype, param, index);
+}
+
+struct buffer_rmcios param_to_buffer (const struct context_rmcios *context,
+                                      enum type_rmcios paramtype,
+                                      const union param_rmcios param,
+                                      int index, int maxlen, char *buffer)
+{
+   struct buffer_rmcios result;
+   result.data = buffer;
+   result.size = maxlen;
+   result.trailing_zero = 0;
+   if (paramtype == buffer_rmcios)
+   {
+      result.length = param.bv[index].length;
+      if (result.length > maxlen)
+         result.length = maxlen;
+      memcpy (buffer, param.bv[index].data, result.length);
+   }
+   else
+      result.length = param_to_string (context, paramtype, param, index,
+                                       maxlen, buffer);
+   result.required_size = result.length;
+   return result;
+}
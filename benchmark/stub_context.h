@@ -0,0 +1,61 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Stub RMCIOS context for driving channel class functions outside of
+ * the RMCIOS runtime.
+ */
+#ifndef STUB_CONTEXT_H
+#define STUB_CONTEXT_H
+
+#include "RMCIOS-functions.h"
+
+// Called for data written to the linked channels of a channel.
+typedef void (*stub_sink) (void *arg, int sender, const char *data,
+                           int length, int num_values);
+
+extern const struct context_rmcios stub_context;
+
+// Find channel by name. Returns 0 when not found.
+int stub_channel (const char *name);
+
+// Call channel function with string parameters.
+// Returned value (if any) is written as text to ret.
+int stub_call (int id, enum function_rmcios function, int num_params,
+               const char *const *params, char *ret, int retlen);
+
+// Write binary buffer parameters to channel.
+void stub_write_buffer (int id, const char *data, int length);
+void stub_write_buffers (int id, int num_params, const char *const *data,
+                         const int *lengths);
+
+// Direct data written to linked channels of id to sink.
+void stub_link (int id, stub_sink sink, void *arg);
+
+#endif
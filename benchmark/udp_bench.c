@@ -0,0 +1,202 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * UDP receive benchmark over loopback.
+ *
+ * Sends datagrams to an udpclient channel and counts the datagrams the
+ * channel delivers to its linked channels. The same load is run against
+ * a receive loop equivalent to the old per-datagram recvfrom + Sleep(10)
+ * implementation for comparison.
+ *
+ * usage: udp_bench [packets] [payload_bytes] [rate_per_s (0=unpaced)]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stub_context.h"
+#include "socket_reactor.h"
+
+void init_socket_channels (const struct context_rmcios *context);
+
+static volatile long received;
+static volatile int legacy_running;
+
+static void count_sink (void *arg, int sender, const char *data, int length,
+                        int num_values)
+{
+   __atomic_fetch_add (&received, 1, __ATOMIC_RELAXED);
+}
+
+static SOCKET udp_socket (int port)
+{
+   struct sockaddr_in local;
+   SOCKET s = socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+   memset (&local, 0, sizeof (local));
+   local.sin_family = AF_INET;
+   local.sin_addr.s_addr = inet_addr ("127.0.0.1");
+   local.sin_port = htons (port);
+   bind (s, (struct sockaddr *) &local, sizeof (local));
+   return s;
+}
+
+static int local_port (SOCKET s)
+{
+   struct sockaddr_in local;
+   socklen_t len = sizeof (local);
+   getsockname (s, (struct sockaddr *) &local, &len);
+   return ntohs (local.sin_port);
+}
+
+// Receive loop of the previous udpclient implementation
+static IO_THREAD_FUNC (legacy_thread, arg)
+{
+   SOCKET s = *(SOCKET *) arg;
+   char buffer[1500];
+   struct sockaddr_in from;
+   socklen_t slen = sizeof (from);
+   while (legacy_running)
+   {
+      if (recvfrom (s, buffer, sizeof (buffer), 0,
+                    (struct sockaddr *) &from, &slen) != SOCKET_ERROR)
+      {
+         __atomic_fetch_add (&received, 1, __ATOMIC_RELAXED);
+      }
+      io_sleep_ms (10);
+   }
+   IO_THREAD_RETURN;
+}
+
+// Send packets to destination and wait until the receiver goes quiet.
+// Returns elapsed seconds from first send to last receive.
+static double run_load (SOCKET tx, struct sockaddr_in *to, long packets,
+                        int payload, long rate)
+{
+   char data[65536];
+   uint64_t start, last_change;
+   long i, last_count = -1;
+   memset (data, 'x', payload);
+
+   received = 0;
+   start = io_clock_ns ();
+   last_change = start;
+   for (i = 0; i < packets; i++)
+   {
+      if (rate > 0)
+      {
+         uint64_t due = start + (uint64_t) i * 1000000000ULL / rate;
+         while (io_clock_ns () < due);
+      }
+      sendto (tx, data, payload, 0, (struct sockaddr *) to, sizeof (*to));
+   }
+
+   // Wait until no more datagrams arrive for 200ms
+   while (1)
+   {
+      long now_count = received;
+      uint64_t now = io_clock_ns ();
+      if (now_count != last_count)
+      {
+         last_count = now_count;
+         last_change = now;
+      }
+      else if (now - last_change > 200000000ULL)
+         break;
+      io_sleep_ms (1);
+   }
+   return (last_change - start) / 1e9;
+}
+
+static void report (const char *name, long packets, double seconds)
+{
+   printf ("%-24s sent %8ld  received %8ld  dropped %8ld  %10.0f packets/s\n",
+           name, packets, received, packets - received,
+           seconds > 0 ? received / seconds : 0.0);
+}
+
+int main (int argc, char *argv[])
+{
+   long packets = argc > 1 ? atol (argv[1]) : 100000;
+   int payload = argc > 2 ? atoi (argv[2]) : 64;
+   long rate = argc > 3 ? atol (argv[3]) : 0;
+   struct sockaddr_in to;
+   SOCKET tx, legacy_rx;
+   double seconds;
+   char port[16];
+   int id;
+
+#ifdef _WIN32
+   WSADATA wsa;
+   WSAStartup (MAKEWORD (2, 2), &wsa);
+#endif
+   if (payload > 1500)
+      payload = 1500;
+   init_socket_channels (&stub_context);
+
+   tx = udp_socket (0);
+   memset (&to, 0, sizeof (to));
+   to.sin_family = AF_INET;
+   to.sin_addr.s_addr = inet_addr ("127.0.0.1");
+
+   printf ("%ld datagrams of %d bytes, rate %s\n", packets, payload,
+           rate > 0 ? argv[3] : "unpaced");
+
+   // Old implementation: recvfrom + Sleep(10) per datagram
+   legacy_rx = udp_socket (0);
+   legacy_running = 1;
+   io_thread_start (legacy_thread, &legacy_rx);
+   to.sin_port = htons (local_port (legacy_rx));
+   seconds = run_load (tx, &to, packets, payload, rate);
+   report ("per-datagram + sleep", packets, seconds);
+   legacy_running = 0;
+
+   // udpclient channel with batched receive
+   {
+      const char *create[] = { "bench_udp" };
+      const char *setup[] = { "127.0.0.1", port };
+      char buffer[64];
+      struct sockaddr_in from;
+      socklen_t slen = sizeof (from);
+
+      stub_call (stub_channel ("udpclient"), create_rmcios, 1, create, 0, 0);
+      id = stub_channel ("bench_udp");
+      stub_link (id, count_sink, NULL);
+      snprintf (port, sizeof (port), "%d", local_port (tx));
+      stub_call (id, setup_rmcios, 2, setup, 0, 0);
+
+      // Learn channel port from its first datagram
+      stub_write_buffer (id, "hello", 5);
+      recvfrom (tx, buffer, sizeof (buffer), 0, (struct sockaddr *) &from,
+                &slen);
+      to.sin_port = from.sin_port;
+      seconds = run_load (tx, &to, packets, payload, rate);
+      report ("udpclient batched", packets, seconds);
+   }
+   return 0;
+}
@@ -0,0 +1,497 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Stream framing stage.
+ *
+ * Changelog: (date,who,description)
+ */
+#include "framing.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define SLIP_END ((char) 0xC0)
+#define SLIP_ESC ((char) 0xDB)
+#define SLIP_ESC_END ((char) 0xDC)
+#define SLIP_ESC_ESC ((char) 0xDD)
+
+void frame_config_init (struct frame_config *config)
+{
+   struct frame_settings *c = &config->settings;
+   io_mutex_init (&config->lock);
+   c->generation = 0;
+   c->mode = FRAME_NONE;
+   c->delimiter[0] = '\n';
+   c->delimiter_length = 1;
+   c->length = 0;
+   c->max_frame = FRAME_DEFAULT_MAX;
+}
+
+// Decode \n \r \t \0 \\ and \xHH escapes of delimiter string
+static int frame_unescape (const char *s, char *out, int max)
+{
+   int n = 0;
+   while (*s != 0 && n < max)
+   {
+      if (*s != '\\' || s[1] == 0)
+      {
+         out[n++] = *s++;
+         continue;
+      }
+      s++;
+      switch (*s)
+      {
+      case 'n':
+         out[n++] = '\n';
+         break;
+      case 'r':
+         out[n++] = '\r';
+         break;
+      case 't':
+         out[n++] = '\t';
+         break;
+      case '0':
+         out[n++] = 0;
+         break;
+      case 'x':
+         out[n++] = (char) strtol (s + 1, NULL, 16);
+         while (s[1] != 0 && strchr ("0123456789abcdefABCDEF", s[1]) != NULL)
+            s++;
+         break;
+      default:
+         out[n++] = *s;
+         break;
+      }
+      s++;
+   }
+   return n;
+}
+
+int frame_config_set (struct frame_config *config, int mode,
+                      const char *arg, int max_frame)
+{
+   struct frame_settings *c;
+   char delimiter[FRAME_DELIMITER_MAX];
+   int delimiter_length = 0;
+   int length = 0;
+
+   switch (mode)
+   {
+   case FRAME_NONE:
+   case FRAME_SLIP:
+   case FRAME_COBS:
+      break;
+   case FRAME_LINE:
+      if (arg != NULL)
+         delimiter_length = frame_unescape (arg, delimiter,
+                                            sizeof (delimiter));
+      if (delimiter_length == 0)
+      {
+         delimiter[0] = '\n';
+         delimiter_length = 1;
+      }
+      break;
+   case FRAME_FIXED:
+      length = arg != NULL ? atoi (arg) : 0;
+      if (length <= 0)
+         return -1;
+      break;
+   case FRAME_PREFIX:
+   case FRAME_PREFIX_LE:
+      length = arg != NULL ? atoi (arg) : 2;
+      if (length != 1 && length != 2 && length != 4)
+         return -1;
+      break;
+   case FRAME_GAP:
+      length = arg != NULL ? atoi (arg) : 0;
+      if (length < 0)
+         return -1;
+      break;
+   default:
+      return -1;
+   }
+   if (max_frame <= 0)
+      max_frame = FRAME_DEFAULT_MAX;
+   if (mode == FRAME_FIXED && max_frame < length)
+      max_frame = length;
+
+   io_mutex_lock (&config->lock);
+   c = &config->settings;
+   c->mode = mode;
+   if (delimiter_length > 0)
+   {
+      memcpy (c->delimiter, delimiter, delimiter_length);
+      c->delimiter_length = delimiter_length;
+   }
+   c->length = length;
+   c->max_frame = max_frame;
+   __atomic_add_fetch (&c->generation, 1, __ATOMIC_RELEASE);
+   io_mutex_unlock (&config->lock);
+   return 0;
+}
+
+int frame_mode_from_name (const char *name)
+{
+   static const char *names[] = {
+      "none", "line", "fixed", "prefix", "prefixle", "slip", "cobs", "gap"
+   };
+   int i;
+   for (i = 0; i < (int) (sizeof (names) / sizeof (names[0])); i++)
+   {
+      if (strcmp (name, names[i]) == 0)
+         return i;
+   }
+   return -1;
+}
+
+void framer_init (struct framer *f, struct frame_config *config,
+                  frame_emit emit, void *arg)
+{
+   memset (f, 0, sizeof (*f));
+   f->config = config;
+   f->emit = emit;
+   f->arg = arg;
+   io_mutex_lock (&config->lock);
+   f->active = config->settings;
+   io_mutex_unlock (&config->lock);
+}
+
+void framer_reset (struct framer *f)
+{
+   f->length = 0;
+   f->scanned = 0;
+   f->discard = 0;
+}
+
+void framer_free (struct framer *f)
+{
+   free (f->buffer);
+   f->buffer = NULL;
+   f->size = 0;
+   framer_reset (f);
+}
+
+// Decode SLIP frame in place. Returns decoded length or -1.
+static int slip_decode (char *p, int n)
+{
+   char *esc = (char *) memchr (p, SLIP_ESC, n);
+   int i, o;
+   if (esc == NULL)
+      return n;
+   o = (int) (esc - p);
+   for (i = o; i < n; i++)
+   {
+      char ch = p[i];
+      if (ch == SLIP_ESC)
+      {
+         if (++i >= n)
+            return -1;
+         if (p[i] == SLIP_ESC_END)
+            ch = SLIP_END;
+         else if (p[i] == SLIP_ESC_ESC)
+            ch = SLIP_ESC;
+         else
+            return -1;
+      }
+      p[o++] = ch;
+   }
+   return o;
+}
+
+// Decode COBS frame (without the zero terminator) in place.
+static int cobs_decode (char *p, int n)
+{
+   int i = 0, o = 0;
+   while (i < n)
+   {
+      int code = (unsigned char) p[i++];
+      if (code == 0 || i + code - 1 > n)
+         return -1;
+      memmove (p + o, p + i, code - 1);
+      o += code - 1;
+      i += code - 1;
+      if (code < 0xFF && i < n)
+         p[o++] = 0;
+   }
+   return o;
+}
+
+// Find end of delimited frame starting from offset from.
+// Returns index of the last delimiter byte or -1.
+static int frame_find_end (const struct frame_settings *c, const char *p,
+                           int n, int from)
+{
+   const char *delimiter;
+   int dlen;
+   char last;
+
+   switch (c->mode)
+   {
+   case FRAME_SLIP:
+      delimiter = "\xC0";
+      dlen = 1;
+      break;
+   case FRAME_COBS:
+      delimiter = "";
+      dlen = 1;
+      break;
+   default:
+      delimiter = c->delimiter;
+      dlen = c->delimiter_length;
+      break;
+   }
+   last = delimiter[dlen - 1];
+   while (from < n)
+   {
+      const char *end = (const char *) memchr (p + from, last, n - from);
+      int pos;
+      if (end == NULL)
+         return -1;
+      pos = (int) (end - p);
+      if (pos + 1 >= dlen && memcmp (end + 1 - dlen, delimiter, dlen) == 0)
+         return pos;
+      from = pos + 1;
+   }
+   return -1;
+}
+
+// Emit complete frames from p. scanned bytes at start are known to
+// hold no delimiter. Returns bytes consumed.
+static int framer_parse (struct framer *f, char *p, int n, int scanned)
+{
+   const struct frame_settings *c = &f->active;
+   int used = 0;
+
+   while (used < n)
+   {
+      char *start = p + used;
+      int avail = n - used;
+      int frame_length;
+      int end;
+
+      switch (c->mode)
+      {
+      case FRAME_FIXED:
+         if (avail < c->length)
+            return used;
+         f->frames++;
+         f->emit (f->arg, start, c->length);
+         used += c->length;
+         break;
+
+      case FRAME_PREFIX:
+      case FRAME_PREFIX_LE:
+         {
+            unsigned char *h = (unsigned char *) start;
+            unsigned long l = 0;
+            int i;
+            if (avail < c->length)
+               return used;
+            for (i = 0; i < c->length; i++)
+            {
+               if (c->mode == FRAME_PREFIX)
+                  l = (l << 8) | h[i];
+               else
+                  l |= (unsigned long) h[i] << (8 * i);
+            }
+            if (l > (unsigned long) c->max_frame)
+            {
+               // Stream can not be resynchronized. Drop what we have.
+               f->errors++;
+               f->dropped_bytes += n - used;
+               return n;
+            }
+            frame_length = (int) l;
+            if (avail < c->length + frame_length)
+               return used;
+            f->frames++;
+            f->emit (f->arg, start + c->length, frame_length);
+            used += c->length + frame_length;
+         }
+         break;
+
+      default:                 // Delimited modes
+         end = frame_find_end (c, start, avail, scanned);
+         scanned = 0;
+         if (end < 0)
+            return used;
+         frame_length = end + 1 - (c->mode == FRAME_LINE ?
+                                   c->delimiter_length : 1);
+         used += end + 1;
+         if (f->discard)
+         {
+            f->discard = 0;
+            f->dropped_bytes += end + 1;
+            break;
+         }
+         if (c->mode == FRAME_SLIP)
+            frame_length = slip_decode (start, frame_length);
+         else if (c->mode == FRAME_COBS)
+            frame_length = cobs_decode (start, frame_length);
+         if (frame_length < 0)
+         {
+            f->errors++;
+            f->dropped_bytes += end + 1;
+            break;
+         }
+         // SLIP and COBS senders may separate frames with empty ones
+         if (frame_length == 0 && c->mode != FRAME_LINE)
+            break;
+         f->frames++;
+         f->emit (f->arg, start, frame_length);
+         break;
+      }
+   }
+   return used;
+}
+
+// Append to partial frame buffer
+static int framer_append (struct framer *f, const char *data, int length)
+{
+   if (f->length + length > f->size)
+   {
+      int size = f->size > 0 ? f->size * 2 : 256;
+      char *buffer;
+      while (size < f->length + length)
+         size *= 2;
+      buffer = (char *) realloc (f->buffer, size);
+      if (buffer == NULL)
+         return -1;
+      f->buffer = buffer;
+      f->size = size;
+   }
+   memcpy (f->buffer + f->length, data, length);
+   f->length += length;
+   return 0;
+}
+
+// Longest partial frame that can still complete within max_frame:
+// frame with its length prefix, or with all but the last byte of its
+// terminator.
+static int framer_partial_max (const struct frame_settings *c)
+{
+   switch (c->mode)
+   {
+   case FRAME_PREFIX:
+   case FRAME_PREFIX_LE:
+      return c->max_frame + c->length - 1;
+   case FRAME_LINE:
+      return c->max_frame + c->delimiter_length - 1;
+   default:
+      return c->max_frame;
+   }
+}
+
+void framer_push (struct framer *f, char *data, int length)
+{
+   int used;
+
+   if (f->active.generation != __atomic_load_n (&f->config->settings.generation,
+                                                __ATOMIC_ACQUIRE))
+   {
+      io_mutex_lock (&f->config->lock);
+      f->active = f->config->settings;
+      io_mutex_unlock (&f->config->lock);
+      framer_reset (f);
+   }
+   if (f->active.mode == FRAME_NONE)
+   {
+      f->frames++;
+      f->emit (f->arg, data, length);
+      return;
+   }
+   if (f->active.mode == FRAME_GAP)
+   {
+      // Whole frame is collected until the line goes idle
+      if (!f->discard && f->length + length > f->active.max_frame)
+      {
+         f->dropped_bytes += f->length;
+         f->length = 0;
+         f->discard = 1;
+      }
+      if (f->discard || framer_append (f, data, length) != 0)
+         f->dropped_bytes += length;
+      return;
+   }
+
+   // Frames complete in the received data are emitted without copying.
+   // Only the partial frame at the end is buffered.
+   if (f->length == 0)
+   {
+      used = framer_parse (f, data, length, 0);
+      data += used;
+      length -= used;
+      if (length == 0)
+         return;
+      if (framer_append (f, data, length) != 0)
+      {
+         f->errors++;
+         f->dropped_bytes += length;
+         return;
+      }
+   }
+   else
+   {
+      if (framer_append (f, data, length) != 0)
+      {
+         f->errors++;
+         f->dropped_bytes += f->length + length;
+         framer_reset (f);
+         return;
+      }
+      used = framer_parse (f, f->buffer, f->length, f->scanned);
+      f->length -= used;
+      if (f->length > 0 && used > 0)
+         memmove (f->buffer, f->buffer + used, f->length);
+   }
+   f->scanned = f->length;
+
+   // Partial frame that can not complete within max_frame
+   if (f->length > framer_partial_max (&f->active))
+   {
+      f->dropped_bytes += f->length;
+      f->discard = f->active.mode != FRAME_FIXED
+                   && f->active.mode != FRAME_PREFIX
+                   && f->active.mode != FRAME_PREFIX_LE;
+      f->length = 0;
+      f->scanned = 0;
+   }
+}
+
+void framer_flush (struct framer *f)
+{
+   if (f->active.mode != FRAME_GAP)
+      return;
+   if (f->length > 0 && !f->discard)
+   {
+      f->frames++;
+      f->emit (f->arg, f->buffer, f->length);
+   }
+   framer_reset (f);
+}
@@ -0,0 +1,129 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Stream framing stage.
+ * Splits received byte stream into complete frames: delimited lines,
+ * fixed length, 1/2/4 byte length prefix, SLIP, COBS and frames ended by
+ * an idle gap detected by the caller.
+ *
+ * Frames that are complete in the received data are passed to the
+ * emit callback without copying. Only a partial frame at the end of the
+ * data is kept in a growable buffer owned by the framer. SLIP and COBS
+ * frames are decoded in place, so pushed data must be writable.
+ *
+ * Changelog: (date,who,description)
+ */
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include "io_platform.h"
+
+#define FRAME_NONE 0            // Pass received data through
+#define FRAME_LINE 1            // Delimiter terminated, delimiter removed
+#define FRAME_FIXED 2           // Fixed number of bytes
+#define FRAME_PREFIX 3          // Length prefix, big endian
+#define FRAME_PREFIX_LE 4       // Length prefix, little endian
+#define FRAME_SLIP 5            // RFC 1055 SLIP
+#define FRAME_COBS 6            // COBS, zero byte terminated
+#define FRAME_GAP 7             // Ended by idle line, see framer_flush
+
+#define FRAME_DELIMITER_MAX 8
+#define FRAME_DEFAULT_MAX 65536
+
+// Framing settings. Plain data, copied to every framer.
+struct frame_settings
+{
+   int generation;              // Incremented on every change
+   int mode;
+   char delimiter[FRAME_DELIMITER_MAX];
+   int delimiter_length;
+   int length;                  // Fixed frame length, prefix bytes or gap us
+   int max_frame;               // Longer frames are dropped
+};
+
+// Framing configuration shared by all connections of a channel.
+struct frame_config
+{
+   io_mutex lock;               // Guards settings. Never copied.
+   struct frame_settings settings;
+};
+
+typedef void (*frame_emit) (void *arg, char *data, int length);
+
+// Per connection framing state.
+struct framer
+{
+   struct frame_config *config;
+   struct frame_settings active;        // Copy of settings in use
+   frame_emit emit;
+   void *arg;
+   char *buffer;
+   int length;
+   int size;
+   int scanned;                 // Buffered bytes known to hold no delimiter
+   int discard;                 // Dropping rest of oversized frame
+   long long frames;
+   long long dropped_bytes;
+   long long errors;
+};
+
+void frame_config_init (struct frame_config *config);
+
+// Set new configuration. mode is one of FRAME_*.
+// arg is delimiter for FRAME_LINE, frame length for FRAME_FIXED,
+// prefix bytes (1,2,4) for FRAME_PREFIX* and idle gap in microseconds
+// for FRAME_GAP (0 = chosen by caller). Returns 0 on success.
+int frame_config_set (struct frame_config *config, int mode,
+                      const char *arg, int max_frame);
+
+// Mode from name: none line fixed prefix prefixle slip cobs gap.
+// -1 if unknown.
+int frame_mode_from_name (const char *name);
+
+void framer_init (struct framer *f, struct frame_config *config,
+                  frame_emit emit, void *arg);
+
+// Discard partial frame. Call when the connection is (re)established.
+void framer_reset (struct framer *f);
+void framer_free (struct framer *f);
+
+// Feed received data. Calls emit for every complete frame.
+void framer_push (struct framer *f, char *data, int length);
+
+// Idle gap seen on the line. Emits buffered FRAME_GAP frame.
+void framer_flush (struct framer *f);
+
+// Partial frame is buffered or being dropped
+static inline int framer_pending (const struct framer *f)
+{
+   return f->length > 0 || f->discard;
+}
+
+#endif
@@ -0,0 +1,225 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Thin threading and timing layer shared by the I/O modules.
+ * Win32 API on windows, pthreads on POSIX systems.
+ *
+ * Changelog: (date,who,description)
+ */
+#ifndef IO_PLATFORM_H
+#define IO_PLATFORM_H
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Threads
+////////////////////////////////////////////////////////////////////////
+#ifdef _WIN32
+#define IO_THREAD_FUNC(name, arg) DWORD WINAPI name (LPVOID arg)
+#define IO_THREAD_RETURN return 0
+
+typedef LPTHREAD_START_ROUTINE io_thread_func;
+
+static inline int io_thread_start (io_thread_func func, void *arg)
+{
+   DWORD threadID;
+   HANDLE h = CreateThread (0, 0, func, arg, 0, &threadID);
+   if (h == NULL)
+      return -1;
+   CloseHandle (h);
+   return 0;
+}
+
+static inline void io_sleep_ms (int ms)
+{
+   Sleep (ms);
+}
+
+static inline int io_cpu_count (void)
+{
+   SYSTEM_INFO info;
+   GetSystemInfo (&info);
+   return info.dwNumberOfProcessors;
+}
+
+#else
+#define IO_THREAD_FUNC(name, arg) void *name (void *arg)
+#define IO_THREAD_RETURN return NULL
+
+typedef void *(*io_thread_func) (void *);
+
+static inline int io_thread_start (io_thread_func func, void *arg)
+{
+   pthread_t thread;
+   if (pthread_create (&thread, NULL, func, arg) != 0)
+      return -1;
+   pthread_detach (thread);
+   return 0;
+}
+
+static inline void io_sleep_ms (int ms)
+{
+   struct timespec ts;
+   ts.tv_sec = ms / 1000;
+   ts.tv_nsec = (ms % 1000) * 1000000L;
+   nanosleep (&ts, NULL);
+}
+
+static inline int io_cpu_count (void)
+{
+   long n = sysconf (_SC_NPROCESSORS_ONLN);
+   return n > 0 ? (int) n : 1;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Mutex
+////////////////////////////////////////////////////////////////////////
+#ifdef _WIN32
+typedef CRITICAL_SECTION io_mutex;
+#define io_mutex_init(m) InitializeCriticalSection (m)
+#define io_mutex_lock(m) EnterCriticalSection (m)
+#define io_mutex_unlock(m) LeaveCriticalSection (m)
+#else
+typedef pthread_mutex_t io_mutex;
+#define io_mutex_init(m) pthread_mutex_init ((m), NULL)
+#define io_mutex_lock(m) pthread_mutex_lock (m)
+#define io_mutex_unlock(m) pthread_mutex_unlock (m)
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Auto-reset event
+////////////////////////////////////////////////////////////////////////
+#ifdef _WIN32
+typedef HANDLE io_event;
+
+static inline void io_event_init (io_event * e)
+{
+   *e = CreateEvent (NULL, FALSE, FALSE, NULL);
+}
+
+static inline void io_event_set (io_event * e)
+{
+   SetEvent (*e);
+}
+
+// Returns 1 when signaled, 0 on timeout. timeout_ms < 0 waits forever.
+static inline int io_event_wait (io_event * e, int timeout_ms)
+{
+   return WaitForSingleObject (*e, timeout_ms < 0 ? INFINITE : timeout_ms)
+          == WAIT_OBJECT_0;
+}
+#else
+typedef struct
+{
+   pthread_mutex_t mutex;
+   pthread_cond_t cond;
+   int signaled;
+} io_event;
+
+static inline void io_event_init (io_event * e)
+{
+   pthread_condattr_t attr;
+   pthread_condattr_init (&attr);
+   pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+   pthread_mutex_init (&e->mutex, NULL);
+   pthread_cond_init (&e->cond, &attr);
+   pthread_condattr_destroy (&attr);
+   e->signaled = 0;
+}
+
+static inline void io_event_set (io_event * e)
+{
+   pthread_mutex_lock (&e->mutex);
+   e->signaled = 1;
+   pthread_cond_signal (&e->cond);
+   pthread_mutex_unlock (&e->mutex);
+}
+
+// Returns 1 when signaled, 0 on timeout. timeout_ms < 0 waits forever.
+static inline int io_event_wait (io_event * e, int timeout_ms)
+{
+   int signaled;
+   struct timespec deadline;
+   clock_gettime (CLOCK_MONOTONIC, &deadline);
+   deadline.tv_sec += timeout_ms / 1000;
+   deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+   if (deadline.tv_nsec >= 1000000000L)
+   {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+   }
+   pthread_mutex_lock (&e->mutex);
+   while (!e->signaled)
+   {
+      if (timeout_ms < 0)
+         pthread_cond_wait (&e->cond, &e->mutex);
+      else if (pthread_cond_timedwait (&e->cond, &e->mutex, &deadline) != 0)
+         break;
+   }
+   signaled = e->signaled;
+   e->signaled = 0;
+   pthread_mutex_unlock (&e->mutex);
+   return signaled;
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Monotonic clock in nanoseconds.
+// Uses the performance counter on windows.
+////////////////////////////////////////////////////////////////////////
+static inline uint64_t io_clock_ns (void)
+{
+#ifdef _WIN32
+   static LARGE_INTEGER frequency;
+   LARGE_INTEGER now;
+   if (frequency.QuadPart == 0)
+      QueryPerformanceFrequency (&frequency);
+   QueryPerformanceCounter (&now);
+   return (uint64_t) (now.QuadPart / frequency.QuadPart) * 1000000000ULL +
+          (uint64_t) (now.QuadPart % frequency.QuadPart) * 1000000000ULL /
+          frequency.QuadPart;
+#else
+   struct timespec ts;
+   clock_gettime (CLOCK_MONOTONIC, &ts);
+   return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+#endif
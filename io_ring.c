@@ -0,0 +1,143 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Single producer, single consumer byte ring buffer implementation.
+ *
+ * head and tail are running byte counts, storage offsets are taken
+ * modulo the storage size. The producer marks writes with the epoch
+ * counter so the consumer can free replaced storage once no write can
+ * still be using it.
+ *
+ * Changelog: (date,who,description)
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "io_ring.h"
+
+void io_ring_init (struct io_ring *r)
+{
+   memset (r, 0, sizeof (*r));
+}
+
+int io_ring_resize (struct io_ring *r, int size)
+{
+   struct io_ring_buf *buf = NULL;
+   struct io_ring_buf *old;
+   unsigned epoch;
+
+   if (size < 0)
+      size = 0;
+   if (size == io_ring_size (r))
+   {
+      io_ring_reset (r);
+      return 0;
+   }
+   if (size > 0)
+   {
+      buf = (struct io_ring_buf *) malloc (sizeof (*buf) + size);
+      if (buf == NULL)
+         return -1;
+      buf->size = size;
+   }
+
+   old = __atomic_exchange_n (&r->buf, buf, __ATOMIC_SEQ_CST);
+   // A write that started before the exchange may still use old storage.
+   // Writes starting after it see the new storage.
+   epoch = __atomic_load_n (&r->epoch, __ATOMIC_SEQ_CST);
+   while ((epoch & 1)
+          && __atomic_load_n (&r->epoch, __ATOMIC_SEQ_CST) == epoch)
+      io_sleep_ms (0);
+   free (old);
+   io_ring_reset (r);
+   return 0;
+}
+
+int io_ring_size (struct io_ring *r)
+{
+   struct io_ring_buf *buf = __atomic_load_n (&r->buf, __ATOMIC_RELAXED);
+   return buf == NULL ? 0 : buf->size;
+}
+
+int io_ring_write (struct io_ring *r, const char *data, int length)
+{
+   struct io_ring_buf *buf;
+   int dropped = 0;
+
+   if (__atomic_load_n (&r->buf, __ATOMIC_RELAXED) == NULL)
+      return 0;
+
+   __atomic_add_fetch (&r->epoch, 1, __ATOMIC_SEQ_CST);
+   buf = __atomic_load_n (&r->buf, __ATOMIC_SEQ_CST);
+   if (buf != NULL)
+   {
+      uint64_t head = __atomic_load_n (&r->head, __ATOMIC_RELAXED);
+      uint64_t used = head - __atomic_load_n (&r->tail, __ATOMIC_ACQUIRE);
+      int space = used < (uint64_t) buf->size ? buf->size - (int) used : 0;
+      int offset = (int) (head % buf->size);
+      int stored = length < space ? length : space;
+      int first = stored < buf->size - offset ? stored : buf->size - offset;
+
+      memcpy (buf->data + offset, data, first);
+      memcpy (buf->data, data + first, stored - first);
+      __atomic_store_n (&r->head, head + stored, __ATOMIC_RELEASE);
+      dropped = length - stored;
+   }
+   __atomic_add_fetch (&r->epoch, 1, __ATOMIC_RELEASE);
+   return dropped;
+}
+
+int io_ring_peek (struct io_ring *r, const char *parts[2], int lengths[2])
+{
+   struct io_ring_buf *buf = r->buf;
+   uint64_t tail = r->tail;
+   uint64_t used;
+   int offset;
+
+   parts[0] = parts[1] = NULL;
+   lengths[0] = lengths[1] = 0;
+   if (buf == NULL)
+      return 0;
+   used = __atomic_load_n (&r->head, __ATOMIC_ACQUIRE) - tail;
+   if (used > (uint64_t) buf->size)
+      used = buf->size;
+   offset = (int) (tail % buf->size);
+   parts[0] = buf->data + offset;
+   lengths[0] = (int) used < buf->size - offset ? 
+                (int) used : buf->size - offset;
+   parts[1] = buf->data;
+   lengths[1] = (int) used - lengths[0];
+   return (int) used;
+}
+
+void io_ring_reset (struct io_ring *r)
+{
+   __atomic_store_n (&r->tail, __atomic_load_n (&r->head, __ATOMIC_ACQUIRE),
+                     __ATOMIC_RELEASE);
+}
@@ -0,0 +1,81 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Single producer, single consumer byte ring buffer.
+ *
+ * The producer (a receive thread) appends data without locks and never
+ * waits for the consumer: data that does not fit is dropped and
+ * reported to the caller. The consumer reads the buffered data in place
+ * and resets or resizes the ring. Consumer functions must not be called
+ * concurrently with each other.
+ *
+ * Changelog: (date,who,description)
+ */
+#ifndef IO_RING_H
+#define IO_RING_H
+
+#include "io_platform.h"
+
+struct io_ring_buf
+{
+   int size;
+   char data[];
+};
+
+struct io_ring
+{
+   struct io_ring_buf *buf;     // NULL when disabled
+   uint64_t head;               // Bytes written. Updated by producer.
+   uint64_t tail;               // Bytes consumed. Updated by consumer.
+   unsigned epoch;              // Odd while producer is writing
+};
+
+void io_ring_init (struct io_ring *r);
+
+// Replace storage with size bytes and discard contents. 0 disables the
+// ring. Waits for a write in progress to finish before freeing the old
+// storage. Consumer side. Returns 0 on success, -1 when out of memory.
+int io_ring_resize (struct io_ring *r, int size);
+
+// Storage size in bytes. 0 when disabled.
+int io_ring_size (struct io_ring *r);
+
+// Append data. Producer side. Returns number of bytes that did not fit.
+int io_ring_write (struct io_ring *r, const char *data, int length);
+
+// Buffered data as two contiguous parts, the second part is used when
+// data wraps around the end of storage. Consumer side.
+// Returns total buffered bytes.
+int io_ring_peek (struct io_ring *r, const char *parts[2], int lengths[2]);
+
+// Discard buffered data. Consumer side.
+void io_ring_reset (struct io_ring *r);
+
+#endif
@@ -0,0 +1,130 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * I/O channel statistics implementation.
+ *
+ * Changelog: (date,who,description)
+ */
+#include <stdio.h>
+#include "io_stats.h"
+
+static int io_histogram_index (uint64_t value)
+{
+   int magnitude, shift;
+   if (value < IO_HIST_SUB)
+      return (int) value;
+   if (value >> IO_HIST_MAGNITUDES)
+      value = (1ULL << IO_HIST_MAGNITUDES) - 1;
+   magnitude = 63 - __builtin_clzll (value);
+   shift = magnitude - IO_HIST_SUB_BITS;
+   return (shift + 1) * IO_HIST_SUB 
+          + (int) (value >> shift) - IO_HIST_SUB;
+}
+
+// Middle of the value range of bucket
+static uint64_t io_histogram_value (int index)
+{
+   int shift;
+   if (index < IO_HIST_SUB)
+      return index;
+   shift = index / IO_HIST_SUB - 1;
+   return ((uint64_t) (IO_HIST_SUB + index % IO_HIST_SUB) << shift)
+          + ((1ULL << shift) >> 1);
+}
+
+void io_histogram_record (struct io_histogram *h, uint64_t value)
+{
+   uint64_t max = __atomic_load_n (&h->max, __ATOMIC_RELAXED);
+   __atomic_fetch_add (&h->counts[io_histogram_index (value)], 1,
+                       __ATOMIC_RELAXED);
+   __atomic_fetch_add (&h->total, 1, __ATOMIC_RELAXED);
+   while (value > max
+          && !__atomic_compare_exchange_n (&h->max, &max, value, 1,
+                                           __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED));
+}
+
+uint64_t io_histogram_percentile (const struct io_histogram *h, double p)
+{
+   uint64_t total = __atomic_load_n (&h->total, __ATOMIC_RELAXED);
+   uint64_t rank, seen = 0;
+   int i;
+   if (total == 0)
+      return 0;
+   rank = (uint64_t) (p * total);
+   if (rank >= total)
+      rank = total - 1;
+   for (i = 0; i < IO_HIST_BUCKETS; i++)
+   {
+      seen += __atomic_load_n (&h->counts[i], __ATOMIC_RELAXED);
+      if (seen > rank)
+      {
+         uint64_t value = io_histogram_value (i);
+         uint64_t max = __atomic_load_n (&h->max, __ATOMIC_RELAXED);
+         return value < max ? value : max;
+      }
+   }
+   return __atomic_load_n (&h->max, __ATOMIC_RELAXED);
+}
+
+int io_histogram_format (const struct io_histogram *h, char *text, int size)
+{
+   return snprintf (text, size, "%.1f %.1f %.1f %.1f %.1f %llu",
+                    io_histogram_percentile (h, 0.5) / 1000.0,
+                    io_histogram_percentile (h, 0.9) / 1000.0,
+                    io_histogram_percentile (h, 0.99) / 1000.0,
+                    io_histogram_percentile (h, 0.999) / 1000.0,
+                    __atomic_load_n (&h->max, __ATOMIC_RELAXED) / 1000.0,
+                    (unsigned long long) 
+                    __atomic_load_n (&h->total, __ATOMIC_RELAXED));
+}
+
+// Clear field by field: reactor threads may be recording concurrently
+static void io_histogram_reset (struct io_histogram *h)
+{
+   int i;
+   for (i = 0; i < IO_HIST_BUCKETS; i++)
+      __atomic_store_n (&h->counts[i], 0, __ATOMIC_RELAXED);
+   __atomic_store_n (&h->total, 0, __ATOMIC_RELAXED);
+   __atomic_store_n (&h->max, 0, __ATOMIC_RELAXED);
+}
+
+void io_stats_reset (struct io_stats *s)
+{
+   __atomic_store_n (&s->bytes_in, 0, __ATOMIC_RELAXED);
+   __atomic_store_n (&s->packets_in, 0, __ATOMIC_RELAXED);
+   __atomic_store_n (&s->bytes_out, 0, __ATOMIC_RELAXED);
+   __atomic_store_n (&s->packets_out, 0, __ATOMIC_RELAXED);
+   __atomic_store_n (&s->send_errors, 0, __ATOMIC_RELAXED);
+   __atomic_store_n (&s->drops, 0, __ATOMIC_RELAXED);
+   io_histogram_reset (&s->dispatch);
+   io_histogram_reset (&s->processing);
+   io_histogram_reset (&s->hold);
+}
@@ -0,0 +1,125 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * I/O channel statistics.
+ *
+ * Message and byte counters plus log-linear latency histograms in the
+ * style of HdrHistogram: every power of two is split into
+ * IO_HIST_SUB linear sub-buckets, so recorded values keep a relative
+ * precision of 1/IO_HIST_SUB over the whole range. Counters are updated
+ * with relaxed atomic adds and can be recorded from any thread without
+ * locks.
+ *
+ * Changelog: (date,who,description)
+ */
+#ifndef IO_STATS_H
+#define IO_STATS_H
+
+#include "io_platform.h"
+
+#define IO_HIST_SUB_BITS 4
+#define IO_HIST_SUB (1 << IO_HIST_SUB_BITS)
+#define IO_HIST_MAGNITUDES 40   // Values up to 2^40 ns (18 minutes)
+#define IO_HIST_BUCKETS \
+   ((IO_HIST_MAGNITUDES - IO_HIST_SUB_BITS + 1) * IO_HIST_SUB)
+
+struct io_histogram
+{
+   uint64_t counts[IO_HIST_BUCKETS];
+   uint64_t total;
+   uint64_t max;
+};
+
+struct io_stats
+{
+   uint64_t bytes_in;
+   uint64_t packets_in;
+   uint64_t bytes_out;
+   uint64_t packets_out;
+   uint64_t send_errors;
+   uint64_t drops;
+   struct io_histogram dispatch;        // Receive -> linked channel write
+   struct io_histogram processing;      // Linked channel write duration
+   struct io_histogram hold;            // Time held by send rate limit
+};
+
+static inline void io_stats_add (uint64_t * counter, uint64_t value)
+{
+   __atomic_fetch_add (counter, value, __ATOMIC_RELAXED);
+}
+
+void io_histogram_record (struct io_histogram *h, uint64_t value);
+
+// Value at fraction p (0..1) of recorded values. 0 when empty.
+uint64_t io_histogram_percentile (const struct io_histogram *h, double p);
+
+// "p50 p90 p99 p999 max count" with values in microseconds
+int io_histogram_format (const struct io_histogram *h, char *text, 
+                         int size);
+
+void io_stats_reset (struct io_stats *s);
+
+// Count received bytes
+static inline void io_stats_received (struct io_stats *s, int bytes)
+{
+   io_stats_add (&s->bytes_in, bytes);
+}
+
+// Start delivering message received at time received. Records the
+// receive-to-dispatch latency and returns the dispatch start time.
+static inline uint64_t io_stats_dispatch_begin (struct io_stats *s,
+                                                uint64_t received)
+{
+   uint64_t now = io_clock_ns ();
+   io_histogram_record (&s->dispatch, now - received);
+   return now;
+}
+
+// Message delivered. Records linked channel processing time.
+static inline void io_stats_dispatch_end (struct io_stats *s,
+                                          uint64_t begin)
+{
+   io_stats_add (&s->packets_in, 1);
+   io_histogram_record (&s->processing, io_clock_ns () - begin);
+}
+
+// Count sent message or send error
+static inline void io_stats_sent (struct io_stats *s, int bytes, int ok)
+{
+   if (ok)
+   {
+      io_stats_add (&s->bytes_out, bytes);
+      io_stats_add (&s->packets_out, 1);
+   }
+   else
+      io_stats_add (&s->send_errors, 1);
+}
+
+#endif
@@ -0,0 +1,16 @@
+include RMCIOS-build-scripts/utilities.mk
+
+# Serial channels as shared object for linux.
+# termios ports, epoll serial engine and inotify hotplug.
+SOURCES:=serial_channels.c serial_port.c serial_engine.c io_ring.c \
+         framing.c serial_hotplug.c
+FILENAME?=linux-serial-module
+GCC?=${TOOL_PREFIX}gcc
+CFLAGS+= -shared -fPIC -O2 -IRMCIOS-interface -DINDEPENDENT_CHANNEL_MODULE
+LIBS+= -lpthread
+export
+
+compile: ${FILENAME}.so
+
+${FILENAME}.so: ${SOURCES} RMCIOS-interface${/}RMCIOS-functions.c
+	${GCC} ${CFLAGS} -o $@ $^ ${LIBS}
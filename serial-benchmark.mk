@@ -0,0 +1,19 @@
+include RMCIOS-build-scripts/utilities.mk
+
+# Pseudo terminal benchmarks for serial channels.
+# Built for the host against stub RMCIOS context. Runs on linux.
+BENCH_SOURCES:=benchmark${/}stub_context.c serial_channels.c serial_port.c \
+               serial_engine.c serial_hotplug.c \
+               io_ring.c framing.c
+BENCH_CFLAGS:=-O2 -Ibenchmark${/}stub -Ibenchmark -I.
+BENCH_LIBS:=-lpthread
+CC?=gcc
+export
+
+compile: benchmark${/}serial_bench
+
+benchmark${/}serial_bench: benchmark${/}serial_bench.c ${BENCH_SOURCES}
+	${CC} ${BENCH_CFLAGS} -o $@ $^ ${BENCH_LIBS}
+
+run: benchmark${/}serial_bench
+	benchmark${/}serial_bench
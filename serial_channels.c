@@ -28,139 +28,698 @@ along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
 */
 
 /* 
- * Windows serial channel implementation
+ * Serial channel implementation
  */
 #define DLL
 
+#ifdef _WIN32
 #define _WIN32_WINNT 0x0500
+#endif
 
 #include <stdio.h>
-#include <windows.h>
+#include <string.h>
 
 #include "RMCIOS-functions.h"
+#include "io_platform.h"
+#include "io_ring.h"
+#include "framing.h"
+#include "serial_port.h"
+#include "serial_engine.h"
+#include "serial_hotplug.h"
 
 const struct context_rmcios *module_context;
 
-void setDCB (HANDLE h, DCB * dcb)
-{
-   // Maintain dummy and reserved values and set our values
-   DCB temp;
-   temp.DCBlength = sizeof (DCB);
-   if (!GetCommState (h, &temp))
-   {
-      printf ("Error! GetCommState\n");
-   }
-   dcb->fDummy2 = temp.fDummy2;
-   dcb->wReserved = temp.wReserved;
-   dcb->wReserved1 = temp.wReserved1;
-   if (!SetCommState (h, dcb))
-   {
-      printf ("Error! SetCommState\n");
-   }
-}
-
 //////////////////////////////////////////////////////////
 // Serial class
 /////////////////////////////////////////////////////////
+// Largest batch delivered with one write
+#define SERIAL_BATCH_MAX 4096
+
+// Reopen retry interval grows from min to max while the port is missing.
+// Port arrival restarts it from min, so max is only a safety net.
+#define SERIAL_RETRY_MIN_MS 10
+#define SERIAL_RETRY_MAX_MS 5000
+
+// Longest port list returned by read serial
+#define SERIAL_LIST_MAX 4096
+
+// Transmit queue operations
+#define SERIAL_TX_DATA 0
+#define SERIAL_TX_LINES 1       // arg: bit 0 dtr, bit 1 rts
+#define SERIAL_TX_BREAK 2       // arg: duration_ms
+
+// Transmit queue policies when high_water is reached
+#define SERIAL_QUEUE_BLOCK 0
+#define SERIAL_QUEUE_DROP_OLDEST 1
+#define SERIAL_QUEUE_DROP_NEWEST 2
+
+#define SERIAL_QUEUE_DEFAULT 65536
+
+// Transmit waits on engine timer
+#define SERIAL_WAIT_BREAK 1     // Line break in progress
+#define SERIAL_WAIT_FLOW 2      // Flow control lines do not allow transmit
+#define SERIAL_WAIT_DRAIN 3     // Driver is sending before lines restore
+
+// Queued write or line control. Done in order by engine thread.
+struct serial_txop
+{
+   struct serial_txop *next;
+   uint64_t seq;
+   int type;
+   int arg;
+   int length;
+   char data[];
+};
+
 struct serial_data
 {
+   struct serial_data *next;    // All serial channels
    unsigned int id;
-   HANDLE serial_handle;
-   char *rxbuffer;
-   int bufflen;
-   int rindex;
+   struct serial_port port;
+   struct serial_task task;     // Receive handler in serial engine
+   io_mutex lock;               // Port open state and line settings
+   struct io_ring rx;           // Received data since last write
+   uint64_t rx_dropped;         // Bytes that did not fit in rx
    char p_name[50];
    int halt_serial;
-   DCB ss_dcb;
-   int ctl_mode;
+   struct serial_config config;
    int config_changed;
+   int batch_latency_us;        // Hold received bytes this long. 0 = off
+   int batch_bytes;             // Deliver earlier when this much is held
+   // Receive state of engine thread
+   char held[SERIAL_BATCH_MAX]; // Bytes waiting for delivery
+   int held_length;
+   uint64_t first_ns;           // Arrival of first held byte
+   uint64_t last_ns;            // Arrival of last received data
+   int open_error;
+   int retry_ms;
+   int arrived;                 // Port appeared. Retry from min interval
+   struct frame_config frame;
+   struct framer framer;        // Used by receive thread
+   uint64_t read_ns;            // Arrival of data being framed
+   uint64_t pending_ns;         // Arrival of first byte of partial frame
+   uint64_t frame_ns;           // Arrival of first byte of last frame
+   unsigned int timestamp_id;   // Timestamp subchannel
+   int timestamp_push;          // Write frame_ns before each frame
+   // Transaction: first frame after request is kept as reply
+   io_mutex reply_lock;
+   io_event reply_event;        // Set when reply is complete
+   int reply_armed;             // Waiting for reply
+   char *reply;
+   int reply_length;
+   int reply_size;
+   int reply_timeout_ms;
+   // Transmit queue. Drained by engine thread.
+   io_mutex tx_lock;
+   io_event tx_space;           // Set when queued operation is done
+   struct serial_txop *tx_head, *tx_tail;
+   int tx_msgs;
+   long tx_bytes;
+   long tx_high_water;          // Bytes. 0 = writers wait until written
+   int tx_policy;
+   long long tx_dropped_msgs;
+   long long tx_dropped_bytes;
+   uint64_t tx_seq;             // Last queued operation
+   uint64_t tx_done;            // Last done operation
+   unsigned int queue_id;       // Written lengths go to its links
+   // Transmit state of engine thread
+   int tx_offset;               // Bytes of head written
+   int tx_busy;                 // Write of head in progress
+   int tx_wait;                 // SERIAL_WAIT_ reason. 0 = none
+   uint64_t tx_wait_end;        // Continue transmit at
+   int tx_lines;                // Lines set for transmit by ctl_mode
 };
 
-DWORD WINAPI serial_rx_thread (LPVOID data)
+// Channels kicked on port arrival
+static struct serial_data *serial_list;
+static io_mutex serial_list_lock;
+
+// Ask receive thread to reopen the port with current settings
+static void serial_reopen (struct serial_data *this)
 {
-   struct serial_data *this = (struct serial_data *) data;
-   DWORD dwRead;
-   char s[2];
-   s[1] = 0;
-   char open_error = 0;
-   while (1)
+   __atomic_store_n (&this->config_changed, 1, __ATOMIC_RELEASE);
+   serial_task_kick (&this->task);
+}
+
+// Close port from engine thread. Partial frame is discarded, except
+// gap frame that ends when the line stops.
+static void serial_close (struct serial_data *this)
+{
+   serial_task_unwatch (&this->task);
+   io_mutex_lock (&this->lock);
+   serial_port_close (&this->port);
+   io_mutex_unlock (&this->lock);
+   // Rest of interrupted write is sent after reopen
+   this->tx_busy = 0;
+   this->tx_wait = 0;
+   this->tx_lines = 0;
+   framer_flush (&this->framer);
+   framer_reset (&this->framer);
+}
+
+// Time to send one character in nanoseconds
+static long long serial_char_ns (struct serial_data *this)
+{
+   const struct serial_config *c = &this->config;
+   long long bits10;            // Bits per character * 10
+   bits10 = 10 * (1 + c->data_bits + (c->parity != 0))
+            + (c->stop_bits == 0 ? 10 : c->stop_bits == 1 ? 15 : 20);
+   return c->baud_rate > 0 ? bits10 * 100000000 / c->baud_rate : 0;
+}
+
+// Idle time that ends a gap frame. 0 when not gap framing.
+// Default is 3.5 character times as in Modbus RTU, fixed 1750us above
+// 19200 baud.
+static long serial_gap_us (struct serial_data *this)
+{
+   const struct serial_config *c = &this->config;
+   if (this->framer.active.mode != FRAME_GAP)
+      return 0;
+   if (this->framer.active.length > 0)
+      return this->framer.active.length;
+   if (c->baud_rate > 19200 || c->baud_rate <= 0)
+      return 1750;
+   return (long) (35 * serial_char_ns (this) / 10000);
+}
+
+// Store to receive buffer returned by read
+static void serial_rx_store (struct serial_data *this, const char *data,
+                             int length)
+{
+   int dropped = io_ring_write (&this->rx, data, length);
+   if (dropped > 0)
+      __atomic_fetch_add (&this->rx_dropped, dropped, __ATOMIC_RELAXED);
+}
+
+// Keep frame as reply of pending transaction and wake the caller
+static void serial_reply_store (struct serial_data *this, const char *data,
+                                int length)
+{
+   io_mutex_lock (&this->reply_lock);
+   if (this->reply_armed)
    {
-      if(this->config_changed == 1)
+      if (length > this->reply_size)
       {
-         this->config_changed = 0;
-         CloseHandle (this->serial_handle);
-         Sleep(10); // Give driver some time to close
-         this->serial_handle = INVALID_HANDLE_VALUE;
+         char *reply = (char *) realloc (this->reply, length);
+         if (reply != NULL)
+         {
+            this->reply = reply;
+            this->reply_size = length;
+         }
+         else
+            length = this->reply_size;
       }
+      memcpy (this->reply, data, length);
+      this->reply_length = length;
+      this->reply_armed = 0;
+      io_event_set (&this->reply_event);
+   }
+   io_mutex_unlock (&this->reply_lock);
+}
+
+// Write complete frame to linked channels. Called by framer.
+static void serial_frame_emit (void *arg, char *data, int length)
+{
+   struct serial_data *this = (struct serial_data *) arg;
+   if (__atomic_load_n (&this->reply_armed, __ATOMIC_RELAXED))
+      serial_reply_store (this, data, length);
+   __atomic_store_n (&this->frame_ns, this->pending_ns, __ATOMIC_RELAXED);
+   // Following frames start in the data being framed
+   this->pending_ns = this->read_ns;
+   if (this->timestamp_push)
+   {
+      char text[24];
+      int text_length = snprintf (text, sizeof (text), "%llu",
+                                  (unsigned long long) this->frame_ns / 1000);
+      write_buffer (module_context,
+                    linked_channels (module_context, this->timestamp_id),
+                    text, text_length, this->timestamp_id);
+   }
+   write_buffer (module_context, linked_channels (module_context, this->id),
+                 data, length, this->id);
+}
+
+// Pass held bytes that arrived first at arrival_ns to framing. Without
+// framing they are written to linked channels as one buffer.
+static void serial_rx_deliver (struct serial_data *this, char *data,
+                               int length, uint64_t arrival_ns)
+{
+   if (length <= 0)
+      return;
+   this->read_ns = arrival_ns;
+   if (framer_pending (&this->framer) == 0)
+      this->pending_ns = arrival_ns;
+   framer_push (&this->framer, data, length);
+}
+
+// Deliver held bytes
+static void serial_rx_flush (struct serial_data *this)
+{
+   serial_rx_deliver (this, this->held, this->held_length, this->first_ns);
+   this->held_length = 0;
+}
+
+// Open port from engine thread. Retries with growing interval.
+static int serial_open (struct serial_data *this)
+{
+   int result;
+   if (this->p_name[0] == 0)
+      return -1;
+   io_mutex_lock (&this->lock);
+   result = serial_port_open (&this->port, this->p_name, &this->config);
+   io_mutex_unlock (&this->lock);
+   if (result == 0 && serial_task_watch (&this->task) != 0)
+   {
+      serial_close (this);
+      result = -1;
+   }
+   if (result == 0)
+   {
+      this->open_error = 0;
+      this->retry_ms = SERIAL_RETRY_MIN_MS;
+      return 0;
+   }
+   if (this->open_error == 0)
+   {
+      printf ("Error! Could not open serial handle!\n");
+      this->open_error = 1;
+   }
+   serial_task_timer (&this->task, this->retry_ms * 1000L);
+   this->retry_ms *= 2;
+   if (this->retry_ms > SERIAL_RETRY_MAX_MS)
+      this->retry_ms = SERIAL_RETRY_MAX_MS;
+   return -1;
+}
+
+// Port appeared or was removed. Runs in hotplug thread.
+// Closed ports retry opening immediately instead of waiting for the
+// retry timer. Open ports ignore the kick.
+static void serial_hotplug_event (void *arg, const char *name, int present)
+{
+   struct serial_data *this;
+   if (!present)
+      return;
+   io_mutex_lock (&serial_list_lock);
+   for (this = serial_list; this != NULL; this = this->next)
+   {
+      __atomic_store_n (&this->arrived, 1, __ATOMIC_RELEASE);
+      serial_task_kick (&this->task);
+   }
+   io_mutex_unlock (&serial_list_lock);
+}
+
+// Report result of queued write to channels linked to newname_queue
+static void serial_tx_signal (struct serial_data *this, int result)
+{
+   write_i (module_context, linked_channels (module_context, this->queue_id),
+            result);
+}
 
-      dwRead = 0;
-      if (this->serial_handle != INVALID_HANDLE_VALUE)
+// Remove done head operation. result < 0 when data was not written.
+// Engine thread.
+static void serial_tx_pop (struct serial_data *this, int result)
+{
+   struct serial_txop *op;
+   io_mutex_lock (&this->tx_lock);
+   op = this->tx_head;
+   this->tx_head = op->next;
+   if (this->tx_head == NULL)
+      this->tx_tail = NULL;
+   this->tx_msgs--;
+   this->tx_bytes -= op->length;
+   this->tx_done = op->seq;
+   if (result < 0)
+   {
+      this->tx_dropped_msgs++;
+      this->tx_dropped_bytes += op->length;
+   }
+   io_mutex_unlock (&this->tx_lock);
+   io_event_set (&this->tx_space);
+   this->tx_offset = 0;
+   if (op->type == SERIAL_TX_DATA)
+      serial_tx_signal (this, result);
+   free (op);
+}
+
+// Continue transmit on engine timer
+static void serial_tx_wait (struct serial_data *this, int reason,
+                            long long delay_ns)
+{
+   this->tx_wait = reason;
+   this->tx_wait_end = io_clock_ns () + delay_ns;
+}
+
+// ctl_mode bits done by the engine instead of the driver
+static int serial_tx_soft_ctl (struct serial_data *this)
+{
+   return this->config.ctl_mode & ~this->port.native_ctl;
+}
+
+// Set dtr/rts for transmit, or restore them, as set in ctl_mode
+static void serial_tx_set_lines (struct serial_data *this, int on)
+{
+   int soft = serial_tx_soft_ctl (this);
+   int dtr = -1, rts = -1;
+   if (this->tx_lines == on)
+      return;
+   if (soft & (SERIAL_CTL_DTR_ON_TX | SERIAL_CTL_DTR_OFF_TX))
+      dtr = on ? (soft & SERIAL_CTL_DTR_ON_TX) != 0 :
+            this->config.dtr_control != 0;
+   if (soft & (SERIAL_CTL_RTS_ON_TX | SERIAL_CTL_RTS_OFF_TX))
+      rts = on ? (soft & SERIAL_CTL_RTS_ON_TX) != 0 :
+            this->config.rts_control != 0;
+   if (dtr >= 0 || rts >= 0)
+      serial_port_lines (&this->port, dtr, rts);
+   this->tx_lines = on && (dtr >= 0 || rts >= 0);
+}
+
+// Modem status lines allow transmit as set in ctl_mode. Ports without
+// modem status always allow.
+static int serial_tx_allowed (struct serial_data *this)
+{
+   int soft = serial_tx_soft_ctl (this);
+   int modem;
+   if ((soft & (SERIAL_CTL_DSR_LOW_TX | SERIAL_CTL_DSR_HIGH_TX
+                | SERIAL_CTL_CTS_LOW_TX | SERIAL_CTL_CTS_HIGH_TX)) == 0)
+      return 1;
+   modem = serial_port_modem (&this->port);
+   if (modem < 0)
+      return 1;
+   if ((soft & SERIAL_CTL_DSR_LOW_TX) && (modem & SERIAL_MODEM_DSR))
+      return 0;
+   if ((soft & SERIAL_CTL_DSR_HIGH_TX) && !(modem & SERIAL_MODEM_DSR))
+      return 0;
+   if ((soft & SERIAL_CTL_CTS_LOW_TX) && (modem & SERIAL_MODEM_CTS))
+      return 0;
+   if ((soft & SERIAL_CTL_CTS_HIGH_TX) && !(modem & SERIAL_MODEM_CTS))
+      return 0;
+   return 1;
+}
+
+// Nonzero when the driver has sent all written data. Otherwise
+// transmit continues on engine timer after the estimated send time.
+static int serial_tx_sent (struct serial_data *this)
+{
+   int unsent = serial_port_unsent (&this->port);
+   if (unsent <= 0)
+      return 1;
+   serial_tx_wait (this, SERIAL_WAIT_DRAIN,
+                   unsent * serial_char_ns (this) + 100000);
+   return 0;
+}
+
+// Queue is empty. Restore transmit lines once the driver has sent all.
+static void serial_tx_drain (struct serial_data *this)
+{
+   if (this->tx_lines && serial_tx_sent (this))
+      serial_tx_set_lines (this, 0);
+}
+
+// Engine timer of transmit wait expired
+static void serial_tx_resume (struct serial_data *this)
+{
+   if (this->tx_wait == SERIAL_WAIT_BREAK)
+      serial_port_break (&this->port, 0);
+   this->tx_wait = 0;
+}
+
+// Start queued operations until a write or a wait is in progress.
+// Data queued while the port is missing is dropped. Engine thread.
+static void serial_tx_run (struct serial_data *this)
+{
+   struct serial_txop *op;
+   int open = serial_port_is_open (&this->port);
+   while (!this->tx_busy)
+   {
+      io_mutex_lock (&this->tx_lock);
+      op = this->tx_head;
+      io_mutex_unlock (&this->tx_lock);
+      // More data keeps transmit lines set
+      if (this->tx_wait == SERIAL_WAIT_DRAIN && op != NULL
+          && op->type == SERIAL_TX_DATA)
+         this->tx_wait = 0;
+      if (this->tx_wait != 0)
+         return;
+      if (op == NULL)
+      {
+         if (open)
+            serial_tx_drain (this);
+         return;
+      }
+      switch (op->type)
       {
-         if (ReadFile (this->serial_handle, s, 1, &dwRead, NULL) == 0)
+      case SERIAL_TX_DATA:
+         if (open && !serial_tx_allowed (this))
+         {
+            // Poll modem status
+            serial_tx_wait (this, SERIAL_WAIT_FLOW, 1000000);
+            return;
+         }
+         if (open)
+            serial_tx_set_lines (this, 1);
+         if (open && serial_task_write (&this->task,
+                                        op->data + this->tx_offset,
+                                        op->length - this->tx_offset) == 0)
          {
-            CloseHandle (this->serial_handle);
-            this->serial_handle = INVALID_HANDLE_VALUE;
-            // Set to invalid for usb disconnection -> reconnection
+            this->tx_busy = 1;
+            return;
          }
+         serial_tx_pop (this, -1);
+         break;
+
+      case SERIAL_TX_LINES:
+         // Data written before is on the line first
+         if (open && !serial_tx_sent (this))
+            return;
+         io_mutex_lock (&this->lock);
+         this->config.dtr_control = op->arg & 1;
+         this->config.rts_control = (op->arg >> 1) & 1;
+         // Driver switching rts for transmit owns the line
+         if (open)
+            serial_port_lines (&this->port, this->config.dtr_control,
+                               this->port.native_ctl
+                               & (SERIAL_CTL_RTS_ON_TX
+                                  | SERIAL_CTL_RTS_OFF_TX) ? -1 :
+                               this->config.rts_control);
+         this->tx_lines = 0;
+         io_mutex_unlock (&this->lock);
+         serial_tx_pop (this, 0);
+         break;
+
+      case SERIAL_TX_BREAK:
+         if (open && !serial_tx_sent (this))
+            return;
+         // Held on engine timer without blocking the engine thread
+         if (open)
+         {
+            serial_port_break (&this->port, 1);
+            serial_tx_wait (this, SERIAL_WAIT_BREAK,
+                            (long long) op->arg * 1000000);
+         }
+         serial_tx_pop (this, 0);
+         break;
       }
-      else      
-      // Not open -> attemp to reopen
+   }
+}
+
+// Write of head operation completed. Engine thread.
+static void serial_tx_written (struct serial_data *this, int written)
+{
+   struct serial_txop *op;
+   io_mutex_lock (&this->tx_lock);
+   op = this->tx_head;
+   io_mutex_unlock (&this->tx_lock);
+   this->tx_busy = 0;
+   if (written < 0)
+      serial_tx_pop (this, -1);
+   else if ((this->tx_offset += written) >= op->length)
+      serial_tx_pop (this, op->length);
+}
+
+// Queue write or line control for engine thread. Applies the
+// high-water policy, or waits until done when there is no high water.
+// Writers in an engine thread, such as channels linked to serial input,
+// never wait: blocking writes are queued over the limit.
+static void serial_tx_enqueue (struct serial_data *this, int type, int arg,
+                               const char *data, int length)
+{
+   struct serial_txop *op, *p;
+   uint64_t seq = 0;
+   int wait, done, dropped = 0;
+   int engine = serial_engine_current ();
+
+   op = (struct serial_txop *) malloc (sizeof (*op) + length);
+   if (op == NULL)
+      return;
+   op->next = NULL;
+   op->type = type;
+   op->arg = arg;
+   op->length = length;
+   if (length > 0)
+      memcpy (op->data, data, length);
+
+   io_mutex_lock (&this->tx_lock);
+   if (type == SERIAL_TX_DATA && this->tx_high_water > 0)
+   {
+      switch (this->tx_policy)
       {
-         if (this->p_name[0] != 0)
+      case SERIAL_QUEUE_DROP_NEWEST:
+         if (this->tx_bytes > 0
+             && this->tx_bytes + length > this->tx_high_water)
          {
-            this->serial_handle = CreateFile (this->p_name, 
-                                              GENERIC_READ | GENERIC_WRITE, 
-                                              0,   
-                                              NULL,  // no security attrs
-                                              OPEN_EXISTING,    
-                                              0,     // not overlapped I/O
-                                              NULL); 
-
-            if (this->serial_handle != INVALID_HANDLE_VALUE)
-            {
-               open_error = 0;
-
-               setDCB (this->serial_handle, &this->ss_dcb);
-
-               COMMTIMEOUTS timeouts = { 0 };
-               timeouts.ReadIntervalTimeout = 50;
-               timeouts.ReadTotalTimeoutConstant = 50;
-               timeouts.ReadTotalTimeoutMultiplier = 10;
-               timeouts.WriteTotalTimeoutConstant = 50;
-               timeouts.WriteTotalTimeoutMultiplier = 10;
-               if (!SetCommTimeouts (this->serial_handle, &timeouts))
-               {
-                  //handle error
-               }
-            }
-            else
+            this->tx_dropped_msgs++;
+            this->tx_dropped_bytes += length;
+            io_mutex_unlock (&this->tx_lock);
+            free (op);
+            serial_tx_signal (this, -1);
+            return;
+         }
+         break;
+
+      case SERIAL_QUEUE_DROP_OLDEST:
+         // Head may be being written. Line control is kept.
+         for (p = this->tx_head; p != NULL && p->next != NULL
+              && this->tx_bytes + length > this->tx_high_water;)
+         {
+            struct serial_txop *old = p->next;
+            if (old->type != SERIAL_TX_DATA)
             {
-               if (open_error == 0)
-               {
-                  printf ("Error! Could not open serial handle!\n");
-                  open_error = 1;
-               }
+               p = old;
+               continue;
             }
+            p->next = old->next;
+            if (this->tx_tail == old)
+               this->tx_tail = p;
+            this->tx_msgs--;
+            this->tx_bytes -= old->length;
+            this->tx_dropped_msgs++;
+            this->tx_dropped_bytes += old->length;
+            dropped++;
+            free (old);
          }
-      }
+         break;
 
-      if (dwRead != 0)
-      {
-         if (this->bufflen > this->rindex - 1)
+      default:
+         while (!engine && this->tx_bytes > 0 && this->tx_high_water > 0
+                && this->tx_bytes + length > this->tx_high_water)
          {
-            this->rxbuffer[this->rindex] = *s;
-            this->rindex += dwRead;
-            this->rxbuffer[this->rindex] = 0;
+            io_mutex_unlock (&this->tx_lock);
+            io_event_wait (&this->tx_space, 10);
+            io_mutex_lock (&this->tx_lock);
          }
-         write_str (module_context,
-                    linked_channels (module_context, this->id), s, this->id);
+         break;
       }
-      else
+   }
+   op->seq = seq = ++this->tx_seq;
+   if (this->tx_tail != NULL)
+      this->tx_tail->next = op;
+   else
+      this->tx_head = op;
+   this->tx_tail = op;
+   this->tx_msgs++;
+   this->tx_bytes += length;
+   wait = this->tx_high_water == 0 && !engine;
+   io_mutex_unlock (&this->tx_lock);
+   while (dropped-- > 0)
+      serial_tx_signal (this, -1);
+   serial_task_kick (&this->task);
+
+   // Wait, polling because there may be several waiting writers
+   while (wait)
+   {
+      io_mutex_lock (&this->tx_lock);
+      done = this->tx_done >= seq;
+      io_mutex_unlock (&this->tx_lock);
+      if (done)
+         break;
+      io_event_wait (&this->tx_space, 10);
+   }
+}
+
+// Receive handler. Runs in serial engine thread.
+static void serial_rx_handler (struct serial_task *t, int events)
+{
+   struct serial_data *this = (struct serial_data *) t->owner;
+   int max_batch, bytes = 0;
+   long latency_us, gap_us;
+   uint64_t now, deadline = 0;
+
+   if (events & SERIAL_IO_WRITE)
+      serial_tx_written (this, t->written);
+   if (__atomic_exchange_n (&this->config_changed, 0, __ATOMIC_ACQUIRE))
+   {
+      serial_rx_flush (this);
+      serial_close (this);
+      this->retry_ms = SERIAL_RETRY_MIN_MS;
+   }
+   if (__atomic_exchange_n (&this->arrived, 0, __ATOMIC_ACQUIRE))
+      this->retry_ms = SERIAL_RETRY_MIN_MS;
+   if (!serial_port_is_open (&this->port))
+   // Not open -> attemp to reopen
+   {
+      if (serial_open (this) != 0)
       {
-         Sleep (10);
+         serial_tx_run (this);
+         return;
       }
    }
-   return 0;
+   if (this->tx_wait != 0 && io_clock_ns () >= this->tx_wait_end)
+      serial_tx_resume (this);
+   serial_tx_run (this);
+
+   max_batch = this->batch_bytes;
+   if (max_batch <= 0 || max_batch > SERIAL_BATCH_MAX)
+      max_batch = SERIAL_BATCH_MAX;
+   // Gap framing needs every read to see the idle time
+   gap_us = serial_gap_us (this);
+   latency_us = gap_us > 0 ? 0 : this->batch_latency_us;
+
+   // Drain everything received. Also on timer, so that data that
+   // arrived with the timer is not taken for an idle gap.
+   while ((bytes = serial_port_read (&this->port,
+                                     this->held + this->held_length,
+                                     max_batch - this->held_length)) > 0)
+   {
+      this->last_ns = io_clock_ns ();
+      if (this->held_length == 0)
+         this->first_ns = this->last_ns;
+      serial_rx_store (this, this->held + this->held_length, bytes);
+      this->held_length += bytes;
+      if (this->held_length >= max_batch)
+         serial_rx_flush (this);
+   }
+   if (bytes < 0 || (events & SERIAL_IO_ERROR))
+   {
+      // Closed for usb disconnection -> reconnection
+      serial_rx_flush (this);
+      serial_close (this);
+      serial_task_timer (t, 0);
+      return;
+   }
+
+   // Deliver held bytes that are due and end frame on idle gap
+   now = io_clock_ns ();
+   if (this->held_length > 0)
+   {
+      deadline = this->first_ns + (uint64_t) latency_us * 1000;
+      if (latency_us <= 0 || now >= deadline)
+      {
+         serial_rx_flush (this);
+         deadline = 0;
+      }
+   }
+   if (gap_us > 0 && framer_pending (&this->framer))
+   {
+      uint64_t gap_end = this->last_ns + (uint64_t) gap_us * 1000;
+      if (now >= gap_end)
+         framer_flush (&this->framer);
+      else if (deadline == 0 || gap_end < deadline)
+         deadline = gap_end;
+   }
+   if (this->tx_wait != 0 && (deadline == 0 || this->tx_wait_end < deadline))
+      deadline = this->tx_wait_end;
+   serial_task_timer (t, deadline == 0 ? -1 : (long) ((deadline - now + 999)
+                                                       / 1000));
 }
 
 void serial_port_subchan_func (struct serial_data *this,
@@ -175,27 +734,16 @@ void serial_port_subchan_func (struct serial_data *this,
    case write_rmcios:
       if (this == NULL)
          break;
+      // Queued in order with written data
       if (num_params < 1)
-      {
-         SetCommBreak (this->serial_handle);
-         Sleep (100);
-         ClearCommBreak (this->serial_handle);
-      }
+         serial_tx_enqueue (this, SERIAL_TX_BREAK, 100, NULL, 0);
       else
       {
          int oper = param_to_integer (context, paramtype, param, 0);
-         int sigbreak = oper >> 2 & 1;
-         this->ss_dcb.fDtrControl = oper & 1;
-         this->ss_dcb.fRtsControl = (oper >> 1) & 1;
-         if (sigbreak == 1)
-         {
-            SetCommBreak (this->serial_handle);
-            Sleep (100);
-            ClearCommBreak (this->serial_handle);
-         }
-         setDCB (this->serial_handle, &this->ss_dcb);
+         if ((oper >> 2 & 1) == 1)
+            serial_tx_enqueue (this, SERIAL_TX_BREAK, 100, NULL, 0);
+         serial_tx_enqueue (this, SERIAL_TX_LINES, oper & 3, NULL, 0);
       }
-
       break;
 
    case setup_rmcios:
@@ -204,16 +752,305 @@ void serial_port_subchan_func (struct serial_data *this,
       if (num_params < 1)
          break;
       if (num_params > 1)
-         this->ss_dcb.fDtrControl = param_to_int (context, paramtype, param, 1);
+         this->config.dtr_control = param_to_int (context, paramtype, param, 1);
       if (num_params > 2)
-         this->ss_dcb.fRtsControl = param_to_int (context, paramtype, param, 2);
-      strcpy (this->p_name, "\\\\.\\");
+         this->config.rts_control = param_to_int (context, paramtype, param, 2);
       param_to_string (context, paramtype, param, 0,
-                       sizeof (this->p_name) - strlen (this->p_name),
-                       this->p_name + strlen (this->p_name));
-      if (this->serial_handle != INVALID_HANDLE_VALUE)
-         // Close the handle -> thread will reopen
-         CloseHandle (this->serial_handle);     
+                       sizeof (this->p_name), this->p_name);
+      // Thread will reopen
+      serial_reopen (this);
+      break;
+   }
+}
+
+void serial_batch_subchan_func (struct serial_data *this,
+                                const struct context_rmcios *context, int id,
+                                enum function_rmcios function,
+                                enum type_rmcios paramtype,
+                                struct combo_rmcios *returnv,
+                                int num_params,
+                                const union param_rmcios param)
+{
+   char text[40];
+   switch (function)
+   {
+   case setup_rmcios:
+      if (this == NULL || num_params < 1)
+         break;
+      this->batch_latency_us = param_to_integer (context, paramtype, param, 0);
+      if (num_params > 1)
+         this->batch_bytes = param_to_integer (context, paramtype, param, 1);
+      // Apply immediately to bytes already held
+      serial_task_kick (&this->task);
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      snprintf (text, sizeof (text), "%d %d", this->batch_latency_us,
+                this->batch_bytes);
+      return_string (context, returnv, text);
+      break;
+   }
+}
+
+// Reset receive buffer and queue data for transmit
+static void serial_send (struct serial_data *this, const char *data,
+                         int length)
+{
+   io_ring_reset (&this->rx);
+   serial_tx_enqueue (this, SERIAL_TX_DATA, 0, data, length);
+}
+
+// Send request. Next complete frame is kept as reply.
+static void serial_transaction_start (struct serial_data *this,
+                                      const char *data, int length)
+{
+   io_mutex_lock (&this->reply_lock);
+   this->reply_length = 0;
+   io_event_wait (&this->reply_event, 0);       // Clear late reply
+   __atomic_store_n (&this->reply_armed, 1, __ATOMIC_RELAXED);
+   io_mutex_unlock (&this->reply_lock);
+   serial_send (this, data, length);
+}
+
+// Wait for reply of started transaction and return it.
+// Nothing is returned on timeout.
+static void serial_transaction_reply (struct serial_data *this,
+                                      const struct context_rmcios *context,
+                                      struct combo_rmcios *returnv)
+{
+   io_event_wait (&this->reply_event, this->reply_timeout_ms);
+   io_mutex_lock (&this->reply_lock);
+   this->reply_armed = 0;
+   if (this->reply_length > 0)
+      return_buffer (context, returnv, this->reply, this->reply_length);
+   this->reply_length = 0;
+   io_mutex_unlock (&this->reply_lock);
+}
+
+void serial_transaction_subchan_func (struct serial_data *this,
+                                      const struct context_rmcios *context,
+                                      int id, enum function_rmcios function,
+                                      enum type_rmcios paramtype,
+                                      struct combo_rmcios *returnv,
+                                      int num_params,
+                                      const union param_rmcios param)
+{
+   int plen;
+   switch (function)
+   {
+   case setup_rmcios:
+      if (this == NULL || num_params < 1)
+         break;
+      this->reply_timeout_ms = param_to_integer (context, paramtype, param, 0);
+      break;
+
+   case write_rmcios:
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params > 0)
+      {
+         plen = param_buffer_alloc_size (context, paramtype, param, 0);
+         {
+            char buffer[plen];
+            struct buffer_rmcios pbuffer;
+            pbuffer = param_to_buffer (context, paramtype, param, 0, plen,
+                                       buffer);
+            serial_transaction_start (this, pbuffer.data, pbuffer.length);
+         }
+      }
+      if (function == read_rmcios)
+         serial_transaction_reply (this, context, returnv);
+      break;
+   }
+}
+
+#define SERIAL_FRAME_HELP \
+   " setup newname_frame mode | arg | max_frame(65536)\r\n" \
+   "    # -write only complete frames to linked channels.\r\n" \
+   "    # none           : data as received (default)\r\n" \
+   "    # gap gap_us     : frame ends when line is idle for gap_us.\r\n" \
+   "    #                  0=3.5 character times (Modbus RTU),\r\n" \
+   "    #                  1750us above 19200 baud\r\n" \
+   "    # line delimiter : delimiter terminated, default \\n.\r\n" \
+   "    #                  Escapes \\r \\n \\t \\0 \\xHH. Delimiter removed.\r\n" \
+   "    # fixed length   : frames of length bytes\r\n" \
+   "    # prefix bytes | prefixle bytes | slip | cobs : as socket channels\r\n" \
+   "    # Longer frames than max_frame are dropped.\r\n" \
+   " read newname_frame\r\n" \
+   "    # -frames dropped_bytes errors first_byte_us\r\n" \
+   "    #  first_byte_us: monotonic arrival time of first byte of\r\n" \
+   "    #  last frame in microseconds\r\n"
+
+void serial_frame_subchan_func (struct serial_data *this,
+                                const struct context_rmcios *context, int id,
+                                enum function_rmcios function,
+                                enum type_rmcios paramtype,
+                                struct combo_rmcios *returnv,
+                                int num_params,
+                                const union param_rmcios param)
+{
+   char mode[16];
+   char arg[32];
+   char text[100];
+   int m;
+   switch (function)
+   {
+   case setup_rmcios:
+      if (this == NULL || num_params < 1)
+         break;
+      param_to_string (context, paramtype, param, 0, sizeof (mode), mode);
+      m = frame_mode_from_name (mode);
+      if (m < 0)
+      {
+         printf ("Unknown framing mode: %s\n", mode);
+         break;
+      }
+      if (num_params > 1)
+         param_to_string (context, paramtype, param, 1, sizeof (arg), arg);
+      if (frame_config_set (&this->frame, m, num_params > 1 ? arg : NULL,
+                            num_params > 2 ?
+                            param_to_integer (context, paramtype, param, 2) :
+                            0) != 0)
+         printf ("Invalid framing parameter for mode %s\n", mode);
+      // Wait timeouts depend on the mode
+      serial_task_kick (&this->task);
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      snprintf (text, sizeof (text), "%lld %lld %lld %llu",
+                this->framer.frames, this->framer.dropped_bytes,
+                this->framer.errors, (unsigned long long)
+                __atomic_load_n (&this->frame_ns, __ATOMIC_RELAXED) / 1000);
+      return_string (context, returnv, text);
+      break;
+   }
+}
+
+#define SERIAL_QUEUE_HELP \
+   " setup newname_queue high_water | policy\r\n" \
+   "    # -writes are queued and written by the serial engine thread.\r\n" \
+   "    #  Line control of newname_port is queued in order with data.\r\n" \
+   "    #  high_water: queue limit in bytes (65536).\r\n" \
+   "    #   0=writer waits until data is written\r\n" \
+   "    #  policy when limit is reached:\r\n" \
+   "    #   0=block writer (default) 1=drop oldest 2=drop newest\r\n" \
+   "    #  Writers linked to serial input never wait, so that\r\n" \
+   "    #  echo and reply channels do not stop the serial engine.\r\n" \
+   " read newname_queue\r\n" \
+   "    # -queued_messages queued_bytes dropped_messages dropped_bytes\r\n" \
+   "    #  Data is also dropped when the port is not open.\r\n" \
+   " link newname_queue channel\r\n" \
+   "    # -length of each written message, -1 when dropped\r\n"
+
+void serial_queue_subchan_func (struct serial_data *this,
+                                const struct context_rmcios *context, int id,
+                                enum function_rmcios function,
+                                enum type_rmcios paramtype,
+                                struct combo_rmcios *returnv,
+                                int num_params,
+                                const union param_rmcios param)
+{
+   char text[100];
+   switch (function)
+   {
+   case setup_rmcios:
+      if (this == NULL || num_params < 1)
+         break;
+      io_mutex_lock (&this->tx_lock);
+      this->tx_high_water = param_to_integer (context, paramtype, param, 0);
+      if (num_params > 1)
+         this->tx_policy = param_to_integer (context, paramtype, param, 1);
+      io_mutex_unlock (&this->tx_lock);
+      // Blocked writers check the new limit
+      io_event_set (&this->tx_space);
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      io_mutex_lock (&this->tx_lock);
+      snprintf (text, sizeof (text), "%d %ld %lld %lld", this->tx_msgs,
+                this->tx_bytes, this->tx_dropped_msgs,
+                this->tx_dropped_bytes);
+      io_mutex_unlock (&this->tx_lock);
+      return_string (context, returnv, text);
+      break;
+   }
+}
+
+#define SERIAL_TIMESTAMP_HELP \
+   " read newname_timestamp\r\n" \
+   "    # -arrival_us age_us\r\n" \
+   "    #  arrival_us: monotonic time in microseconds when the first byte\r\n" \
+   "    #  of the frame being delivered, or the last one, was read.\r\n" \
+   "    #  Performance counter on windows, as fast_clock.\r\n" \
+   "    #  age_us: time elapsed since arrival\r\n" \
+   " setup newname_timestamp 1\r\n" \
+   "    # -Write arrival_us to channels linked to newname_timestamp\r\n" \
+   "    #  before each frame. 0=off (default)\r\n"
+
+void serial_timestamp_subchan_func (struct serial_data *this,
+                                    const struct context_rmcios *context,
+                                    int id, enum function_rmcios function,
+                                    enum type_rmcios paramtype,
+                                    struct combo_rmcios *returnv,
+                                    int num_params,
+                                    const union param_rmcios param)
+{
+   uint64_t arrival_ns;
+   char text[48];
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      arrival_ns = __atomic_load_n (&this->frame_ns, __ATOMIC_RELAXED);
+      snprintf (text, sizeof (text), "%llu %llu",
+                (unsigned long long) arrival_ns / 1000,
+                (unsigned long long) (io_clock_ns () - arrival_ns) / 1000);
+      return_string (context, returnv, text);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL || num_params < 1)
+         break;
+      this->timestamp_push = param_to_integer (context, paramtype, param, 0);
+      break;
+   }
+}
+
+void serial_rx_subchan_func (struct serial_data *this,
+                             const struct context_rmcios *context, int id,
+                             enum function_rmcios function,
+                             enum type_rmcios paramtype,
+                             struct combo_rmcios *returnv,
+                             int num_params, const union param_rmcios param)
+{
+   const char *parts[2];
+   int lengths[2];
+   char text[60];
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      snprintf (text, sizeof (text), "%d %d %llu",
+                io_ring_peek (&this->rx, parts, lengths),
+                io_ring_size (&this->rx),
+                (unsigned long long)
+                __atomic_load_n (&this->rx_dropped, __ATOMIC_RELAXED));
+      return_string (context, returnv, text);
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      __atomic_store_n (&this->rx_dropped, 0, __ATOMIC_RELAXED);
       break;
    }
 }
@@ -225,8 +1062,6 @@ void serial_class_func (struct serial_data *this,
                         struct combo_rmcios *returnv,
                         int num_params, const union param_rmcios param)
 {
-   char *s;
-   DWORD dwRead, dwWritten;
    int plen;
    switch (function)
    {
@@ -235,8 +1070,15 @@ void serial_class_func (struct serial_data *this,
                      "Serial channel help.\r\n"
                      " create serial newname | comX\r\n"
                      " read serial # read list of system serialports\r\n"
+                     "  # List is kept up to date on port arrival/removal\r\n"
                      " creates subchannel: \r\n"
                      "   newname_port for port special functions\r\n"
+                     "   newname_batch for receive batching\r\n"
+                     "   newname_rx for receive buffer state\r\n"
+                     "   newname_frame for receive framing\r\n"
+                     "   newname_transaction for request/response\r\n"
+                     "   newname_timestamp for receive time of frames\r\n"
+                     "   newname_queue for write queue\r\n"
                      " setup newname_port comX | dtr| rts \r\n"
                      "  # -set physical com port and control line states\r\n"
                      "  rts: 0=rts-deactive \r\n"
@@ -265,13 +1107,40 @@ void serial_class_func (struct serial_data *this,
                      "	16= DSR_LOW_TO_TRANSMIT"
                      "	32= DSR_HIGH_TO_TRANSMIT"
                      "	64= CTS_LOW_TO_TRANSMIT"
-                     "	128= CTS_HIGH_TO_TRANSMIT"
+                     "	128= CTS_HIGH_TO_TRANSMIT\r\n"
+                     "    #  Done by the driver when it can: RTS toggle and\r\n"
+                     "    #  DSR/CTS high flow on windows, RS485 RTS on\r\n"
+                     "    #  linux. Otherwise lines are set by the engine.\r\n"
                      " write newname data \r\n"
                      "    # -Transmit data to serial. \\r=CR \\n=LF \r\n"
+                     "    #  Returns when queued, see newname_queue.\r\n"
                      " read newname \r\n"
                      "    # -Read data in receive buffer since last write.\r\n"
                      " link newname channel \r\n"
-                     "    # -writes all arriving bytes to channel.\r\n");
+                     "    # -writes arriving bytes to channel. Bytes from\r\n"
+                     "    #  one read are written as one buffer.\r\n"
+                     " setup newname_batch max_latency_us | max_bytes\r\n"
+                     "    # -hold received bytes up to max_latency_us and\r\n"
+                     "    #  write them with one call. 0=off (default)\r\n"
+                     "    #  max_bytes: write earlier when this much is held\r\n"
+                     " read newname_batch # max_latency_us max_bytes\r\n"
+                     " read newname_rx \r\n"
+                     "    # -buffered_bytes rx_buff_len dropped_bytes\r\n"
+                     "    #  bytes that do not fit rx_buff_len are dropped\r\n"
+                     " write newname_rx # reset dropped_bytes count\r\n"
+                     SERIAL_FRAME_HELP
+                     " read newname_transaction request\r\n"
+                     "    # -send request and return the reply: first\r\n"
+                     "    #  complete frame received after the request.\r\n"
+                     "    #  Reply ends as set with newname_frame. Returns\r\n"
+                     "    #  as soon as reply is complete, nothing on timeout\r\n"
+                     " write newname_transaction request\r\n"
+                     "    # -send request without waiting\r\n"
+                     " read newname_transaction\r\n"
+                     "    # -wait for reply of request sent with write\r\n"
+                     " setup newname_transaction timeout_ms(1000)\r\n"
+                     SERIAL_TIMESTAMP_HELP
+                     SERIAL_QUEUE_HELP);
       break;
 
    case create_rmcios:
@@ -284,45 +1153,98 @@ void serial_class_func (struct serial_data *this,
 
       //default values :
       
-      // allocate new memory
-      this->rxbuffer = (char *) malloc (sizeof (char) * 1024);  
-      this->rxbuffer[0] = 0;
-      this->bufflen = 1024;
-      this->rindex = 0;
+      io_ring_init (&this->rx);
+      io_ring_resize (&this->rx, 1024);
+      this->rx_dropped = 0;
       this->halt_serial = 0;
       this->p_name[0] = 0;
-      this->serial_handle = INVALID_HANDLE_VALUE;
-      this->ss_dcb.DCBlength = sizeof (DCB);
-      this->ss_dcb.fBinary = 1;
-      this->ss_dcb.BaudRate = CBR_9600;
-      this->ss_dcb.ByteSize = 8;
-      this->ss_dcb.Parity = NOPARITY;
-      this->ss_dcb.StopBits = ONESTOPBIT;
-      this->ss_dcb.fDtrControl = 1;
-      this->ss_dcb.fRtsControl = 1;
-      this->ctl_mode = 0;
+      serial_port_init (&this->port);
+      io_mutex_init (&this->lock);
+      this->config.baud_rate = 9600;
+      this->config.data_bits = 8;
+      this->config.parity = 0;
+      this->config.stop_bits = 0;
+      this->config.dtr_control = 1;
+      this->config.rts_control = 1;
+      this->config.ctl_mode = 0;
       this->config_changed = 0;
+      this->batch_latency_us = 0;
+      this->batch_bytes = SERIAL_BATCH_MAX;
+      frame_config_init (&this->frame);
+      framer_init (&this->framer, &this->frame, serial_frame_emit, this);
+      this->read_ns = 0;
+      this->pending_ns = 0;
+      this->frame_ns = 0;
+      io_mutex_init (&this->reply_lock);
+      io_event_init (&this->reply_event);
+      this->reply_armed = 0;
+      this->reply = NULL;
+      this->reply_length = 0;
+      this->reply_size = 0;
+      this->reply_timeout_ms = 1000;
 
       this->id =
          create_channel_param (context, paramtype, param, 0,
                                (class_rmcios) serial_class_func, this);
       create_subchannel_str (context, this->id, "_port",
                              (class_rmcios) serial_port_subchan_func, this);
+      create_subchannel_str (context, this->id, "_batch",
+                             (class_rmcios) serial_batch_subchan_func, this);
+      create_subchannel_str (context, this->id, "_rx",
+                             (class_rmcios) serial_rx_subchan_func, this);
+      create_subchannel_str (context, this->id, "_frame",
+                             (class_rmcios) serial_frame_subchan_func, this);
+      create_subchannel_str (context, this->id, "_transaction",
+                             (class_rmcios) serial_transaction_subchan_func,
+                             this);
+      this->timestamp_push = 0;
+      io_mutex_init (&this->tx_lock);
+      io_event_init (&this->tx_space);
+      this->tx_head = NULL;
+      this->tx_tail = NULL;
+      this->tx_msgs = 0;
+      this->tx_bytes = 0;
+      this->tx_high_water = SERIAL_QUEUE_DEFAULT;
+      this->tx_policy = SERIAL_QUEUE_BLOCK;
+      this->tx_dropped_msgs = 0;
+      this->tx_dropped_bytes = 0;
+      this->tx_seq = 0;
+      this->tx_done = 0;
+      this->tx_offset = 0;
+      this->tx_busy = 0;
+      this->tx_wait = 0;
+      this->tx_wait_end = 0;
+      this->tx_lines = 0;
+      this->queue_id =
+         create_subchannel_str (context, this->id, "_queue",
+                                (class_rmcios) serial_queue_subchan_func,
+                                this);
+      this->timestamp_id =
+         create_subchannel_str (context, this->id, "_timestamp",
+                                (class_rmcios)
+                                serial_timestamp_subchan_func, this);
 
       // Set serial port name:
       if (num_params >= 2)
       {
-         strcpy (this->p_name, "\\\\.\\");
          param_to_string (context, paramtype, param, 1,
-                          sizeof (this->p_name) -
-                          strlen (this->p_name),
-                          this->p_name + strlen (this->p_name));
+                          sizeof (this->p_name), this->p_name);
       }
 
-      // Create thread for serial reception
-      DWORD myThreadID = 0;
-      HANDLE myHandle =
-         CreateThread (0, 0, serial_rx_thread, this, 0, &myThreadID);
+      // Receive in serial engine thread
+      this->held_length = 0;
+      this->first_ns = 0;
+      this->last_ns = 0;
+      this->open_error = 0;
+      this->retry_ms = SERIAL_RETRY_MIN_MS;
+      this->arrived = 0;
+      serial_task_init (&this->task, &this->port, serial_rx_handler, this);
+      if (serial_engine_add (&this->task) != 0)
+         printf ("Serial engine is not running\n");
+      io_mutex_lock (&serial_list_lock);
+      this->next = serial_list;
+      serial_list = this;
+      io_mutex_unlock (&serial_list_lock);
 
       break;
 
@@ -332,114 +1254,60 @@ void serial_class_func (struct serial_data *this,
          break;
       else
       {
-         this->ss_dcb.BaudRate = param_to_int (context, paramtype, param, 0);
+         this->config.baud_rate = param_to_int (context, paramtype, param, 0);
          if (num_params > 3)
          {
-            this->ss_dcb.ByteSize = param_to_int (context, paramtype, param, 1);
-            this->ss_dcb.Parity = param_to_int (context, paramtype, param, 2);
-            this->ss_dcb.StopBits =
+            this->config.data_bits =
+               param_to_int (context, paramtype, param, 1);
+            this->config.parity = param_to_int (context, paramtype, param, 2);
+            this->config.stop_bits =
                (param_to_int (context, paramtype, param, 3) - 1) >> 1;
          }
+         if (num_params > 4)
+         {
+            //4.rx_buff_len 
+            // Old buffer is freed after receive thread has left it
+            io_ring_resize (&this->rx,
+                            param_to_int (context, paramtype, param, 4));
+         }
+         if (num_params > 5)
+            this->config.ctl_mode =
+               param_to_int (context, paramtype, param, 5);
          // Signal thread to reopen and configure
-         this->config_changed = 1;
-
-         if (num_params < 5) break;
-         
-         // receive buffer length
-         unsigned int bufflen;
-         // temporarily disable buffering in thread:
-         this->bufflen = 0;     
-         
-         //4.rx_buff_len 
-         bufflen = param_to_int (context, paramtype, param, 4); 
-         if (this->rxbuffer != NULL)
-            // release memory
-            free (this->rxbuffer);      
-         
-         // allocate new memory
-         this->rxbuffer = (char *) malloc (sizeof (char) * bufflen);    
-         this->rxbuffer[0] = 0;
-         this->bufflen = bufflen;
-         if (num_params < 6) break; 
-         this->ctl_mode = param_to_int (context, paramtype, param, 5);
+         serial_reopen (this);
          break;
       }
 
    case read_rmcios:
       if (this == NULL)
       {
-         // List system serial port identifiers from windows registry.
-         HKEY hey;
-         DWORD dwRet;
-         dwRet = RegOpenKeyExA (HKEY_LOCAL_MACHINE,// _In_ HKEY hKey,
-                                // _In_opt_ LPCTSTR lpSubKey:
-                                "HARDWARE\\DEVICEMAP\\SERIALCOMM",      
-                                0,      //_In_ DWORD ulOptions,
-                                KEY_READ,// _In_ REGSAM samDesired,
-                                &hey    //_Out_ PHKEY phkResult
-            );
-
-         DWORD values;
-         DWORD max_namelen;
-         DWORD max_valuelen;
-
-         dwRet = RegQueryInfoKey (hey,  //_In_        HKEY     hKey,
-                                  NULL, // _Out_opt_   LPTSTR  lpClass,
-                                  NULL, // _Inout_opt_ LPDWORD lpcClass,
-                                  NULL, //_Reserved_  LPDWORD  lpReserved,
-                                  NULL, //_Out_opt_   LPDWORD  lpcSubKeys,
-                                  NULL, // _Out_opt_   LPDWORD lpcMaxSubKeyLen,
-                                  NULL, // _Out_opt_   LPDWORD lpcMaxClassLen,
-                                  &values,      // _Out_opt_ LPDWORD lpcValues,
-                                  // _Out_opt_ LPDWORD lpcMaxValueNameLen:
-                                  &max_namelen, 
-                                  // _Out_opt_ LPDWORD lpcMaxValueLen:
-                                  &max_valuelen,
-                                  // _Out_opt_ LPDWORD lpcbSecurityDescriptor:
-                                  NULL, 
-                                  NULL  // _Out_opt_ PFILETIME lpftLastWriteTime
-                                 );
-
-         if (values)
+         // Cached list, updated on device arrival and removal
+         char list[SERIAL_LIST_MAX];
+         serial_hotplug_list (list, sizeof (list));
+         return_string (context, returnv, list);
+      }
+      else
+      {
+         const char *parts[2];
+         int lengths[2], i;
+         io_ring_peek (&this->rx, parts, lengths);
+         for (i = 0; i < 2; i++)
          {
-            DWORD retCode;
-            int i;
-            for (i = 0, retCode = ERROR_SUCCESS; i < values; i++)
-            {
-               char value[max_valuelen + 2];
-               char name[max_namelen + 2];
-               DWORD valuelen = max_valuelen + 1;
-               DWORD namelen = max_namelen + 1;
-               value[0] = 0;
-
-               retCode = RegEnumValueA (hey, i,
-                                        name,
-                                        &namelen, NULL, NULL, value, &valuelen);
-
-
-               if (retCode == ERROR_SUCCESS)
-               {
-                  return_string (context, returnv, value);
-                  return_string (context, returnv, " ");
-               }
-            }
+            if (lengths[i] > 0)
+               return_buffer (context, returnv, parts[i], lengths[i]);
          }
-         RegCloseKey (hey);
       }
-      else
-         return_string (context, returnv, this->rxbuffer);
       break;
 
    case write_rmcios:
       if (this == NULL)
          break;
-      // reset receive buffer:
-      this->rindex = 0; 
-      // reset receive buffer:
-      this->rxbuffer[0] = 0;    
-
       if (num_params < 1)
+      {
+         // reset receive buffer:
+         io_ring_reset (&this->rx);
          break;
+      }
 
       plen = param_buffer_alloc_size (context, paramtype, param, 0);    
       // Determine the needed buffer size
@@ -449,21 +1317,66 @@ void serial_class_func (struct serial_data *this,
          // structure pointer to buffer data
          struct buffer_rmcios pbuffer;  
          pbuffer = param_to_buffer (context, paramtype, param, 0, plen, buffer);
-         if (this->serial_handle != INVALID_HANDLE_VALUE)
-         {
-            WriteFile (this->serial_handle, pbuffer.data,
-                       pbuffer.length, &dwWritten, NULL);
-         }
+         serial_send (this, pbuffer.data, pbuffer.length);
       }
       break;
    }
 }
 
+// Serial engine thread configuration
+void serialengine_class_func (void *this,
+                              const struct context_rmcios *context, int id,
+                              enum function_rmcios function,
+                              enum type_rmcios paramtype,
+                              struct combo_rmcios *returnv,
+                              int num_params,
+                              const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "Serial engine channel\r\n"
+                     " I/O threads shared by all serial channels.\r\n"
+                     " setup serialengine threads\r\n"
+                     "  # Number of I/O threads (default 1).\r\n"
+                     "  # Applies to serial channels created afterwards.\r\n"
+                     " read serialengine # Number of I/O threads\r\n");
+      break;
+
+   case setup_rmcios:
+      if (num_params < 1)
+         break;
+      if (serial_engine_start (param_to_integer (context, paramtype,
+                                                 param, 0)) != 0)
+         printf ("Could not start serial engine threads\n");
+      break;
+
+   case read_rmcios:
+      return_int (context, returnv, serial_engine_threads ());
+      break;
+   }
+}
+
 void init_serial_channels (const struct context_rmcios *context)
 {
-   printf ("Windows serial module\r\n[" VERSION_STR "]\r\n");
+   printf ("Serial module\r\n[" VERSION_STR "]\r\n");
    module_context = context;
 
+   // One thread services all serial ports
+   if (serial_engine_start (1) != 0)
+   {
+      printf ("Could not start serial engine\n");
+      return;
+   }
+   // Port arrival reopens waiting channels
+   io_mutex_init (&serial_list_lock);
+   if (serial_hotplug_start (serial_hotplug_event, NULL) != 0)
+      printf ("Serial port hotplug detection not available\n");
+
+   create_channel_str (context, "serialengine",
+                       (class_rmcios) serialengine_class_func, NULL);
+
    create_channel_str (context, "serial", (class_rmcios) serial_class_func,
                        NULL);
 /* Removed : seen not to work on some machines.
@@ -0,0 +1,519 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Serial I/O engine.
+ *
+ * Changelog: (date,who,description)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "serial_engine.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#define ENGINE_MAX_EVENTS 64
+#define ENGINE_MAX_LOOPS 16
+
+struct serial_loop
+{
+#ifdef _WIN32
+   HANDLE iocp;
+#else
+   int epfd;
+   int wake_fd;                 // eventfd for kicks
+   int timer_fd;
+   uint64_t timer_programmed;   // Deadline in timer_fd. 0 = none
+#endif
+   struct serial_task *tasks;   // Only added to
+};
+
+static struct
+{
+   int started;
+   io_mutex lock;
+   int num_loops;               // Running threads
+   int active_loops;            // Threads new tasks are assigned to
+   unsigned next_loop;
+   struct serial_loop loops[ENGINE_MAX_LOOPS];
+} engine;
+
+// Loop of the current engine thread. NULL in other threads.
+static __thread struct serial_loop *current_loop;
+
+int serial_engine_current (void)
+{
+   return current_loop != NULL;
+}
+
+void serial_task_init (struct serial_task *t, struct serial_port *port,
+                       serial_task_handler handler, void *owner)
+{
+   memset (t, 0, sizeof (*t));
+   t->port = port;
+   t->handler = handler;
+   t->owner = owner;
+}
+
+void serial_task_timer (struct serial_task *t, long delay_us)
+{
+   t->deadline = delay_us < 0 ? 0 : io_clock_ns () + delay_us * 1000ULL;
+}
+
+// Run handlers of expired timers. Returns earliest remaining deadline
+// or 0 when no timer is running.
+static uint64_t serial_loop_run_timers (struct serial_loop *loop)
+{
+   struct serial_task *t;
+   uint64_t now = io_clock_ns ();
+   uint64_t next = 0;
+   for (t = __atomic_load_n (&loop->tasks, __ATOMIC_ACQUIRE);
+        t != NULL; t = t->next)
+   {
+      if (t->deadline != 0 && t->deadline <= now)
+      {
+         t->deadline = 0;
+         t->handler (t, SERIAL_IO_TIMER);
+      }
+      // Handler may have started the timer again
+      if (t->deadline != 0 && (next == 0 || t->deadline < next))
+         next = t->deadline;
+   }
+   return next;
+}
+
+#ifdef _WIN32
+////////////////////////////////////////////////////////////////////////
+// Completion port
+////////////////////////////////////////////////////////////////////////
+
+// Wait for next received character. Data already queued in the driver
+// is reported with a posted completion.
+static int serial_task_arm (struct serial_task *t)
+{
+   struct serial_io_op *op;
+   int queued = serial_port_queued (t->port);
+   if (queued < 0)
+      return -1;
+   op = (struct serial_io_op *) calloc (1, sizeof (*op));
+   if (op == NULL)
+      return -1;
+   op->task = t;
+   t->wait = op;
+   if (queued > 0)
+   {
+      PostQueuedCompletionStatus (t->loop->iocp, 0, (ULONG_PTR) t, &op->ov);
+      return 0;
+   }
+   // Completes through the completion port also when done immediately
+   if (!WaitCommEvent (t->port->handle, &op->mask, &op->ov)
+       && GetLastError () != ERROR_IO_PENDING)
+   {
+      t->wait = NULL;
+      free (op);
+      return -1;
+   }
+   return 0;
+}
+
+int serial_task_watch (struct serial_task *t)
+{
+   if (CreateIoCompletionPort (t->port->handle, t->loop->iocp,
+                               (ULONG_PTR) t, 0) == NULL)
+   {
+      printf ("Could not associate serial port with completion port : %d\n",
+              (int) GetLastError ());
+      return -1;
+   }
+   t->watched = 1;
+   if (serial_task_arm (t) != 0)
+   {
+      t->watched = 0;
+      return -1;
+   }
+   return 0;
+}
+
+void serial_task_unwatch (struct serial_task *t)
+{
+   t->watched = 0;
+   // Completions of the cancelled operations free them
+   if (t->wait != NULL)
+   {
+      t->wait->task = NULL;
+      t->wait = NULL;
+   }
+   if (t->write_op != NULL)
+   {
+      t->write_op->task = NULL;
+      t->write_op = NULL;
+   }
+   CancelIo (t->port->handle);
+}
+
+int serial_task_write (struct serial_task *t, const char *data, int length)
+{
+   struct serial_io_op *op;
+   if (!t->watched || t->write_op != NULL)
+      return -1;
+   // Own copy: abandoned write may complete after data is gone
+   op = (struct serial_io_op *) calloc (1, sizeof (*op) + length);
+   if (op == NULL)
+      return -1;
+   op->write = 1;
+   op->task = t;
+   memcpy (op->data, data, length);
+   t->write_op = op;
+   if (!WriteFile (t->port->handle, op->data, length, NULL, &op->ov)
+       && GetLastError () != ERROR_IO_PENDING)
+   {
+      t->write_op = NULL;
+      free (op);
+      return -1;
+   }
+   return 0;
+}
+
+void serial_task_kick (struct serial_task *t)
+{
+   if (__atomic_exchange_n (&t->kicked, 1, __ATOMIC_ACQ_REL) == 0)
+      PostQueuedCompletionStatus (t->loop->iocp, 0, (ULONG_PTR) t, NULL);
+}
+
+static IO_THREAD_FUNC (serial_loop_thread, arg)
+{
+   struct serial_loop *loop = (struct serial_loop *) arg;
+   uint64_t deadline = 0;
+   current_loop = loop;
+   while (1)
+   {
+      DWORD bytes = 0;
+      ULONG_PTR key = 0;
+      LPOVERLAPPED ov = NULL;
+      DWORD timeout = INFINITE;
+      struct serial_io_op *op;
+      struct serial_task *t;
+      BOOL ok;
+
+      if (deadline != 0)
+      {
+         uint64_t now = io_clock_ns ();
+         timeout = deadline > now ?
+                   (DWORD) ((deadline - now + 999999) / 1000000) : 0;
+      }
+      ok = GetQueuedCompletionStatus (loop->iocp, &bytes, &key, &ov,
+                                      timeout);
+      t = (struct serial_task *) key;
+      if (t != NULL && ov == NULL)
+      {
+         __atomic_store_n (&t->kicked, 0, __ATOMIC_RELEASE);
+         t->handler (t, SERIAL_IO_KICK);
+      }
+      else if (ov != NULL)
+      {
+         int write;
+         op = (struct serial_io_op *) ov;
+         t = op->task;
+         write = op->write;
+         free (op);
+         // Operation of a port closed since
+         if (t == NULL || !t->watched)
+            t = NULL;
+         else if (write)
+         {
+            t->write_op = NULL;
+            t->written = ok ? (int) bytes : -1;
+            t->handler (t, SERIAL_IO_WRITE);
+         }
+         else
+         {
+            t->wait = NULL;
+            t->handler (t, SERIAL_IO_READ | (ok ? 0 : SERIAL_IO_ERROR));
+            if (t->watched && t->wait == NULL && serial_task_arm (t) != 0)
+               t->handler (t, SERIAL_IO_ERROR);
+         }
+      }
+      deadline = serial_loop_run_timers (loop);
+   }
+   IO_THREAD_RETURN;
+}
+
+static int serial_loop_start (struct serial_loop *loop)
+{
+   loop->iocp = CreateIoCompletionPort (INVALID_HANDLE_VALUE, NULL, 0, 1);
+   if (loop->iocp == NULL)
+   {
+      printf ("Could not create completion port : %d\n",
+              (int) GetLastError ());
+      return -1;
+   }
+   return io_thread_start (serial_loop_thread, loop);
+}
+
+#else
+////////////////////////////////////////////////////////////////////////
+// epoll
+////////////////////////////////////////////////////////////////////////
+
+int serial_task_watch (struct serial_task *t)
+{
+   struct epoll_event ev;
+   ev.events = EPOLLIN;
+   ev.data.ptr = t;
+   if (epoll_ctl (t->loop->epfd, EPOLL_CTL_ADD, t->port->fd, &ev) != 0)
+   {
+      printf ("Could not add serial port to epoll : %d\n", errno);
+      return -1;
+   }
+   t->watched = 1;
+   return 0;
+}
+
+void serial_task_unwatch (struct serial_task *t)
+{
+   if (!t->watched)
+      return;
+   t->watched = 0;
+   t->write_length = 0;
+   epoll_ctl (t->loop->epfd, EPOLL_CTL_DEL, t->port->fd, NULL);
+}
+
+// Wait also for space to write while a write is pending
+static void serial_task_want_write (struct serial_task *t, int on)
+{
+   struct epoll_event ev;
+   ev.events = on ? EPOLLIN | EPOLLOUT : EPOLLIN;
+   ev.data.ptr = t;
+   epoll_ctl (t->loop->epfd, EPOLL_CTL_MOD, t->port->fd, &ev);
+}
+
+// Written in the engine loop when the port has space
+int serial_task_write (struct serial_task *t, const char *data, int length)
+{
+   if (!t->watched || t->write_length > 0 || length <= 0)
+      return -1;
+   t->write_data = data;
+   t->write_length = length;
+   serial_task_want_write (t, 1);
+   return 0;
+}
+
+// Port has space for pending write. Returns SERIAL_IO_WRITE when the
+// write has completed.
+static int serial_task_run_write (struct serial_task *t)
+{
+   int bytes;
+   if (t->write_length <= 0)
+      return 0;
+   bytes = serial_port_write (t->port, t->write_data, t->write_length);
+   if (bytes == 0)
+      return 0;
+   t->written = bytes;
+   t->write_length = 0;
+   serial_task_want_write (t, 0);
+   return SERIAL_IO_WRITE;
+}
+
+void serial_task_kick (struct serial_task *t)
+{
+   uint64_t one = 1;
+   if (__atomic_exchange_n (&t->kicked, 1, __ATOMIC_ACQ_REL) == 0
+       && write (t->loop->wake_fd, &one, sizeof (one)) < 0)
+      return;                   // Counter full: loop is being woken
+}
+
+static void serial_loop_run_kicks (struct serial_loop *loop)
+{
+   struct serial_task *t;
+   uint64_t count;
+   if (read (loop->wake_fd, &count, sizeof (count)) < 0)
+      count = 0;
+   for (t = __atomic_load_n (&loop->tasks, __ATOMIC_ACQUIRE);
+        t != NULL; t = t->next)
+   {
+      if (__atomic_exchange_n (&t->kicked, 0, __ATOMIC_ACQ_REL))
+         t->handler (t, SERIAL_IO_KICK);
+   }
+}
+
+// Program timer_fd to absolute monotonic deadline
+static void serial_loop_program (struct serial_loop *loop, uint64_t deadline)
+{
+   struct itimerspec its;
+   if (deadline == loop->timer_programmed)
+      return;
+   memset (&its, 0, sizeof (its));
+   its.it_value.tv_sec = deadline / 1000000000ULL;
+   its.it_value.tv_nsec = deadline % 1000000000ULL;
+   timerfd_settime (loop->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+   loop->timer_programmed = deadline;
+}
+
+static IO_THREAD_FUNC (serial_loop_thread, arg)
+{
+   struct serial_loop *loop = (struct serial_loop *) arg;
+   struct epoll_event events[ENGINE_MAX_EVENTS];
+   current_loop = loop;
+   while (1)
+   {
+      int i, n;
+      serial_loop_program (loop, serial_loop_run_timers (loop));
+      n = epoll_wait (loop->epfd, events, ENGINE_MAX_EVENTS, -1);
+      for (i = 0; i < n; i++)
+      {
+         struct serial_task *t = (struct serial_task *) events[i].data.ptr;
+         if (t == NULL)
+         {
+            serial_loop_run_kicks (loop);
+            continue;
+         }
+         if (events[i].data.ptr == &loop->timer_fd)
+         {
+            uint64_t count;
+            if (read (loop->timer_fd, &count, sizeof (count)) < 0)
+               count = 0;
+            loop->timer_programmed = 0;
+            continue;
+         }
+         // Port closed earlier in this batch
+         if (!t->watched)
+            continue;
+         t->handler (t, SERIAL_IO_READ |
+                     (events[i].events & EPOLLOUT ?
+                      serial_task_run_write (t) : 0) |
+                     (events[i].events & (EPOLLERR | EPOLLHUP) ?
+                      SERIAL_IO_ERROR : 0));
+      }
+   }
+   IO_THREAD_RETURN;
+}
+
+static int serial_loop_start (struct serial_loop *loop)
+{
+   struct epoll_event ev;
+   loop->epfd = epoll_create1 (EPOLL_CLOEXEC);
+   if (loop->epfd < 0)
+   {
+      printf ("Could not create epoll instance : %d\n", errno);
+      return -1;
+   }
+   loop->wake_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (loop->wake_fd < 0)
+   {
+      printf ("Could not create eventfd : %d\n", errno);
+      return -1;
+   }
+   ev.events = EPOLLIN;
+   ev.data.ptr = NULL;
+   epoll_ctl (loop->epfd, EPOLL_CTL_ADD, loop->wake_fd, &ev);
+
+   loop->timer_fd = timerfd_create (CLOCK_MONOTONIC,
+                                    TFD_NONBLOCK | TFD_CLOEXEC);
+   if (loop->timer_fd < 0)
+   {
+      printf ("Could not create timerfd : %d\n", errno);
+      return -1;
+   }
+   ev.events = EPOLLIN;
+   ev.data.ptr = &loop->timer_fd;
+   epoll_ctl (loop->epfd, EPOLL_CTL_ADD, loop->timer_fd, &ev);
+   loop->timer_programmed = 0;
+   return io_thread_start (serial_loop_thread, loop);
+}
+#endif
+
+////////////////////////////////////////////////////////////////////////
+// Threads and registration
+////////////////////////////////////////////////////////////////////////
+
+int serial_engine_start (int threads)
+{
+   int result = 0;
+   if (threads <= 0)
+      threads = 1;
+   if (threads > ENGINE_MAX_LOOPS)
+      threads = ENGINE_MAX_LOOPS;
+   // First call is from module init
+   if (!engine.started)
+   {
+      io_mutex_init (&engine.lock);
+      engine.started = 1;
+   }
+
+   io_mutex_lock (&engine.lock);
+   while (engine.num_loops < threads)
+   {
+      if (serial_loop_start (&engine.loops[engine.num_loops]) != 0)
+      {
+         result = -1;
+         break;
+      }
+      engine.num_loops++;
+   }
+   if (engine.num_loops == 0)
+      result = -1;
+   else
+      engine.active_loops = threads < engine.num_loops ?
+                            threads : engine.num_loops;
+   io_mutex_unlock (&engine.lock);
+   return result;
+}
+
+int serial_engine_threads (void)
+{
+   int threads;
+   io_mutex_lock (&engine.lock);
+   threads = engine.active_loops;
+   io_mutex_unlock (&engine.lock);
+   return threads;
+}
+
+int serial_engine_add (struct serial_task *t)
+{
+   struct serial_loop *loop;
+   io_mutex_lock (&engine.lock);
+   if (engine.active_loops == 0)
+   {
+      io_mutex_unlock (&engine.lock);
+      return -1;
+   }
+   loop = &engine.loops[engine.next_loop++ % engine.active_loops];
+   t->loop = loop;
+   t->next = loop->tasks;
+   __atomic_store_n (&loop->tasks, t, __ATOMIC_RELEASE);
+   io_mutex_unlock (&engine.lock);
+   serial_task_kick (t);
+   return 0;
+}
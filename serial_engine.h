@@ -0,0 +1,139 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Serial I/O engine.
+ * Completion port backend on windows, epoll backend on linux.
+ *
+ * A small number of engine threads service all serial ports. Every
+ * port is a task bound to one engine thread, so its handler always
+ * runs in the same thread. The handler is called when:
+ *  - data has been received on the watched port (SERIAL_IO_READ),
+ *  - the port has failed or hung up (SERIAL_IO_ERROR),
+ *  - the timer of the task expires (SERIAL_IO_TIMER),
+ *  - another thread has kicked the task (SERIAL_IO_KICK),
+ *  - a write started with serial_task_write has completed
+ *    (SERIAL_IO_WRITE).
+ *
+ * Opening, reconfiguring and closing the port is done by the handler.
+ * An opened port is watched with serial_task_watch and must be unwatched
+ * with serial_task_unwatch before closing.
+ *
+ * Changelog: (date,who,description)
+ */
+#ifndef SERIAL_ENGINE_H
+#define SERIAL_ENGINE_H
+
+#include "io_platform.h"
+#include "serial_port.h"
+
+// Event bits passed to the handler
+#define SERIAL_IO_READ 1
+#define SERIAL_IO_ERROR 2
+#define SERIAL_IO_TIMER 4
+#define SERIAL_IO_KICK 8
+#define SERIAL_IO_WRITE 16
+
+struct serial_task;
+struct serial_loop;
+typedef void (*serial_task_handler) (struct serial_task *t, int events);
+
+#ifdef _WIN32
+// Outstanding WaitCommEvent or WriteFile. Freed by the engine when it
+// completes.
+struct serial_io_op
+{
+   OVERLAPPED ov;
+   DWORD mask;
+   int write;
+   struct serial_task *task;    // NULL when abandoned
+   char data[];                 // Copy of written data
+};
+#endif
+
+struct serial_task
+{
+   struct serial_port *port;
+   serial_task_handler handler;
+   void *owner;
+   struct serial_loop *loop;    // Engine thread of the task
+   struct serial_task *next;    // Tasks of the same thread
+   int kicked;
+   int watched;
+   uint64_t deadline;           // Timer. 0 = stopped
+   int written;                 // Result of completed write
+#ifdef _WIN32
+   struct serial_io_op *wait;
+   struct serial_io_op *write_op;
+#else
+   const char *write_data;      // Write waiting for space
+   int write_length;
+#endif
+};
+
+// Start engine threads. Calling again with more threads starts the
+// missing ones. Tasks added afterwards are spread over the first threads.
+int serial_engine_start (int threads);
+
+// Number of threads new tasks are spread over
+int serial_engine_threads (void);
+
+// Nonzero when called from an engine thread, for example from a handler.
+// Waiting for the engine there would deadlock.
+int serial_engine_current (void);
+
+void serial_task_init (struct serial_task *t, struct serial_port *port,
+                       serial_task_handler handler, void *owner);
+
+// Bind task to an engine thread and kick it.
+int serial_engine_add (struct serial_task *t);
+
+// Call handler with SERIAL_IO_KICK in the engine thread. Any thread.
+void serial_task_kick (struct serial_task *t);
+
+// Call handler with SERIAL_IO_TIMER after delay_us. < 0 stops the timer.
+// Engine thread. Resolution is milliseconds on windows.
+void serial_task_timer (struct serial_task *t, long delay_us);
+
+// Start notifications of received data on the opened port.
+// Engine thread. Returns 0 on success.
+int serial_task_watch (struct serial_task *t);
+
+// Stop notifications before closing the port. Engine thread.
+// A write in progress is abandoned without SERIAL_IO_WRITE.
+void serial_task_unwatch (struct serial_task *t);
+
+// Write data on the watched port without waiting. The handler is called
+// with SERIAL_IO_WRITE when done, with written set to the number of
+// bytes written, which may be less than length, or -1 on error.
+// One write at a time. data must stay valid until completion or
+// unwatch. Engine thread. Returns 0 when started.
+int serial_task_write (struct serial_task *t, const char *data, int length);
+
+#endif
@@ -0,0 +1,366 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Serial port hotplug detection and cached port list.
+ *
+ * Changelog: (date,who,description)
+ */
+#include <stdio.h>
+#include <string.h>
+#include "io_platform.h"
+#include "serial_hotplug.h"
+
+#ifdef _WIN32
+#include <dbt.h>
+#else
+#include <dirent.h>
+#include <errno.h>
+#include <sys/inotify.h>
+#endif
+
+#define HOTPLUG_MAX_PORTS 256
+#define HOTPLUG_NAME_MAX 64
+
+static struct
+{
+   io_mutex lock;
+   int count;
+   char names[HOTPLUG_MAX_PORTS][HOTPLUG_NAME_MAX];
+   serial_hotplug_func func;
+   void *arg;
+#ifndef _WIN32
+   int fd;                      // inotify
+   int wd_dev;
+   int wd_pts;
+#endif
+} hotplug;
+
+static int hotplug_find (const char *name)
+{
+   int i;
+   for (i = 0; i < hotplug.count; i++)
+   {
+      if (strcmp (hotplug.names[i], name) == 0)
+         return i;
+   }
+   return -1;
+}
+
+// Add name to list. Returns 1 when it was not listed before.
+static int hotplug_add (const char *name)
+{
+   int added = 0;
+   io_mutex_lock (&hotplug.lock);
+   if (hotplug_find (name) < 0 && hotplug.count < HOTPLUG_MAX_PORTS)
+   {
+      snprintf (hotplug.names[hotplug.count++], HOTPLUG_NAME_MAX, "%s",
+                name);
+      added = 1;
+   }
+   io_mutex_unlock (&hotplug.lock);
+   return added;
+}
+
+// Remove name from list. Returns 1 when it was listed.
+static int hotplug_remove (const char *name)
+{
+   int i;
+   io_mutex_lock (&hotplug.lock);
+   i = hotplug_find (name);
+   if (i >= 0)
+   {
+      hotplug.count--;
+      memcpy (hotplug.names[i], hotplug.names[hotplug.count],
+              HOTPLUG_NAME_MAX);
+   }
+   io_mutex_unlock (&hotplug.lock);
+   return i >= 0;
+}
+
+int serial_hotplug_list (char *buffer, int size)
+{
+   int i, length = 0;
+   if (size <= 0)
+      return 0;
+   buffer[0] = 0;
+   io_mutex_lock (&hotplug.lock);
+   for (i = 0; i < hotplug.count && length < size - 1; i++)
+   {
+      length += snprintf (buffer + length, size - length, "%s%s",
+                          i > 0 ? " " : "", hotplug.names[i]);
+   }
+   io_mutex_unlock (&hotplug.lock);
+   return length < size ? length : size - 1;
+}
+
+#ifdef _WIN32
+////////////////////////////////////////////////////////////////////////
+// Device change notifications
+////////////////////////////////////////////////////////////////////////
+
+// GUID_DEVINTERFACE_COMPORT
+static const GUID hotplug_comport_guid = {
+   0x86E0D1E0, 0x8089, 0x11D0,
+   {0x9C, 0xE4, 0x08, 0x00, 0x3E, 0x30, 0x1F, 0x73}
+};
+
+// Update port list from registry. Reports removed and added ports.
+// Returns number of added ports.
+static int hotplug_scan (void)
+{
+   char found[HOTPLUG_MAX_PORTS][HOTPLUG_NAME_MAX];
+   char removed[HOTPLUG_MAX_PORTS][HOTPLUG_NAME_MAX];
+   int num_found = 0, num_removed = 0, added = 0;
+   DWORD values = 0, max_namelen = 0, max_valuelen = 0;
+   HKEY hey;
+   int i, j;
+
+   if (RegOpenKeyExA (HKEY_LOCAL_MACHINE, "HARDWARE\\DEVICEMAP\\SERIALCOMM",
+                      0, KEY_READ, &hey) == ERROR_SUCCESS)
+   {
+      RegQueryInfoKey (hey, NULL, NULL, NULL, NULL, NULL, NULL, &values,
+                       &max_namelen, &max_valuelen, NULL, NULL);
+      for (i = 0; i < (int) values && num_found < HOTPLUG_MAX_PORTS; i++)
+      {
+         char value[max_valuelen + 2];
+         char name[max_namelen + 2];
+         DWORD valuelen = max_valuelen + 1;
+         DWORD namelen = max_namelen + 1;
+         value[0] = 0;
+         if (RegEnumValueA (hey, i, name, &namelen, NULL, NULL,
+                            (LPBYTE) value, &valuelen) == ERROR_SUCCESS)
+            snprintf (found[num_found++], HOTPLUG_NAME_MAX, "%s", value);
+      }
+      RegCloseKey (hey);
+   }
+
+   io_mutex_lock (&hotplug.lock);
+   for (i = 0; i < hotplug.count; i++)
+   {
+      for (j = 0; j < num_found; j++)
+      {
+         if (strcmp (hotplug.names[i], found[j]) == 0)
+            break;
+      }
+      if (j == num_found)
+         memcpy (removed[num_removed++], hotplug.names[i], HOTPLUG_NAME_MAX);
+   }
+   io_mutex_unlock (&hotplug.lock);
+
+   for (i = 0; i < num_removed; i++)
+   {
+      if (hotplug_remove (removed[i]) && hotplug.func != NULL)
+         hotplug.func (hotplug.arg, removed[i], 0);
+   }
+   for (i = 0; i < num_found; i++)
+   {
+      if (hotplug_add (found[i]))
+      {
+         added++;
+         if (hotplug.func != NULL)
+            hotplug.func (hotplug.arg, found[i], 1);
+      }
+   }
+   return added;
+}
+
+static LRESULT CALLBACK hotplug_wndproc (HWND hwnd, UINT msg, WPARAM wparam,
+                                         LPARAM lparam)
+{
+   DEV_BROADCAST_HDR *hdr = (DEV_BROADCAST_HDR *) lparam;
+   if (msg != WM_DEVICECHANGE)
+      return DefWindowProc (hwnd, msg, wparam, lparam);
+   if (wparam == DBT_DEVICEARRIVAL || wparam == DBT_DEVICEREMOVECOMPLETE)
+   {
+      // Port of a driver that has not updated the registry yet
+      if (hotplug_scan () == 0 && wparam == DBT_DEVICEARRIVAL
+          && hdr != NULL && hdr->dbch_devicetype == DBT_DEVTYP_PORT
+          && hotplug.func != NULL)
+         hotplug.func (hotplug.arg,
+                       ((DEV_BROADCAST_PORT_A *) hdr)->dbcp_name, 1);
+   }
+   return TRUE;
+}
+
+static IO_THREAD_FUNC (hotplug_thread, arg)
+{
+   DEV_BROADCAST_DEVICEINTERFACE_A filter;
+   WNDCLASSA wc;
+   HWND hwnd;
+   MSG msg;
+
+   // Hidden top level window: message-only windows get no broadcasts
+   memset (&wc, 0, sizeof (wc));
+   wc.lpfnWndProc = hotplug_wndproc;
+   wc.hInstance = GetModuleHandle (NULL);
+   wc.lpszClassName = "rmcios_serial_hotplug";
+   RegisterClassA (&wc);
+   hwnd = CreateWindowA (wc.lpszClassName, "", WS_OVERLAPPED, 0, 0, 0, 0,
+                         NULL, NULL, wc.hInstance, NULL);
+   if (hwnd == NULL)
+   {
+      printf ("Could not create serial hotplug window : %d\n",
+              (int) GetLastError ());
+      IO_THREAD_RETURN;
+   }
+   memset (&filter, 0, sizeof (filter));
+   filter.dbcc_size = sizeof (filter);
+   filter.dbcc_devicetype = DBT_DEVTYP_DEVICEINTERFACE;
+   filter.dbcc_classguid = hotplug_comport_guid;
+   RegisterDeviceNotificationA (hwnd, &filter, DEVICE_NOTIFY_WINDOW_HANDLE);
+
+   while (GetMessage (&msg, NULL, 0, 0) > 0)
+   {
+      TranslateMessage (&msg);
+      DispatchMessage (&msg);
+   }
+   IO_THREAD_RETURN;
+}
+
+int serial_hotplug_start (serial_hotplug_func func, void *arg)
+{
+   io_mutex_init (&hotplug.lock);
+   hotplug.count = 0;
+   hotplug_scan ();
+   hotplug.func = func;
+   hotplug.arg = arg;
+   return io_thread_start (hotplug_thread, NULL);
+}
+
+#else
+////////////////////////////////////////////////////////////////////////
+// inotify
+////////////////////////////////////////////////////////////////////////
+
+static int hotplug_is_serial (const char *name)
+{
+   static const char *prefixes[] = {
+      "ttyS", "ttyUSB", "ttyACM", "ttyAMA", "ttymxc", "ttyO", "ttyXRUSB",
+      "rfcomm"
+   };
+   unsigned int i;
+   for (i = 0; i < sizeof (prefixes) / sizeof (prefixes[0]); i++)
+   {
+      if (strncmp (name, prefixes[i], strlen (prefixes[i])) == 0)
+         return 1;
+   }
+   return 0;
+}
+
+static void hotplug_event (const struct inotify_event *e)
+{
+   char path[HOTPLUG_NAME_MAX];
+   int listed, present;
+
+   // Events of the watched directory itself have no name
+   if (e->len == 0)
+      return;
+   listed = e->wd == hotplug.wd_dev && hotplug_is_serial (e->name);
+   present = (e->mask & (IN_DELETE | IN_MOVED_FROM)) == 0;
+   if (e->wd == hotplug.wd_dev && !listed)
+      return;
+   // Names that do not fit the list are not serial ports
+   if (snprintf (path, sizeof (path), "%s/%s",
+                 e->wd == hotplug.wd_dev ? "/dev" : "/dev/pts", e->name)
+       >= (int) sizeof (path))
+      return;
+   if (listed)
+   {
+      if (present)
+         hotplug_add (path);
+      else
+         hotplug_remove (path);
+   }
+   // Attribute changes report ports that became accessible
+   if (hotplug.func != NULL)
+      hotplug.func (hotplug.arg, path, present);
+}
+
+static IO_THREAD_FUNC (hotplug_thread, arg)
+{
+   char buffer[4096] __attribute__ ((aligned (8)));
+   while (1)
+   {
+      int n = read (hotplug.fd, buffer, sizeof (buffer));
+      int i = 0;
+      if (n < 0 && errno == EINTR)
+         continue;
+      if (n <= 0)
+         break;
+      while (i < n)
+      {
+         const struct inotify_event *e =
+            (const struct inotify_event *) (buffer + i);
+         hotplug_event (e);
+         i += sizeof (struct inotify_event) + e->len;
+      }
+   }
+   printf ("Serial hotplug watch stopped : %d\n", errno);
+   IO_THREAD_RETURN;
+}
+
+int serial_hotplug_start (serial_hotplug_func func, void *arg)
+{
+   uint32_t mask = IN_CREATE | IN_DELETE | IN_ATTRIB | IN_MOVED_TO
+                   | IN_MOVED_FROM;
+   struct dirent *entry;
+   char path[HOTPLUG_NAME_MAX];
+   DIR *dir;
+
+   io_mutex_init (&hotplug.lock);
+   hotplug.count = 0;
+   hotplug.func = func;
+   hotplug.arg = arg;
+
+   // Watch before listing, so that no node is missed in between
+   hotplug.fd = inotify_init1 (IN_CLOEXEC);
+   if (hotplug.fd < 0)
+   {
+      printf ("Could not create inotify instance : %d\n", errno);
+      return -1;
+   }
+   hotplug.wd_dev = inotify_add_watch (hotplug.fd, "/dev", mask);
+   hotplug.wd_pts = inotify_add_watch (hotplug.fd, "/dev/pts", mask);
+   if (hotplug.wd_dev < 0)
+      printf ("Could not watch /dev : %d\n", errno);
+
+   dir = opendir ("/dev");
+   while (dir != NULL && (entry = readdir (dir)) != NULL)
+   {
+      if (hotplug_is_serial (entry->d_name)
+          && snprintf (path, sizeof (path), "/dev/%s", entry->d_name)
+          < (int) sizeof (path))
+         hotplug_add (path);
+   }
+   if (dir != NULL)
+      closedir (dir);
+   return io_thread_start (hotplug_thread, NULL);
+}
+#endif
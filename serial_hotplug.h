@@ -0,0 +1,59 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Serial port hotplug detection and cached port list.
+ *
+ * Windows: a hidden window receives WM_DEVICECHANGE for serial port and
+ * COM port interface arrival and removal. The port list is read from
+ * HARDWARE\DEVICEMAP\SERIALCOMM only when devices change.
+ *
+ * Linux: /dev and /dev/pts are watched with inotify and the port list
+ * is updated from created and deleted serial device nodes.
+ *
+ * The watcher runs in one thread that sleeps until something changes.
+ *
+ * Changelog: (date,who,description)
+ */
+#ifndef SERIAL_HOTPLUG_H
+#define SERIAL_HOTPLUG_H
+
+// Called from the watcher thread when a device node appears (present=1)
+// or disappears (present=0). name is COMx on windows and full device
+// path on linux.
+typedef void (*serial_hotplug_func) (void *arg, const char *name,
+                                     int present);
+
+// Build port list and start watching. Returns 0 on success.
+int serial_hotplug_start (serial_hotplug_func func, void *arg);
+
+// Copy space separated port list to buffer. Returns list length.
+int serial_hotplug_list (char *buffer, int size);
+
+#endif
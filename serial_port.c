@@ -0,0 +1,497 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Serial port backend implementation.
+ *
+ * Windows: the port is opened for overlapped I/O with EV_RXCHAR events
+ * enabled for the engine. All bytes reported by ClearCommError are read
+ * with one ReadFile, which returns immediately because of the read
+ * timeouts.
+ *
+ * POSIX: the port is opened non-blocking in raw mode. On linux, rates
+ * between the standard speeds are set with termios2 and rts transmit
+ * control uses the RS485 mode of the driver when it has one.
+ *
+ * Changelog: (date,who,description)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "serial_port.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#ifdef __linux__
+#include <linux/serial.h>
+#endif
+#endif
+
+#ifdef _WIN32
+////////////////////////////////////////////////////////////////////////
+// Win32 communications API
+////////////////////////////////////////////////////////////////////////
+
+// Event with low bit set: completion is not queued to completion port
+static HANDLE serial_port_event (void)
+{
+   return (HANDLE) ((ULONG_PTR) CreateEvent (NULL, TRUE, FALSE, NULL) | 1);
+}
+
+void serial_port_init (struct serial_port *p)
+{
+   memset (p, 0, sizeof (*p));
+   p->handle = INVALID_HANDLE_VALUE;
+   p->read_ov.hEvent = serial_port_event ();
+}
+
+int serial_port_open (struct serial_port *p, const char *name,
+                      const struct serial_config *c)
+{
+   char path[64];
+   // Device namespace path works also for COM10 and above
+   if (strncmp (name, "\\\\.\\", 4) == 0)
+      snprintf (path, sizeof (path), "%s", name);
+   else
+      snprintf (path, sizeof (path), "\\\\.\\%s", name);
+
+   p->handle = CreateFile (path, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+                           OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+   if (p->handle == INVALID_HANDLE_VALUE)
+      return -1;
+   if (serial_port_configure (p, c) != 0
+       || !SetCommMask (p->handle, EV_RXCHAR))
+   {
+      serial_port_close (p);
+      return -1;
+   }
+   return 0;
+}
+
+int serial_port_is_open (struct serial_port *p)
+{
+   return p->handle != INVALID_HANDLE_VALUE;
+}
+
+int serial_port_configure (struct serial_port *p,
+                           const struct serial_config *c)
+{
+   COMMTIMEOUTS timeouts = { 0 };
+   DCB dcb;
+
+   // Keep reserved and driver specific values
+   dcb.DCBlength = sizeof (DCB);
+   if (!GetCommState (p->handle, &dcb))
+   {
+      printf ("Error! GetCommState\n");
+      return -1;
+   }
+   dcb.fBinary = 1;
+   dcb.BaudRate = c->baud_rate;
+   dcb.ByteSize = c->data_bits;
+   dcb.Parity = c->parity;
+   dcb.StopBits = c->stop_bits;
+   dcb.fDtrControl = c->dtr_control;
+   dcb.fRtsControl = c->rts_control;
+   // Transmit control done by the driver
+   p->native_ctl = c->ctl_mode & (SERIAL_CTL_RTS_ON_TX
+                                  | SERIAL_CTL_DSR_HIGH_TX
+                                  | SERIAL_CTL_CTS_HIGH_TX);
+   if (c->ctl_mode & SERIAL_CTL_RTS_ON_TX)
+      dcb.fRtsControl = RTS_CONTROL_TOGGLE;
+   dcb.fOutxDsrFlow = (c->ctl_mode & SERIAL_CTL_DSR_HIGH_TX) != 0;
+   dcb.fOutxCtsFlow = (c->ctl_mode & SERIAL_CTL_CTS_HIGH_TX) != 0;
+   if (!SetCommState (p->handle, &dcb))
+   {
+      printf ("Error! SetCommState\n");
+      return -1;
+   }
+
+   // Reads return immediately with the bytes already received
+   timeouts.ReadIntervalTimeout = MAXDWORD;
+   timeouts.WriteTotalTimeoutConstant = 50;
+   timeouts.WriteTotalTimeoutMultiplier = 10;
+   if (!SetCommTimeouts (p->handle, &timeouts))
+      return -1;
+   return 0;
+}
+
+void serial_port_close (struct serial_port *p)
+{
+   if (p->handle == INVALID_HANDLE_VALUE)
+      return;
+   CloseHandle (p->handle);
+   p->handle = INVALID_HANDLE_VALUE;
+}
+
+// Bytes in the driver receive queue or -1 when the port has failed
+int serial_port_queued (struct serial_port *p)
+{
+   DWORD errors;
+   COMSTAT stat;
+   if (!ClearCommError (p->handle, &errors, &stat))
+      return -1;
+   return (int) stat.cbInQue;
+}
+
+int serial_port_read (struct serial_port *p, char *buffer, int size)
+{
+   DWORD bytes;
+   int queued = serial_port_queued (p);
+   if (queued <= 0)
+      return queued;
+   if (queued > size)
+      queued = size;
+   if (!ReadFile (p->handle, buffer, queued, NULL, &p->read_ov)
+       && GetLastError () != ERROR_IO_PENDING)
+      return -1;
+   if (!GetOverlappedResult (p->handle, &p->read_ov, &bytes, TRUE))
+      return -1;
+   return (int) bytes;
+}
+
+void serial_port_break (struct serial_port *p, int on)
+{
+   if (on)
+      SetCommBreak (p->handle);
+   else
+      ClearCommBreak (p->handle);
+}
+
+void serial_port_lines (struct serial_port *p, int dtr, int rts)
+{
+   if (dtr >= 0)
+      EscapeCommFunction (p->handle, dtr ? SETDTR : CLRDTR);
+   if (rts >= 0)
+      EscapeCommFunction (p->handle, rts ? SETRTS : CLRRTS);
+}
+
+int serial_port_modem (struct serial_port *p)
+{
+   DWORD status;
+   if (!GetCommModemStatus (p->handle, &status))
+      return -1;
+   return (status & MS_DSR_ON ? SERIAL_MODEM_DSR : 0)
+          | (status & MS_CTS_ON ? SERIAL_MODEM_CTS : 0);
+}
+
+int serial_port_unsent (struct serial_port *p)
+{
+   DWORD errors;
+   COMSTAT stat;
+   if (!ClearCommError (p->handle, &errors, &stat))
+      return 0;
+   return (int) stat.cbOutQue;
+}
+
+#else
+////////////////////////////////////////////////////////////////////////
+// termios
+////////////////////////////////////////////////////////////////////////
+
+static const struct
+{
+   long rate;
+   speed_t speed;
+} serial_speeds[] =
+{
+   {50, B50}, {75, B75}, {110, B110}, {134, B134}, {150, B150},
+   {200, B200}, {300, B300}, {600, B600}, {1200, B1200}, {1800, B1800},
+   {2400, B2400}, {4800, B4800}, {9600, B9600}, {19200, B19200},
+   {38400, B38400},
+#ifdef B57600
+   {57600, B57600},
+#endif
+#ifdef B115200
+   {115200, B115200},
+#endif
+#ifdef B230400
+   {230400, B230400},
+#endif
+#ifdef B460800
+   {460800, B460800},
+#endif
+#ifdef B500000
+   {500000, B500000},
+#endif
+#ifdef B576000
+   {576000, B576000},
+#endif
+#ifdef B921600
+   {921600, B921600},
+#endif
+#ifdef B1000000
+   {1000000, B1000000},
+#endif
+#ifdef B2000000
+   {2000000, B2000000},
+#endif
+#ifdef B3000000
+   {3000000, B3000000},
+#endif
+};
+
+// Closest standard speed. exact is set when rate is a standard speed.
+static speed_t serial_speed (long rate, int *exact)
+{
+   unsigned int i, best = 0;
+   for (i = 1; i < sizeof (serial_speeds) / sizeof (serial_speeds[0]); i++)
+   {
+      if (labs (serial_speeds[i].rate - rate)
+          < labs (serial_speeds[best].rate - rate))
+         best = i;
+   }
+   *exact = serial_speeds[best].rate == rate;
+   return serial_speeds[best].speed;
+}
+
+#if defined(__linux__) && defined(TCGETS2) \
+    && (defined(__x86_64__) || defined(__i386__) || defined(__arm__) \
+        || defined(__aarch64__) || defined(__riscv))
+// Layout of asm-generic/termbits.h, which can not be included together
+// with termios.h
+struct termios2
+{
+   tcflag_t c_iflag;
+   tcflag_t c_oflag;
+   tcflag_t c_cflag;
+   tcflag_t c_lflag;
+   cc_t c_line;
+   cc_t c_cc[19];
+   speed_t c_ispeed;
+   speed_t c_ospeed;
+};
+#define SERIAL_BOTHER 0010000
+
+// Set any rate the driver can divide to. Returns 0 on success.
+static int serial_custom_speed (struct serial_port *p, long rate)
+{
+   struct termios2 tio;
+   if (ioctl (p->fd, TCGETS2, &tio) != 0)
+      return -1;
+   tio.c_cflag &= ~CBAUD;
+#ifdef CIBAUD
+   tio.c_cflag &= ~CIBAUD;
+#endif
+   tio.c_cflag |= SERIAL_BOTHER;
+   tio.c_ispeed = rate;
+   tio.c_ospeed = rate;
+   return ioctl (p->fd, TCSETS2, &tio);
+}
+#else
+static int serial_custom_speed (struct serial_port *p, long rate)
+{
+   return -1;
+}
+#endif
+
+void serial_port_init (struct serial_port *p)
+{
+   memset (p, 0, sizeof (*p));
+   p->fd = -1;
+}
+
+int serial_port_open (struct serial_port *p, const char *name,
+                      const struct serial_config *c)
+{
+   p->fd = open (name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+   if (p->fd < 0)
+      return -1;
+   if (serial_port_configure (p, c) != 0)
+   {
+      serial_port_close (p);
+      return -1;
+   }
+   return 0;
+}
+
+int serial_port_is_open (struct serial_port *p)
+{
+   return p->fd >= 0;
+}
+
+// Set or clear modem control line
+static void serial_port_line (struct serial_port *p, int line, int on)
+{
+   ioctl (p->fd, on ? TIOCMBIS : TIOCMBIC, &line);
+}
+
+// Let the driver switch rts for transmit, or stop it when ctl_mode has
+// no rts transmit bit. The setting stays in the driver over reopen.
+// Returns 0 when supported.
+static int serial_rs485 (struct serial_port *p, int ctl_mode)
+{
+#if defined(TIOCSRS485) && defined(SER_RS485_ENABLED)
+   struct serial_rs485 rs485;
+   memset (&rs485, 0, sizeof (rs485));
+   if (ctl_mode & SERIAL_CTL_RTS_ON_TX)
+      rs485.flags = SER_RS485_ENABLED | SER_RS485_RTS_ON_SEND;
+   else if (ctl_mode & SERIAL_CTL_RTS_OFF_TX)
+      rs485.flags = SER_RS485_ENABLED | SER_RS485_RTS_AFTER_SEND;
+   return ioctl (p->fd, TIOCSRS485, &rs485);
+#else
+   return -1;
+#endif
+}
+
+int serial_port_configure (struct serial_port *p,
+                           const struct serial_config *c)
+{
+   struct termios tio;
+   speed_t speed;
+   int exact;
+   if (tcgetattr (p->fd, &tio) != 0)
+      return -1;
+   cfmakeraw (&tio);
+   tio.c_cflag |= CLOCAL | CREAD;
+   tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB);
+   switch (c->data_bits)
+   {
+   case 5:
+      tio.c_cflag |= CS5;
+      break;
+   case 6:
+      tio.c_cflag |= CS6;
+      break;
+   case 7:
+      tio.c_cflag |= CS7;
+      break;
+   default:
+      tio.c_cflag |= CS8;
+      break;
+   }
+   if (c->parity == 1)
+      tio.c_cflag |= PARENB | PARODD;
+   else if (c->parity == 2)
+      tio.c_cflag |= PARENB;
+   if (c->stop_bits != 0)
+      tio.c_cflag |= CSTOPB;
+#ifdef CRTSCTS
+   if (c->rts_control == 2)
+      tio.c_cflag |= CRTSCTS;
+   else
+      tio.c_cflag &= ~CRTSCTS;
+#endif
+   tio.c_cc[VMIN] = 0;
+   tio.c_cc[VTIME] = 0;
+   speed = serial_speed (c->baud_rate, &exact);
+   cfsetispeed (&tio, speed);
+   cfsetospeed (&tio, speed);
+   if (tcsetattr (p->fd, TCSANOW, &tio) != 0)
+      return -1;
+   // Otherwise closest standard speed
+   if (!exact && serial_custom_speed (p, c->baud_rate) != 0)
+      printf ("Serial rate %ld not supported. Using closest.\n",
+              c->baud_rate);
+
+   // Not supported (ENOTTY) by most ports
+   p->native_ctl = 0;
+   if (serial_rs485 (p, c->ctl_mode) == 0)
+      p->native_ctl = c->ctl_mode & (SERIAL_CTL_RTS_ON_TX
+                                     | SERIAL_CTL_RTS_OFF_TX);
+
+   // Not supported by pseudo terminals
+   serial_port_line (p, TIOCM_DTR, c->dtr_control != 0);
+   if (c->rts_control != 2 && p->native_ctl == 0)
+      serial_port_line (p, TIOCM_RTS, c->rts_control != 0);
+   return 0;
+}
+
+void serial_port_close (struct serial_port *p)
+{
+   if (p->fd < 0)
+      return;
+   close (p->fd);
+   p->fd = -1;
+}
+
+int serial_port_read (struct serial_port *p, char *buffer, int size)
+{
+   // With VMIN=0 reads return 0 when nothing is received. Hangup is
+   // reported by the engine.
+   int bytes = read (p->fd, buffer, size);
+   if (bytes >= 0)
+      return bytes;
+   if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return 0;
+   return -1;
+}
+
+int serial_port_write (struct serial_port *p, const char *data, int length)
+{
+   int bytes = write (p->fd, data, length);
+   if (bytes >= 0)
+      return bytes;
+   if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return 0;
+   return -1;
+}
+
+void serial_port_break (struct serial_port *p, int on)
+{
+   ioctl (p->fd, on ? TIOCSBRK : TIOCCBRK);
+}
+
+void serial_port_lines (struct serial_port *p, int dtr, int rts)
+{
+   if (dtr >= 0)
+      serial_port_line (p, TIOCM_DTR, dtr);
+   if (rts >= 0)
+      serial_port_line (p, TIOCM_RTS, rts);
+}
+
+int serial_port_modem (struct serial_port *p)
+{
+   int status;
+   if (ioctl (p->fd, TIOCMGET, &status) != 0)
+      return -1;
+   return (status & TIOCM_DSR ? SERIAL_MODEM_DSR : 0)
+          | (status & TIOCM_CTS ? SERIAL_MODEM_CTS : 0);
+}
+
+int serial_port_unsent (struct serial_port *p)
+{
+   int unsent = 0;
+   if (ioctl (p->fd, TIOCOUTQ, &unsent) != 0)
+      return 0;
+#ifdef TIOCSERGETLSR
+   // Last character may still be in the transmitter
+   if (unsent == 0)
+   {
+      unsigned int lsr;
+      if (ioctl (p->fd, TIOCSERGETLSR, &lsr) == 0 && !(lsr & TIOCSER_TEMT))
+         unsent = 1;
+   }
+#endif
+   return unsent;
+}
+#endif
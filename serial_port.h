@@ -0,0 +1,134 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Serial port backend.
+ * Overlapped Win32 communications API on windows, termios and poll on
+ * POSIX systems.
+ *
+ * Waiting for received data is done by the serial engine
+ * (serial_engine.h), which then drains the port with serial_port_read.
+ * Writes are started by the engine too. Other threads may configure
+ * the port. Opening and closing is done by the engine thread.
+ *
+ * Changelog: (date,who,description)
+ */
+#ifndef SERIAL_PORT_H
+#define SERIAL_PORT_H
+
+#include "io_platform.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+// ctl_mode bits: control lines during transmit and flow control
+#define SERIAL_CTL_DTR_ON_TX 1
+#define SERIAL_CTL_DTR_OFF_TX 2
+#define SERIAL_CTL_RTS_ON_TX 4
+#define SERIAL_CTL_RTS_OFF_TX 8
+#define SERIAL_CTL_DSR_LOW_TX 16
+#define SERIAL_CTL_DSR_HIGH_TX 32
+#define SERIAL_CTL_CTS_LOW_TX 64
+#define SERIAL_CTL_CTS_HIGH_TX 128
+
+// Modem status bits
+#define SERIAL_MODEM_DSR 1
+#define SERIAL_MODEM_CTS 2
+
+// Line settings
+struct serial_config
+{
+   long baud_rate;
+   int data_bits;               // 5 - 8
+   int parity;                  // 0=none 1=odd 2=even
+   int stop_bits;               // 0=1 1=1.5 2=2 stop bits
+   int dtr_control;             // 0=off 1=on
+   int rts_control;             // 0=off 1=on 2=handshake 3=toggle
+   int ctl_mode;                // SERIAL_CTL_ bits
+};
+
+struct serial_port
+{
+#ifdef _WIN32
+   HANDLE handle;
+   OVERLAPPED read_ov;          // Completed without completion port packet
+#else
+   int fd;
+#endif
+   int native_ctl;              // ctl_mode bits done by the driver
+};
+
+// Initialize once before first use.
+void serial_port_init (struct serial_port *p);
+
+// Open port by name (COM3, /dev/ttyUSB0) and apply config.
+// Returns 0 on success, -1 on error.
+int serial_port_open (struct serial_port *p, const char *name,
+                      const struct serial_config *c);
+
+int serial_port_is_open (struct serial_port *p);
+
+// Apply line settings to open port. ctl_mode bits that the driver can
+// do are set in native_ctl, the rest is left to the caller.
+int serial_port_configure (struct serial_port *p,
+                           const struct serial_config *c);
+
+// Close port. On windows a WaitCommEvent of the engine must not be
+// pending.
+void serial_port_close (struct serial_port *p);
+
+#ifdef _WIN32
+// Bytes in the driver receive queue or -1 when the port has failed.
+int serial_port_queued (struct serial_port *p);
+#endif
+
+// Read available data without waiting.
+// Returns bytes read, 0 when nothing was available, -1 on error.
+int serial_port_read (struct serial_port *p, char *buffer, int size);
+
+#ifndef _WIN32
+// Write without waiting. Returns bytes written, 0 when the driver
+// buffer is full, -1 on error. Windows writes are started by the engine.
+int serial_port_write (struct serial_port *p, const char *data, int length);
+#endif
+
+// Set or clear line break state.
+void serial_port_break (struct serial_port *p, int on);
+
+// Set dtr and rts lines: 1=on 0=off -1=unchanged.
+void serial_port_lines (struct serial_port *p, int dtr, int rts);
+
+// SERIAL_MODEM_ bits or -1 when not available.
+int serial_port_modem (struct serial_port *p);
+
+// Bytes written but not yet sent by the driver.
+int serial_port_unsent (struct serial_port *p);
+
+#endif
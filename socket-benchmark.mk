@@ -0,0 +1,32 @@
+include RMCIOS-build-scripts/utilities.mk
+
+# Loopback benchmarks for socket channels.
+# Built for the host against stub RMCIOS context. Runs on linux.
+BENCH_SOURCES:=benchmark${/}stub_context.c socket_channels.c socket_reactor.c \
+               framing.c io_stats.c io_ring.c
+BENCH_CFLAGS:=-O2 -Ibenchmark${/}stub -Ibenchmark -I. -DSOCK_COUNT_COPIES
+BENCH_LIBS:=-lpthread
+CC?=gcc
+export
+
+compile: benchmark${/}udp_bench benchmark${/}send_bench benchmark${/}rtt_bench \
+         benchmark${/}dispatch_bench benchmark${/}loopback_bench
+
+benchmark${/}udp_bench: benchmark${/}udp_bench.c ${BENCH_SOURCES}
+	${CC} ${BENCH_CFLAGS} -o $@ $^ ${BENCH_LIBS}
+
+benchmark${/}send_bench: benchmark${/}send_bench.c ${BENCH_SOURCES}
+	${CC} ${BENCH_CFLAGS} -o $@ $^ ${BENCH_LIBS}
+
+benchmark${/}rtt_bench: benchmark${/}rtt_bench.c ${BENCH_SOURCES}
+	${CC} ${BENCH_CFLAGS} -o $@ $^ ${BENCH_LIBS}
+
+benchmark${/}dispatch_bench: benchmark${/}dispatch_bench.c ${BENCH_SOURCES}
+	${CC} ${BENCH_CFLAGS} -o $@ $^ ${BENCH_LIBS}
+
+benchmark${/}loopback_bench: benchmark${/}loopback_bench.c ${BENCH_SOURCES}
+	${CC} ${BENCH_CFLAGS} -o $@ $^ ${BENCH_LIBS}
+
+# Throughput and latency suite for checking releases
+run: benchmark${/}loopback_bench
+	benchmark${/}loopback_bench
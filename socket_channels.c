@@ -33,32 +33,776 @@ along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
  *
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "RMCIOS-functions.h"
+#include "socket_reactor.h"
+#include "framing.h"
+#include "io_stats.h"
+#include "io_ring.h"
 
-#include <io.h>
-#include <winsock2.h>
-#include <windows.h>
+#ifdef _WIN32
 #pragma comment(lib,"ws2_32.lib")       //Winsock Library
+#endif
 
 const struct context_rmcios *module_context;
 
+/***********************************************************************
+ * Write parameter gathering
+ **********************************************************************/
+
+#define GATHER_INLINE_BUFS 8
+
+// Write parameters as scatter/gather send buffers. Buffer parameters
+// are sent straight from the caller's memory, other parameter types
+// are converted into one heap allocated scratch area.
+struct param_gather
+{
+   int count;
+   int length;
+   sock_buf *bufs;
+   sock_buf inline_bufs[GATHER_INLINE_BUFS];
+   char *scratch;
+};
+
+static int param_gather (struct param_gather *g,
+                         const struct context_rmcios *context,
+                         enum type_rmcios paramtype,
+                         const union param_rmcios param,
+                         int first, int num_params)
+{
+   int i;
+   int scratch_len = 0;
+   char *scratch;
+
+   g->count = 0;
+   g->length = 0;
+   g->scratch = NULL;
+   g->bufs = g->inline_bufs;
+   if (num_params <= first)
+      return 0;
+   if (num_params - first > GATHER_INLINE_BUFS)
+   {
+      g->bufs = (sock_buf *) malloc (sizeof (sock_buf) * 
+                                     (num_params - first));
+      if (g->bufs == NULL)
+         return -1;
+   }
+
+   if (paramtype == buffer_rmcios)
+   {
+      for (i = first; i < num_params; i++)
+      {
+         SOCK_BUF_SET (g->bufs[g->count], param.bv[i].data, 
+                       param.bv[i].length);
+         g->length += param.bv[i].length;
+         g->count++;
+      }
+      return 0;
+   }
+
+   // Determine the needed buffer size
+   for (i = first; i < num_params; i++)
+      scratch_len += param_buffer_alloc_size (context, paramtype, param, i);
+   g->scratch = (char *) malloc (scratch_len > 0 ? scratch_len : 1);
+   if (g->scratch == NULL)
+      return -1;
+
+   scratch = g->scratch;
+   for (i = first; i < num_params; i++)
+   {
+      int plen = param_buffer_alloc_size (context, paramtype, param, i);
+      // structure pointer to buffer data
+      struct buffer_rmcios pbuffer;
+      pbuffer = param_to_buffer (context, paramtype, param, i, plen, scratch);
+      SOCK_BUF_SET (g->bufs[g->count], pbuffer.data, pbuffer.length);
+      g->length += pbuffer.length;
+      g->count++;
+      scratch += plen;
+      SOCK_COUNT_COPY (pbuffer.length);
+   }
+   return 0;
+}
+
+static void param_gather_free (struct param_gather *g)
+{
+   if (g->bufs != g->inline_bufs)
+      free (g->bufs);
+   free (g->scratch);
+}
+
+/***********************************************************************
+ * Outbound queue configuration and counters
+ **********************************************************************/
+
+static void queue_configure (struct sock_io *io, long high_water, int policy)
+{
+   io_mutex_lock (&io->outq.lock);
+   io->outq.high_water = high_water;
+   io->outq.policy = policy;
+   io_mutex_unlock (&io->outq.lock);
+   // Release writers blocked on the old limit
+   io_event_set (&io->outq.space);
+}
+
+// Add depth_msgs depth_bytes dropped_msgs dropped_bytes of io to counters
+static void queue_counters_add (struct sock_io *io, long long counters[4])
+{
+   io_mutex_lock (&io->outq.lock);
+   counters[0] += io->outq.depth_msgs;
+   counters[1] += io->outq.depth_bytes;
+   counters[2] += io->outq.dropped_msgs;
+   counters[3] += io->outq.dropped_bytes;
+   io_mutex_unlock (&io->outq.lock);
+}
+
+static void return_queue_counters (const struct context_rmcios *context,
+                                   struct combo_rmcios *returnv,
+                                   long long counters[4])
+{
+   char text[100];
+   snprintf (text, sizeof (text), "%lld %lld %lld %lld", 
+             counters[0], counters[1], counters[2], counters[3]);
+   return_string (context, returnv, text);
+}
+
+#define QUEUE_HELP \
+   "setup newname_queue high_water | policy\r\n" \
+   "  # Queue writes and send them from the I/O thread.\r\n" \
+   "  # high_water: queue limit in bytes. 0=no limit (default):\r\n" \
+   "  #  writes are sent directly, what the socket does not take\r\n" \
+   "  #  is queued. Writers are never blocked.\r\n" \
+   "  # policy when limit is reached:\r\n" \
+   "  #  0=block writer (default) 1=drop oldest 2=drop newest\r\n" \
+   "read newname_queue\r\n" \
+   "  # queued_messages queued_bytes dropped_messages dropped_bytes\r\n"
+
+/***********************************************************************
+ * Receive framing configuration and counters
+ **********************************************************************/
+
+static void frame_configure (const struct context_rmcios *context,
+                             struct frame_config *config,
+                             enum type_rmcios paramtype,
+                             const union param_rmcios param, int num_params)
+{
+   char mode[16];
+   char arg[32];
+   int m;
+   param_to_string (context, paramtype, param, 0, sizeof (mode), mode);
+   m = frame_mode_from_name (mode);
+   // Sockets have no idle line to end gap frames
+   if (m < 0 || m == FRAME_GAP)
+   {
+      printf ("Unknown framing mode: %s\n", mode);
+      return;
+   }
+   if (num_params > 1)
+      param_to_string (context, paramtype, param, 1, sizeof (arg), arg);
+   if (frame_config_set (config, m, num_params > 1 ? arg : NULL,
+                         num_params > 2 ?
+                         param_to_integer (context, paramtype, param, 2) :
+                         0) != 0)
+      printf ("Invalid framing parameter for mode %s\n", mode);
+}
+
+// Add frames dropped_bytes errors of framer to counters
+static void frame_counters_add (struct framer *f, long long counters[3])
+{
+   counters[0] += f->frames;
+   counters[1] += f->dropped_bytes;
+   counters[2] += f->errors;
+}
+
+static void return_frame_counters (const struct context_rmcios *context,
+                                   struct combo_rmcios *returnv,
+                                   long long counters[3])
+{
+   char text[80];
+   snprintf (text, sizeof (text), "%lld %lld %lld", 
+             counters[0], counters[1], counters[2]);
+   return_string (context, returnv, text);
+}
+
+/***********************************************************************
+ * Receive buffer sizes
+ **********************************************************************/
+
+#define RECV_SIZE_DEFAULT 1500
+#define RECV_SIZE_MAX 65536
+
+struct recv_buffers
+{
+   int recv_size;               // User space receive buffer
+   int rcvbuf;                  // Kernel SO_RCVBUF. 0 = system default
+   int sndbuf;                  // Kernel SO_SNDBUF. 0 = system default
+   long long truncated;         // Datagrams that did not fit recv_size
+};
+
+static void buffers_init (struct recv_buffers *b)
+{
+   b->recv_size = RECV_SIZE_DEFAULT;
+   b->rcvbuf = 0;
+   b->sndbuf = 0;
+   b->truncated = 0;
+}
+
+static void buffers_configure (const struct context_rmcios *context,
+                               struct recv_buffers *b,
+                               enum type_rmcios paramtype,
+                               const union param_rmcios param, 
+                               int num_params)
+{
+   int size = param_to_integer (context, paramtype, param, 0);
+   if (size < 1)
+      size = RECV_SIZE_DEFAULT;
+   if (size > RECV_SIZE_MAX)
+      size = RECV_SIZE_MAX;
+   b->recv_size = size;
+   if (num_params > 1)
+      b->rcvbuf = param_to_integer (context, paramtype, param, 1);
+   if (num_params > 2)
+      b->sndbuf = param_to_integer (context, paramtype, param, 2);
+}
+
+static void buffers_apply (struct recv_buffers *b, SOCKET s)
+{
+   if (s != INVALID_SOCKET)
+      sock_set_buffers (s, b->rcvbuf, b->sndbuf);
+}
+
+// Return recv_size, effective kernel buffer sizes of s and truncations
+static void return_buffers (const struct context_rmcios *context,
+                            struct combo_rmcios *returnv,
+                            struct recv_buffers *b, SOCKET s)
+{
+   char text[100];
+   int rcvbuf = b->rcvbuf;
+   int sndbuf = b->sndbuf;
+   if (s != INVALID_SOCKET)
+   {
+      socklen_t len = sizeof (rcvbuf);
+      getsockopt (s, SOL_SOCKET, SO_RCVBUF, (char *) &rcvbuf, &len);
+      len = sizeof (sndbuf);
+      getsockopt (s, SOL_SOCKET, SO_SNDBUF, (char *) &sndbuf, &len);
+   }
+   snprintf (text, sizeof (text), "%d %d %d %lld", 
+             b->recv_size, rcvbuf, sndbuf, b->truncated);
+   return_string (context, returnv, text);
+}
+
+#define BUFFER_HELP \
+   "setup newname_buffer recv_bytes | so_rcvbuf | so_sndbuf\r\n" \
+   "  # recv_bytes: bytes received per read, max 65536 (1500)\r\n" \
+   "  # so_rcvbuf so_sndbuf: kernel buffer sizes. 0=system default\r\n" \
+   "read newname_buffer\r\n" \
+   "  # recv_bytes so_rcvbuf so_sndbuf truncated_datagrams\r\n"
+
+/***********************************************************************
+ * Latency options of tcp connections
+ **********************************************************************/
+
+struct send_options
+{
+   int nodelay;                 // TCP_NODELAY
+   int coalesce_us;             // Write coalescing window. 0 = off
+   long coalesce_bytes;         // Send before window when this is queued
+
+   // Send rate limit. 0 = unlimited
+   long bytes_per_s;
+   long msgs_per_s;
+   long burst_bytes;
+   long burst_msgs;
+};
+
+static void send_options_init (struct send_options *o)
+{
+   o->nodelay = 0;
+   o->coalesce_us = 0;
+   o->coalesce_bytes = 0;
+   o->bytes_per_s = 0;
+   o->msgs_per_s = 0;
+   o->burst_bytes = 0;
+   o->burst_msgs = 0;
+}
+
+static void send_options_configure (const struct context_rmcios *context,
+                                    struct send_options *o,
+                                    enum type_rmcios paramtype,
+                                    const union param_rmcios param, 
+                                    int num_params)
+{
+   o->nodelay = param_to_integer (context, paramtype, param, 0);
+   if (num_params > 1)
+      o->coalesce_us = param_to_integer (context, paramtype, param, 1);
+   if (num_params > 2)
+      o->coalesce_bytes = param_to_integer (context, paramtype, param, 2);
+}
+
+static void send_options_apply (struct send_options *o, struct sock_io *io,
+                                struct io_stats *stats)
+{
+   if (io->s != INVALID_SOCKET)
+      sock_set_nodelay (io->s, o->nodelay);
+   sock_io_coalesce (io, o->coalesce_us, o->coalesce_bytes);
+   sock_io_shape (io, o->bytes_per_s, o->msgs_per_s, o->burst_bytes,
+                  o->burst_msgs, &stats->hold);
+}
+
+// Writes are sent by the reactor thread from the outbound queue
+static int send_options_queued (struct send_options *o)
+{
+   return o->coalesce_us > 0 || o->bytes_per_s > 0 || o->msgs_per_s > 0;
+}
+
+static void return_send_options (const struct context_rmcios *context,
+                                 struct combo_rmcios *returnv,
+                                 struct send_options *o)
+{
+   char text[80];
+   snprintf (text, sizeof (text), "%d %d %ld", 
+             o->nodelay, o->coalesce_us, o->coalesce_bytes);
+   return_string (context, returnv, text);
+}
+
+#define SEND_HELP \
+   "setup newname_send nodelay | coalesce_us | coalesce_bytes\r\n" \
+   "  # nodelay: 1=send small writes immediately (TCP_NODELAY)\r\n" \
+   "  # coalesce_us: collect writes for this long and send them\r\n" \
+   "  #   with one call. Writes go through the queue. 0=off\r\n" \
+   "  # coalesce_bytes: send earlier when this much is collected\r\n" \
+   "read newname_send\r\n" \
+   "  # nodelay coalesce_us coalesce_bytes\r\n"
+
+/***********************************************************************
+ * Send rate limit of tcp connections
+ **********************************************************************/
+
+static void rate_options_configure (const struct context_rmcios *context,
+                                    struct send_options *o,
+                                    enum type_rmcios paramtype,
+                                    const union param_rmcios param, 
+                                    int num_params)
+{
+   o->bytes_per_s = param_to_integer (context, paramtype, param, 0);
+   o->msgs_per_s = 0;
+   o->burst_bytes = 0;
+   o->burst_msgs = 0;
+   if (num_params > 1)
+      o->msgs_per_s = param_to_integer (context, paramtype, param, 1);
+   if (num_params > 2)
+      o->burst_bytes = param_to_integer (context, paramtype, param, 2);
+   if (num_params > 3)
+      o->burst_msgs = param_to_integer (context, paramtype, param, 3);
+}
+
+static void return_rate_options (const struct context_rmcios *context,
+                                 struct combo_rmcios *returnv,
+                                 struct send_options *o)
+{
+   char text[100];
+   snprintf (text, sizeof (text), "%ld %ld %ld %ld", 
+             o->bytes_per_s, o->msgs_per_s, o->burst_bytes, o->burst_msgs);
+   return_string (context, returnv, text);
+}
+
+#define RATE_HELP \
+   "setup newname_rate bytes_per_s | msgs_per_s | burst_bytes" \
+   " | burst_msgs\r\n" \
+   "  # Limit send rate with token buckets. 0=unlimited (default)\r\n" \
+   "  # Writes are queued and the I/O thread sends them when the\r\n" \
+   "  #   limit allows. The writer is not delayed.\r\n" \
+   "  # burst_bytes burst_msgs: sent at once after idle time (0)\r\n" \
+   "  # Held times are in read newname_stats.\r\n" \
+   "read newname_rate\r\n" \
+   "  # bytes_per_s msgs_per_s burst_bytes burst_msgs\r\n"
+
+/***********************************************************************
+ * Channel statistics
+ **********************************************************************/
+
+// Length after appending to text of size. Output may be truncated.
+static int stats_length (int length, int added, int size)
+{
+   if (added > 0)
+      length += added;
+   return length < size ? length : size - 1;
+}
+
+// Counters, queue depth of queue_counters and latency histograms
+static void return_stats (const struct context_rmcios *context,
+                          struct combo_rmcios *returnv, struct io_stats *s,
+                          long long queue_counters[4])
+{
+   // 8 counters and 3 histograms of 5 times and a count
+   char text[8 * 21 + 3 * (5 * 24 + 21)];
+   int length;
+   length = snprintf (text, sizeof (text), 
+                      "%llu %llu %llu %llu %llu %llu %lld %lld ",
+                      (unsigned long long) s->bytes_in,
+                      (unsigned long long) s->packets_in,
+                      (unsigned long long) s->bytes_out,
+                      (unsigned long long) s->packets_out,
+                      (unsigned long long) s->send_errors,
+                      (unsigned long long) s->drops + queue_counters[2],
+                      queue_counters[0], queue_counters[1]);
+   length = stats_length (0, length, sizeof (text));
+   length = stats_length (length,
+                          io_histogram_format (&s->dispatch, text + length,
+                                               sizeof (text) - length),
+                          sizeof (text));
+   length = stats_length (length,
+                          snprintf (text + length, sizeof (text) - length,
+                                    " "), sizeof (text));
+   length = stats_length (length,
+                          io_histogram_format (&s->processing, text + length,
+                                               sizeof (text) - length),
+                          sizeof (text));
+   length = stats_length (length,
+                          snprintf (text + length, sizeof (text) - length,
+                                    " "), sizeof (text));
+   io_histogram_format (&s->hold, text + length, sizeof (text) - length);
+   return_string (context, returnv, text);
+}
+
+#define STATS_HELP \
+   "read newname_stats\r\n" \
+   "  # bytes_in messages_in bytes_out messages_out send_errors drops\r\n" \
+   "  # queued_messages queued_bytes\r\n" \
+   "  # dispatch: p50 p90 p99 p999 max count\r\n" \
+   "  # processing: p50 p90 p99 p999 max count\r\n" \
+   "  # held: p50 p90 p99 p999 max count\r\n" \
+   "  # dispatch is the time in us from receive to linked channel write\r\n" \
+   "  # processing is the time in us spent in linked channels\r\n" \
+   "  # held is the time in us writes waited for the rate limit\r\n" \
+   "  # drops: dropped queued messages, truncated datagrams and\r\n" \
+   "  #   receive ring overflows\r\n" \
+   "setup newname_stats # Reset\r\n"
+
+/***********************************************************************
+ * Pull-mode receive ring
+ **********************************************************************/
+
+// Keep received data for polling. Data that does not fit is counted
+// as a drop. Runs in reactor thread.
+static void ring_push (struct io_ring *r, struct io_stats *stats,
+                       const char *data, int length)
+{
+   if (io_ring_write (r, data, length) > 0)
+      io_stats_add (&stats->drops, 1);
+}
+
+static void return_ring (const struct context_rmcios *context,
+                         struct combo_rmcios *returnv, struct io_ring *r)
+{
+   const char *parts[2];
+   int lengths[2];
+   int i;
+   io_ring_peek (r, parts, lengths);
+   for (i = 0; i < 2; i++)
+   {
+      if (lengths[i] > 0)
+         return_buffer (context, returnv, parts[i], lengths[i]);
+   }
+}
+
+#define RX_HELP \
+   "setup newname_rx size\r\n" \
+   "  # Keep received data in ring buffer of size bytes. 0=off (default)\r\n" \
+   "  # Data that does not fit is dropped and counted in stats drops.\r\n" \
+   "read newname_rx\r\n" \
+   "  # Data received since the last reset\r\n" \
+   "write newname_rx\r\n" \
+   "  # Reset ring buffer\r\n"
+
+/***********************************************************************
+ * Receive timestamps
+ **********************************************************************/
+
+// Arrival time of the message being delivered. The clock is read once
+// per receive call, so all messages of one read share the timestamp.
+struct rx_timestamp
+{
+   uint64_t arrival_ns;
+   int id;                      // Timestamp subchannel
+   int push;                    // Write timestamp to its linked channels
+};
+
+// Record arrival of message about to be delivered. Runs in reactor
+// thread.
+static void timestamp_set (struct rx_timestamp *t, uint64_t arrival_ns)
+{
+   char text[24];
+   int length;
+   __atomic_store_n (&t->arrival_ns, arrival_ns, __ATOMIC_RELAXED);
+   if (t->push == 0)
+      return;
+   length = snprintf (text, sizeof (text), "%llu",
+                      (unsigned long long) arrival_ns / 1000);
+   write_buffer (module_context, linked_channels (module_context, t->id),
+                 text, length, t->id);
+}
+
+// Timestamp subchannel. Shared by all socket channels.
+void timestamp_subchan_func (struct rx_timestamp *this,
+                             const struct context_rmcios *context, int id,
+                             enum function_rmcios function,
+                             enum type_rmcios paramtype,
+                             struct combo_rmcios *returnv,
+                             int num_params,
+                             const union param_rmcios param)
+{
+   uint64_t arrival_ns;
+   char text[48];
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      arrival_ns = __atomic_load_n (&this->arrival_ns, __ATOMIC_RELAXED);
+      snprintf (text, sizeof (text), "%llu %llu",
+                (unsigned long long) arrival_ns / 1000,
+                (unsigned long long) (io_clock_ns () - arrival_ns) / 1000);
+      return_string (context, returnv, text);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL || num_params < 1)
+         break;
+      this->push = param_to_integer (context, paramtype, param, 0);
+      break;
+   }
+}
+
+static void timestamp_create (struct rx_timestamp *t,
+                              const struct context_rmcios *context, int parent)
+{
+   t->arrival_ns = 0;
+   t->push = 0;
+   t->id = create_subchannel_str (context, parent, "_timestamp",
+                                  (class_rmcios) timestamp_subchan_func, t);
+}
+
+#define TIMESTAMP_HELP \
+   "read newname_timestamp\r\n" \
+   "  # arrival_us age_us\r\n" \
+   "  # arrival_us: monotonic time in microseconds when the message being\r\n" \
+   "  #   delivered, or the last one, was read from the socket.\r\n" \
+   "  #   Performance counter on windows, as fast_clock.\r\n" \
+   "  # age_us: time elapsed since arrival\r\n" \
+   "setup newname_timestamp 1\r\n" \
+   "  # Write arrival_us to channels linked to newname_timestamp\r\n" \
+   "  # before each message. 0=off (default)\r\n"
+
+#define FRAME_HELP \
+   "setup newname_frame mode | arg | max_frame(65536)\r\n" \
+   "  # Deliver only complete frames to linked channels.\r\n" \
+   "  # none            : data as received (default)\r\n" \
+   "  # line delimiter  : delimiter terminated, default \\n.\r\n" \
+   "  #                   Escapes \\r \\n \\t \\0 \\xHH. Delimiter removed.\r\n" \
+   "  # fixed length    : frames of length bytes\r\n" \
+   "  # prefix bytes    : big endian length prefix of 1, 2 or 4 bytes\r\n" \
+   "  # prefixle bytes  : little endian length prefix\r\n" \
+   "  # slip            : RFC 1055 SLIP frames, decoded\r\n" \
+   "  # cobs            : zero terminated COBS frames, decoded\r\n" \
+   "  # Longer frames than max_frame are dropped.\r\n" \
+   "read newname_frame\r\n" \
+   "  # frames dropped_bytes errors\r\n"
+
+/***********************************************************************
+ * Tcp server channel
+ **********************************************************************/
+
+struct tcpserver_data;
+
+// One accepted client connection
+struct tcpserver_connection
+{
+   struct sock_io io;
+   struct tcpserver_data *server;
+   int slot;
+   int active;
+   int senders;                 // Writers holding the slot. Blocks reuse.
+   struct sockaddr_in peer;
+   struct framer framer;
+   uint64_t received;           // Time of latest receive
+   struct io_ring rx;           // Pull-mode receive ring
+};
+
 // tcpserver channel data
 struct tcpserver_data
 {
    int port;
    int id;
    int linked_channels;
-   DWORD threadID;
-   SOCKET connection;
+   struct sock_io listener;
+   int listening;
+   
+   // Connection slots. Slots are reused, never freed.
+   io_mutex lock;
+   struct tcpserver_connection **connections;
+   int num_slots;
+   int slots_allocated;         // Capacity of connections
+   int num_active;
+   
+   // Slot of the client whose data is being delivered
+   int current_slot;
+   
+   // Outbound queue settings for connections
+   long queue_high_water;
+   int queue_policy;
+
+   // Receive framing of connections
+   struct frame_config frame;
+   struct recv_buffers buffers;
+   struct send_options send;
+   struct io_stats stats;
+   struct rx_timestamp timestamp;
+   int rx_size;                 // Receive ring size of connections
 };
 
-// Server main thread
-DWORD WINAPI tcpserver_thread (LPVOID lpvParam)
+static void tcpserver_close_connection (struct tcpserver_connection *c)
+{
+   struct tcpserver_data *this = c->server;
+   io_mutex_lock (&this->lock);
+   sock_reactor_close (&c->io);
+   c->active = 0;
+   this->num_active--;
+   io_mutex_unlock (&this->lock);
+}
+
+// Deliver received frame to linked channels
+static void tcpserver_emit (void *arg, char *data, int length)
+{
+   struct tcpserver_connection *c = (struct tcpserver_connection *) arg;
+   struct tcpserver_data *this = c->server;
+   uint64_t begin = io_stats_dispatch_begin (&this->stats, c->received);
+   this->current_slot = c->slot;
+   timestamp_set (&this->timestamp, c->received);
+   ring_push (&c->rx, &this->stats, data, length);
+   write_buffer (module_context,
+                 linked_channels (module_context, this->id),
+                 data, length, this->id);
+   io_stats_dispatch_end (&this->stats, begin);
+}
+
+// Receive handler for client connections. Runs in reactor thread.
+static void tcpserver_connection_handler (struct sock_io *io, int events)
+{
+   struct tcpserver_connection *c = (struct tcpserver_connection *) io;
+   char buffer[RECV_SIZE_MAX];
+   int size = c->server->buffers.recv_size;
+   int reads;
+
+   for (reads = 0; reads < 16; reads++)
+   {
+      int bytes = recv (io->s, buffer, size, 0);
+      if (bytes == 0 || (bytes < 0 && !sock_would_block ()))
+      {
+         tcpserver_close_connection (c);
+         return;
+      }
+      if (bytes < 0)
+         break;
+      c->received = io_clock_ns ();
+      io_stats_received (&c->server->stats, bytes);
+      framer_push (&c->framer, buffer, bytes);
+   }
+   sock_reactor_rearm (io);
+}
+
+// Find free connection slot or grow the slot table. Called with lock held.
+static struct tcpserver_connection *tcpserver_get_slot (struct
+                                                        tcpserver_data *this)
+{
+   struct tcpserver_connection **connections;
+   int i;
+   for (i = 0; i < this->num_slots; i++)
+   {
+      if (this->connections[i]->active == 0
+          && __atomic_load_n (&this->connections[i]->senders,
+                              __ATOMIC_ACQUIRE) == 0
+          && !sock_io_busy (&this->connections[i]->io))
+         return this->connections[i];
+   }
+   
+   if (this->num_slots >= this->slots_allocated)
+   {
+      // Doubled, so that a burst of new clients is not copied each time
+      int allocate = this->slots_allocated > 0 ?
+                     this->slots_allocated * 2 : 16;
+      connections = (struct tcpserver_connection **)
+                    realloc (this->connections, 
+                             sizeof (*connections) * allocate);
+      if (connections == NULL)
+         return NULL;
+      this->connections = connections;
+      this->slots_allocated = allocate;
+   }
+   connections = this->connections;
+   connections[i] = (struct tcpserver_connection *)
+                    calloc (1, sizeof (struct tcpserver_connection));
+   if (connections[i] == NULL)
+      return NULL;
+   sock_io_init (&connections[i]->io);
+   framer_init (&connections[i]->framer, &this->frame, tcpserver_emit,
+                connections[i]);
+   io_ring_init (&connections[i]->rx);
+   connections[i]->server = this;
+   connections[i]->slot = i;
+   this->num_slots++;
+   return connections[i];
+}
+
+// Accept handler for the listening socket. Runs in reactor thread.
+static void tcpserver_accept_handler (struct sock_io *io, int events)
 {
-   struct tcpserver_data *this = (struct tcpserver_data *) lpvParam;
+   struct tcpserver_data *this = (struct tcpserver_data *) io->owner;
+   SOCKET s;
+   struct sockaddr_in peer;
+
+   while ((s = sock_io_accept (io, &peer)) != INVALID_SOCKET)
+   {
+      struct tcpserver_connection *c;
+      io_mutex_lock (&this->lock);
+      c = tcpserver_get_slot (this);
+      if (c == NULL)
+      {
+         io_mutex_unlock (&this->lock);
+         closesocket (s);
+         continue;
+      }
+      c->io.s = s;
+      // Connections of a server are handled by one reactor thread
+      sock_io_share_loop (&c->io, io);
+      buffers_apply (&this->buffers, s);
+      c->io.handler = tcpserver_connection_handler;
+      c->io.owner = this;
+      queue_configure (&c->io, this->queue_high_water, this->queue_policy);
+      send_options_apply (&this->send, &c->io, &this->stats);
+      c->peer = peer;
+      framer_reset (&c->framer);
+      io_ring_resize (&c->rx, this->rx_size);
+      c->active = 1;
+      this->num_active++;
+      io_mutex_unlock (&this->lock);
+
+      // empty write to signal new connection :
+      this->current_slot = c->slot;
+      write_iv (module_context, 
+                linked_channels (module_context, this->id), 0, NULL) ;
+      
+      if (sock_reactor_add (&c->io) != 0)
+         tcpserver_close_connection (c);
+   }
+   sock_reactor_rearm (io);
+}
 
+static int tcpserver_listen (struct tcpserver_data *this)
+{
    SOCKET s;
    struct sockaddr_in server;
+   int reuse = 1;
 
    ////////////////////////////////////////////////////////////////////
    // Open the socket
@@ -66,62 +810,1488 @@ DWORD WINAPI tcpserver_thread (LPVOID lpvParam)
    if ((s = socket (AF_INET, SOCK_STREAM, 0)) == INVALID_SOCKET)
    {
       printf ("Could not create socket : %d", WSAGetLastError ());
-      return 1;
+      return -1;
    }
+   setsockopt (s, SOL_SOCKET, SO_REUSEADDR, (char *) &reuse, sizeof (reuse));
+   // Accepted connections inherit kernel buffer sizes
+   buffers_apply (&this->buffers, s);
+   
    ///////////////////////////////////////////////////////////////////
    // Bind the socket
    ///////////////////////////////////////////////////////////////////
    
    //Prepare the sockaddr_in structure:
+   memset (&server, 0, sizeof (server));
    server.sin_family = AF_INET;
    server.sin_addr.s_addr = INADDR_ANY;
    server.sin_port = htons (this->port);
    if (bind (s, (struct sockaddr *) &server, sizeof (server)) == SOCKET_ERROR)
    {
-      printf ("Bind failed with error code : %d", WSAGetLastError ());
-      return 1;
+      printf ("Bind failed with error code : %d", WSAGetLastError ());
+      closesocket (s);
+      return -1;
+   }
+
+   ///////////////////////////////////////////////////////////////////
+   // Start litening to incoming connections.
+   ///////////////////////////////////////////////////////////////////
+   if (listen (s, SOMAXCONN) == SOCKET_ERROR)
+   {
+      printf ("Listen failed with error code : %d", WSAGetLastError ());
+      closesocket (s);
+      return -1;
+   }
+
+   this->listener.s = s;
+   this->listener.handler = tcpserver_accept_handler;
+   this->listener.owner = this;
+   this->listener.listening = 1;
+   if (sock_reactor_add (&this->listener) != 0)
+   {
+      closesocket (s);
+      return -1;
+   }
+   this->listening = 1;
+   return 0;
+}
+
+// Active connections of slot, or all when slot < 0. Collected with the
+// lock held, so that sending is done without it. The slots are held
+// until tcpserver_targets_release, so that a slot of a client that
+// closes is not reused for a new client in between. One slot is
+// returned in single.
+static struct tcpserver_connection **tcpserver_targets (struct tcpserver_data
+                                                        *this, int slot,
+                                                        struct
+                                                        tcpserver_connection
+                                                        **single,
+                                                        int *num_targets)
+{
+   struct tcpserver_connection **targets = single;
+   int i;
+   *num_targets = 0;
+   io_mutex_lock (&this->lock);
+   if (slot < 0)
+      targets = (struct tcpserver_connection **) 
+                malloc (sizeof (*targets) * (this->num_slots + 1));
+   for (i = slot < 0 ? 0 : slot; targets != NULL && i < this->num_slots; i++)
+   {
+      if (this->connections[i]->active)
+      {
+         __atomic_add_fetch (&this->connections[i]->senders, 1,
+                             __ATOMIC_RELAXED);
+         targets[(*num_targets)++] = this->connections[i];
+      }
+      if (slot >= 0)
+         break;
+   }
+   io_mutex_unlock (&this->lock);
+   return targets;
+}
+
+static void tcpserver_targets_release (struct tcpserver_connection **targets,
+                                       struct tcpserver_connection **single,
+                                       int num_targets)
+{
+   int i;
+   for (i = 0; i < num_targets; i++)
+      __atomic_sub_fetch (&targets[i]->senders, 1, __ATOMIC_RELEASE);
+   if (targets != single)
+      free (targets);
+}
+
+// Queue data to one client or to all clients when slot < 0
+static int tcpserver_enqueue (struct tcpserver_data *this, int slot,
+                              const sock_buf * bufs, int count)
+{
+   struct sock_chunk *chunk;
+   struct tcpserver_connection **targets, *single[1];
+   int num_targets = 0;
+   int i;
+   int result = 0;
+
+   // Enqueue may block and must not hold the lock
+   targets = tcpserver_targets (this, slot, single, &num_targets);
+   if (targets == NULL)
+      return -1;
+
+   // One copy of the message is shared by all connection queues
+   chunk = sock_chunk_new (bufs, count);
+   for (i = 0; chunk != NULL && i < num_targets; i++)
+   {
+      if (sock_io_enqueue (&targets[i]->io, chunk) != 0)
+         result = -1;
+   }
+   if (chunk != NULL)
+      sock_chunk_release (chunk);
+   else
+      result = -1;
+   tcpserver_targets_release (targets, single, num_targets);
+   return result;
+}
+
+// Send data to one client or to all clients when slot < 0.
+// Clients that do not keep up get the rest queued and never stall the
+// writer or the reactor threads.
+static int tcpserver_send (struct tcpserver_data *this, int slot,
+                           const sock_buf * bufs, int count)
+{
+   struct tcpserver_connection **targets, *single[1];
+   int num_targets = 0;
+   int i;
+   int result = 0;
+   if (this->queue_high_water > 0 || send_options_queued (&this->send))
+      return tcpserver_enqueue (this, slot, bufs, count);
+
+   // Accept and close take the lock in the reactor threads
+   targets = tcpserver_targets (this, slot, single, &num_targets);
+   if (targets == NULL)
+      return -1;
+
+   for (i = 0; i < num_targets; i++)
+   {
+      if (sock_io_send (&targets[i]->io, bufs, count) < 0)
+         result = -1;
+   }
+   tcpserver_targets_release (targets, single, num_targets);
+   return result;
+}
+
+// Shut down one client or all clients when slot < 0
+static void tcpserver_shutdown (struct tcpserver_data *this, int slot)
+{
+   int i;
+   io_mutex_lock (&this->lock);
+   for (i = 0; i < this->num_slots; i++)
+   {
+      if (slot >= 0 && i != slot)
+         continue;
+      if (this->connections[i]->active)
+         shutdown (this->connections[i]->io.s, SD_SEND);
+   }
+   io_mutex_unlock (&this->lock);
+}
+
+static void tcpserver_write_params (struct tcpserver_data *this,
+                                    const struct context_rmcios *context,
+                                    struct combo_rmcios *returnv, int slot,
+                                    enum type_rmcios paramtype,
+                                    const union param_rmcios param, 
+                                    int first, int num_params)
+{
+   struct param_gather g;
+   if (param_gather (&g, context, paramtype, param, first, num_params) == 0)
+   {
+      int result = tcpserver_send (this, slot, g.bufs, g.count);
+      io_stats_sent (&this->stats, g.length, result >= 0);
+      if (result < 0)
+      {
+         return_int (context, returnv, -1);
+      }
+   }
+   param_gather_free (&g);
+}
+
+// Outbound queue subchannel
+void tcpserver_queue_subchan_func (struct tcpserver_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   long long counters[4] = { 0, 0, 0, 0 };
+   int i;
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      io_mutex_lock (&this->lock);
+      for (i = 0; i < this->num_slots; i++)
+         queue_counters_add (&this->connections[i]->io, counters);
+      io_mutex_unlock (&this->lock);
+      return_queue_counters (context, returnv, counters);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      this->queue_high_water = param_to_integer (context, paramtype, 
+                                                 param, 0);
+      if (num_params > 1)
+         this->queue_policy = param_to_integer (context, paramtype, 
+                                                param, 1);
+      io_mutex_lock (&this->lock);
+      for (i = 0; i < this->num_slots; i++)
+         queue_configure (&this->connections[i]->io, 
+                          this->queue_high_water, this->queue_policy);
+      io_mutex_unlock (&this->lock);
+      break;
+   }
+}
+
+// Receive framing subchannel
+void tcpserver_frame_subchan_func (struct tcpserver_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   long long counters[3] = { 0, 0, 0 };
+   int i;
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      io_mutex_lock (&this->lock);
+      for (i = 0; i < this->num_slots; i++)
+         frame_counters_add (&this->connections[i]->framer, counters);
+      io_mutex_unlock (&this->lock);
+      return_frame_counters (context, returnv, counters);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      frame_configure (context, &this->frame, paramtype, param, num_params);
+      break;
+   }
+}
+
+// Receive buffer subchannel
+void tcpserver_buffer_subchan_func (struct tcpserver_data *this,
+                                    const struct context_rmcios *context,
+                                    int id, enum function_rmcios function,
+                                    enum type_rmcios paramtype,
+                                    struct combo_rmcios *returnv,
+                                    int num_params,
+                                    const union param_rmcios param)
+{
+   int i;
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_buffers (context, returnv, &this->buffers, this->listener.s);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      buffers_configure (context, &this->buffers, paramtype, param, 
+                         num_params);
+      buffers_apply (&this->buffers, this->listener.s);
+      io_mutex_lock (&this->lock);
+      for (i = 0; i < this->num_slots; i++)
+      {
+         if (this->connections[i]->active)
+            buffers_apply (&this->buffers, this->connections[i]->io.s);
+      }
+      io_mutex_unlock (&this->lock);
+      break;
+   }
+}
+
+// Latency options subchannel
+void tcpserver_send_subchan_func (struct tcpserver_data *this,
+                                  const struct context_rmcios *context,
+                                  int id, enum function_rmcios function,
+                                  enum type_rmcios paramtype,
+                                  struct combo_rmcios *returnv,
+                                  int num_params,
+                                  const union param_rmcios param)
+{
+   int i;
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_send_options (context, returnv, &this->send);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      send_options_configure (context, &this->send, paramtype, param, 
+                              num_params);
+      io_mutex_lock (&this->lock);
+      for (i = 0; i < this->num_slots; i++)
+      {
+         if (this->connections[i]->active)
+            send_options_apply (&this->send, &this->connections[i]->io,
+                                &this->stats);
+      }
+      io_mutex_unlock (&this->lock);
+      break;
+   }
+}
+
+// Send rate limit subchannel
+void tcpserver_rate_subchan_func (struct tcpserver_data *this,
+                                  const struct context_rmcios *context,
+                                  int id, enum function_rmcios function,
+                                  enum type_rmcios paramtype,
+                                  struct combo_rmcios *returnv,
+                                  int num_params,
+                                  const union param_rmcios param)
+{
+   int i;
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_rate_options (context, returnv, &this->send);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      rate_options_configure (context, &this->send, paramtype, param, 
+                              num_params);
+      io_mutex_lock (&this->lock);
+      for (i = 0; i < this->num_slots; i++)
+      {
+         if (this->connections[i]->active)
+            send_options_apply (&this->send, &this->connections[i]->io,
+                                &this->stats);
+      }
+      io_mutex_unlock (&this->lock);
+      break;
+   }
+}
+
+// Client addressing subchannel
+void tcpserver_client_subchan_func (struct tcpserver_data *this,
+                                    const struct context_rmcios *context,
+                                    int id, enum function_rmcios function,
+                                    enum type_rmcios paramtype,
+                                    struct combo_rmcios *returnv,
+                                    int num_params,
+                                    const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_int (context, returnv, this->current_slot);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      tcpserver_shutdown (this, param_to_integer (context, paramtype, 
+                                                  param, 0));
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 2)
+         break;
+      tcpserver_write_params (this, context, returnv, 
+                              param_to_integer (context, paramtype, param, 0),
+                              paramtype, param, 1, num_params);
+      break;
+   }
+}
+
+// Statistics subchannel
+void tcpserver_stats_subchan_func (struct tcpserver_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   long long counters[4] = { 0, 0, 0, 0 };
+   int i;
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      io_mutex_lock (&this->lock);
+      for (i = 0; i < this->num_slots; i++)
+         queue_counters_add (&this->connections[i]->io, counters);
+      io_mutex_unlock (&this->lock);
+      return_stats (context, returnv, &this->stats, counters);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      io_stats_reset (&this->stats);
+      break;
+   }
+}
+
+// Pull-mode receive subchannel
+void tcpserver_rx_subchan_func (struct tcpserver_data *this,
+                                const struct context_rmcios *context,
+                                int id, enum function_rmcios function,
+                                enum type_rmcios paramtype,
+                                struct combo_rmcios *returnv,
+                                int num_params,
+                                const union param_rmcios param)
+{
+   int slot;
+   int i;
+   switch (function)
+   {
+   case read_rmcios:
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      slot = this->current_slot;
+      if (num_params > 0)
+         slot = param_to_integer (context, paramtype, param, 0);
+      io_mutex_lock (&this->lock);
+      if (slot >= 0 && slot < this->num_slots)
+      {
+         if (function == read_rmcios)
+            return_ring (context, returnv, &this->connections[slot]->rx);
+         else
+            io_ring_reset (&this->connections[slot]->rx);
+      }
+      io_mutex_unlock (&this->lock);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      io_mutex_lock (&this->lock);
+      this->rx_size = param_to_integer (context, paramtype, param, 0);
+      for (i = 0; i < this->num_slots; i++)
+         io_ring_resize (&this->connections[i]->rx, this->rx_size);
+      io_mutex_unlock (&this->lock);
+      break;
+   }
+}
+
+// Tcp server implementation function:
+void tcpserver_class_func (struct tcpserver_data *this,
+                           const struct context_rmcios *context, int id,
+                           enum function_rmcios function,
+                           enum type_rmcios paramtype,
+                           struct combo_rmcios *returnv,
+                           int num_params,
+                           const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv, 
+                     "TCP server channel\n"
+                     "create tcpserver newname\n"
+                     "setup newname port\n"
+                     "  # Start listening. Serves any number of clients.\n"
+                     "setup newname\n"
+                     "  # Close all client connections\n"
+                     "write newname data\n"
+                     "  # Send data to all connected clients\n"
+                     "read newname\n"
+                     "  # Number of connected clients\n"
+                     "link newname channel\n"
+                     "  # Link data received from any client to channel\n"
+                     "  # Empty write to linked signals new connection\n"
+                     "creates subchannel: \n"
+                     "  newname_client for addressing single client\n"
+                     "read newname_client\n"
+                     "  # Slot of the client that sent the data being linked\n"
+                     "write newname_client slot data\n"
+                     "  # Send data to client in slot\n"
+                     "setup newname_client slot\n"
+                     "  # Close connection of client in slot\n"
+                     "  newname_frame for receive framing of clients\n"
+                     FRAME_HELP
+                     "  newname_buffer for buffer sizes\n"
+                     BUFFER_HELP
+                     "  newname_send for latency options\n"
+                     SEND_HELP
+                     "  newname_rate for send rate limit\n"
+                     RATE_HELP
+                     "  newname_stats for statistics\n"
+                     STATS_HELP
+                     "  newname_timestamp for receive time of messages\n"
+                     TIMESTAMP_HELP
+                     "  newname_rx for polling received data of clients\n"
+                     "setup newname_rx size\n"
+                     "  # Keep data of each client in ring buffer of size\n"
+                     "  # bytes. 0=off (default)\n"
+                     "read newname_rx | slot\n"
+                     "  # Data received from client since the last reset.\n"
+                     "  # Default slot is read newname_client.\n"
+                     "write newname_rx | slot\n"
+                     "  # Reset ring buffer of client\n"
+                     QUEUE_HELP);
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+      
+      // allocate new data
+      this = (struct tcpserver_data *) 
+             calloc (1, sizeof (struct tcpserver_data)); 
+      if (this == NULL)
+         break;
+      
+      //default values :
+      this->port = 0;
+      this->linked_channels = 0;
+      this->listening = 0;
+      this->connections = NULL;
+      this->num_slots = 0;
+      this->slots_allocated = 0;
+      this->num_active = 0;
+      this->current_slot = -1;
+      this->queue_high_water = 0;
+      this->queue_policy = SOCK_QUEUE_BLOCK;
+      io_mutex_init (&this->lock);
+      sock_io_init (&this->listener);
+      io_stats_reset (&this->stats);
+      frame_config_init (&this->frame);
+      buffers_init (&this->buffers);
+      send_options_init (&this->send);
+      
+      // create channel
+      this->id = create_channel_param (context, paramtype, param, 0, 
+                                    (class_rmcios) tcpserver_class_func, this);  
+      create_subchannel_str (context, this->id, "_client",
+                             (class_rmcios) tcpserver_client_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_queue",
+                             (class_rmcios) tcpserver_queue_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_frame",
+                             (class_rmcios) tcpserver_frame_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_buffer",
+                             (class_rmcios) tcpserver_buffer_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_stats",
+                             (class_rmcios) tcpserver_stats_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_rx",
+                             (class_rmcios) tcpserver_rx_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_send",
+                             (class_rmcios) tcpserver_send_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_rate",
+                             (class_rmcios) tcpserver_rate_subchan_func, 
+                             this);
+      timestamp_create (&this->timestamp, context, this->id);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+      {
+         tcpserver_shutdown (this, -1);
+         break;
+      }
+      if (this->listening)
+      {
+         printf ("tcpserver already listening on port %d\n", this->port);
+         break;
+      }
+      this->port = param_to_integer (context, paramtype, param, 0);
+      tcpserver_listen (this);
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_int (context, returnv, this->num_active);
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      tcpserver_write_params (this, context, returnv, -1, paramtype, param, 
+                              0, num_params);
+      break;
+   }
+}
+
+/***********************************************************************
+ * Tcp client channel
+ **********************************************************************/
+
+// tcpclient connection states
+#define TCPCLIENT_CLOSED 0
+#define TCPCLIENT_CONNECTING 1
+#define TCPCLIENT_CONNECTED 2
+#define TCPCLIENT_BACKOFF 3
+
+#define TCPCLIENT_BACKOFF_MIN 100
+
+// tcpclient channel data
+struct tcpclient_data
+{
+   int port;
+   char address[50];
+   int id;
+   SOCKET connection;
+
+   // Reactor registration. Receives, connects and sends queued writes.
+   struct sock_io io;
+   struct sock_timer timer;     // Connect timeout, backoff and setup
+
+   // Receive framing
+   struct frame_config frame;
+   struct framer framer;
+   struct recv_buffers buffers;
+   struct send_options send;
+   struct io_stats stats;
+   struct rx_timestamp timestamp;
+   uint64_t received;           // Time of latest receive
+   struct io_ring rx;           // Pull-mode receive ring
+
+   // Connection state machine run in the reactor thread
+   io_mutex lock;               // Guards connection, address and port
+   int enabled;                 // Connection requested by setup
+   int reconfigure;             // Address changed while connected
+   int state;
+   int connect_timeout;         // ms
+   int max_backoff;             // ms
+   int backoff;                 // ms
+
+   // Latency measurement
+   uint64_t request_time;       // setup or disconnect
+   int startup_ms;              // setup -> first connection
+   int recovery_ms;             // disconnect -> reconnection
+   int connects;
+   int attempts;
+};
+
+// Run state machine after delay_ms. Replaces earlier schedule.
+static void tcpclient_schedule (struct tcpclient_data *this, int delay_ms)
+{
+   sock_timer_stop (&this->timer);
+   sock_timer_start (&this->timer, delay_ms * 1000);
+}
+
+// Connect attempt failed or was aborted. Runs in reactor thread.
+static void tcpclient_connect_failed (struct tcpclient_data *this)
+{
+   sock_reactor_disconnect (&this->io);
+   if (!this->enabled)
+   {
+      this->state = TCPCLIENT_CLOSED;
+      return;
+   }
+   this->state = TCPCLIENT_BACKOFF;
+   if (this->reconfigure)
+   {
+      // New address from setup. Retry at once.
+      tcpclient_schedule (this, 0);
+      return;
+   }
+   tcpclient_schedule (this, this->backoff);
+   if (this->backoff < this->max_backoff)
+   {
+      this->backoff *= 2;
+      if (this->backoff > this->max_backoff)
+         this->backoff = this->max_backoff;
+   }
+}
+
+// Start connecting to the configured address. Runs in reactor thread.
+static void tcpclient_connect (struct tcpclient_data *this)
+{
+   struct sockaddr_in server;
+   SOCKET s;
+
+   if (!this->enabled)
+   {
+      this->state = TCPCLIENT_CLOSED;
+      return;
+   }
+   // Previous socket may still have operations completing
+   if (sock_io_busy (&this->io))
+   {
+      sock_timer_start (&this->timer, 1000);
+      return;
+   }
+
+   io_mutex_lock (&this->lock);
+   server.sin_family = AF_INET;
+   server.sin_addr.s_addr = inet_addr (this->address);
+   server.sin_port = htons (this->port);
+   this->reconfigure = 0;
+   io_mutex_unlock (&this->lock);
+
+   this->attempts++;
+   this->state = TCPCLIENT_CONNECTING;
+   if ((s = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET)
+   {
+      printf ("Could not create socket : %d\n", WSAGetLastError ());
+      tcpclient_connect_failed (this);
+      return;
+   }
+   // Before connect so that the window scale covers SO_RCVBUF
+   buffers_apply (&this->buffers, s);
+   this->io.s = s;
+   if (sock_io_connect (&this->io, &server) != 0)
+   {
+      tcpclient_connect_failed (this);
+      return;
+   }
+   if (this->connect_timeout > 0)
+      tcpclient_schedule (this, this->connect_timeout);
+}
+
+// Connect completed. Runs in reactor thread.
+static void tcpclient_connected (struct tcpclient_data *this)
+{
+   int latency = (int) ((io_clock_ns () - this->request_time) / 1000000);
+
+   io_mutex_lock (&this->lock);
+   this->connection = this->io.s;
+   sock_set_nodelay (this->connection, this->send.nodelay);
+   io_mutex_unlock (&this->lock);
+
+   if (this->connects == 0)
+      this->startup_ms = latency;
+   else
+      this->recovery_ms = latency;
+   this->connects++;
+   this->backoff = TCPCLIENT_BACKOFF_MIN;
+   framer_reset (&this->framer);
+   this->state = TCPCLIENT_CONNECTED;
+   sock_reactor_rearm (&this->io);
+}
+
+static void tcpclient_disconnect (struct tcpclient_data *this)
+{
+   io_mutex_lock (&this->lock);
+   if (this->connection != INVALID_SOCKET)
+   {
+      shutdown (this->connection, SD_SEND);
+      sock_reactor_disconnect (&this->io);
+      this->connection = INVALID_SOCKET;
+   }
+   io_mutex_unlock (&this->lock);
+}
+
+// Close connection and reconnect immediately when still enabled.
+// Runs in reactor thread.
+static void tcpclient_reconnect (struct tcpclient_data *this)
+{
+   tcpclient_disconnect (this);
+   this->request_time = io_clock_ns ();
+   if (!this->enabled)
+   {
+      this->state = TCPCLIENT_CLOSED;
+      return;
+   }
+   this->state = TCPCLIENT_CONNECTING;
+   tcpclient_schedule (this, 0);
+}
+
+// Deliver received frame to linked channels
+static void tcpclient_emit (void *arg, char *data, int length)
+{
+   struct tcpclient_data *this = (struct tcpclient_data *) arg;
+   uint64_t begin = io_stats_dispatch_begin (&this->stats, this->received);
+   timestamp_set (&this->timestamp, this->received);
+   ring_push (&this->rx, &this->stats, data, length);
+   write_buffer (module_context, linked_channels (module_context, this->id),
+                 data, length, this->id);
+   io_stats_dispatch_end (&this->stats, begin);
+}
+
+// Connect timeout, backoff expiry and setup changes.
+// Runs in reactor thread.
+static void tcpclient_timer (struct sock_timer *timer)
+{
+   struct tcpclient_data *this = (struct tcpclient_data *) timer->io->owner;
+   switch (this->state)
+   {
+   case TCPCLIENT_CLOSED:
+   case TCPCLIENT_BACKOFF:
+      tcpclient_connect (this);
+      break;
+
+   case TCPCLIENT_CONNECTING:
+      if (this->io.connecting)
+         // Timeout or setup. Failure is handled by tcpclient_handler.
+         sock_io_abort_connect (&this->io);
+      else if (this->io.s == INVALID_SOCKET)
+         tcpclient_connect (this);
+      break;
+
+   case TCPCLIENT_CONNECTED:
+      if (!this->enabled || this->reconfigure)
+         tcpclient_reconnect (this);
+      break;
+   }
+}
+
+// Connect result and received data. Runs in reactor thread.
+static void tcpclient_handler (struct sock_io *io, int events)
+{
+   struct tcpclient_data *this = (struct tcpclient_data *) io->owner;
+   char buffer[RECV_SIZE_MAX];
+   int reads;
+
+   if (events & SOCK_IO_CONNECT)
+   {
+      if (events & SOCK_IO_ERROR)
+         tcpclient_connect_failed (this);
+      else
+         tcpclient_connected (this);
+      return;
+   }
+
+   for (reads = 0; reads < 16; reads++)
+   {
+      int bytes = recv (io->s, buffer, this->buffers.recv_size, 0);
+      if (bytes == 0 || (bytes < 0 && !sock_would_block ()))
+      {
+         // Connection lost. Reconnect immediately, then back off.
+         tcpclient_reconnect (this);
+         return;
+      }
+      if (bytes < 0)
+         break;
+      this->received = io_clock_ns ();
+      io_stats_received (&this->stats, bytes);
+      framer_push (&this->framer, buffer, bytes);
+   }
+   sock_reactor_rearm (io);
+}
+
+// Outbound queue subchannel
+void tcpclient_queue_subchan_func (struct tcpclient_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   long long counters[4] = { 0, 0, 0, 0 };
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      queue_counters_add (&this->io, counters);
+      return_queue_counters (context, returnv, counters);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      queue_configure (&this->io, 
+                       param_to_integer (context, paramtype, param, 0),
+                       num_params > 1 ? 
+                       param_to_integer (context, paramtype, param, 1) :
+                       this->io.outq.policy);
+      break;
+   }
+}
+
+// Receive framing subchannel
+void tcpclient_frame_subchan_func (struct tcpclient_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   long long counters[3] = { 0, 0, 0 };
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      frame_counters_add (&this->framer, counters);
+      return_frame_counters (context, returnv, counters);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      frame_configure (context, &this->frame, paramtype, param, num_params);
+      break;
+   }
+}
+
+// Receive buffer subchannel
+void tcpclient_buffer_subchan_func (struct tcpclient_data *this,
+                                    const struct context_rmcios *context,
+                                    int id, enum function_rmcios function,
+                                    enum type_rmcios paramtype,
+                                    struct combo_rmcios *returnv,
+                                    int num_params,
+                                    const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      io_mutex_lock (&this->lock);
+      return_buffers (context, returnv, &this->buffers, this->connection);
+      io_mutex_unlock (&this->lock);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      buffers_configure (context, &this->buffers, paramtype, param, 
+                         num_params);
+      io_mutex_lock (&this->lock);
+      buffers_apply (&this->buffers, this->connection);
+      io_mutex_unlock (&this->lock);
+      break;
+   }
+}
+
+// Latency options subchannel
+void tcpclient_send_subchan_func (struct tcpclient_data *this,
+                                  const struct context_rmcios *context,
+                                  int id, enum function_rmcios function,
+                                  enum type_rmcios paramtype,
+                                  struct combo_rmcios *returnv,
+                                  int num_params,
+                                  const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_send_options (context, returnv, &this->send);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      send_options_configure (context, &this->send, paramtype, param, 
+                              num_params);
+      io_mutex_lock (&this->lock);
+      send_options_apply (&this->send, &this->io, &this->stats);
+      io_mutex_unlock (&this->lock);
+      break;
+   }
+}
+
+// Send rate limit subchannel
+void tcpclient_rate_subchan_func (struct tcpclient_data *this,
+                                  const struct context_rmcios *context,
+                                  int id, enum function_rmcios function,
+                                  enum type_rmcios paramtype,
+                                  struct combo_rmcios *returnv,
+                                  int num_params,
+                                  const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_rate_options (context, returnv, &this->send);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      rate_options_configure (context, &this->send, paramtype, param, 
+                              num_params);
+      io_mutex_lock (&this->lock);
+      send_options_apply (&this->send, &this->io, &this->stats);
+      io_mutex_unlock (&this->lock);
+      break;
+   }
+}
+
+// Statistics subchannel
+void tcpclient_stats_subchan_func (struct tcpclient_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   long long counters[4] = { 0, 0, 0, 0 };
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      queue_counters_add (&this->io, counters);
+      return_stats (context, returnv, &this->stats, counters);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      io_stats_reset (&this->stats);
+      break;
+   }
+}
+
+// Pull-mode receive subchannel
+void tcpclient_rx_subchan_func (struct tcpclient_data *this,
+                                const struct context_rmcios *context,
+                                int id, enum function_rmcios function,
+                                enum type_rmcios paramtype,
+                                struct combo_rmcios *returnv,
+                                int num_params,
+                                const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_ring (context, returnv, &this->rx);
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      io_ring_reset (&this->rx);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      io_ring_resize (&this->rx, 
+                      param_to_integer (context, paramtype, param, 0));
+      break;
+   }
+}
+
+// Tcp client implementation function:
+void tcpclient_class_func (struct tcpclient_data *this,
+                           const struct context_rmcios *context, int id,
+                           enum function_rmcios function,
+                           enum type_rmcios paramtype,
+                           struct combo_rmcios *returnv,
+                           int num_params,
+                           const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv, 
+                     "TCP client channel\n"
+                     "create tcpclient newname\n"
+                     " setup newname ip port | connect_timeout_ms(3000)"
+                     " | max_backoff_ms(10000)\r\n"
+                     "  # Open connection. Connects in background and\r\n"
+                     "  # reconnects with exponential backoff when lost.\r\n"
+                     " setup newname \r\n"
+                     "  # Close connection\r\n"
+                     " write newname data \r\n"
+                     "  # -Write data to the connection.\r\n"
+                     "  # Returns -1 when not connected and queue is off.\r\n"
+                     " read newname\r\n"
+                     "  # Connection status: "
+                     "state connects attempts startup_ms recovery_ms\r\n"
+                     "  # state: 0=closed 1=connecting 2=connected "
+                     "3=backoff\r\n"
+                     " link newname channel # Link received data to channel\r\n"
+                     "creates subchannel: \r\n"
+                     "  newname_queue for asynchronous writes\r\n"
+                     "  Queued writes are kept while reconnecting.\r\n"
+                     "  newname_frame for receive framing\r\n"
+                     FRAME_HELP
+                     "  newname_buffer for buffer sizes\r\n"
+                     BUFFER_HELP
+                     "  newname_send for latency options\r\n"
+                     SEND_HELP
+                     "  newname_rate for send rate limit\r\n"
+                     RATE_HELP
+                     "  newname_stats for statistics\r\n"
+                     STATS_HELP
+                     "  newname_timestamp for receive time of messages\r\n"
+                     TIMESTAMP_HELP
+                     "  newname_rx for polling received data\r\n"
+                     RX_HELP
+                     QUEUE_HELP);
+      break;
+
+   case create_rmcios:
+      if (num_params < 1)
+         break;
+      // allocate new data
+      this = (struct tcpclient_data *) malloc (sizeof (struct tcpclient_data)); 
+      if (this == NULL)
+         break;
+      
+      //default values :
+      this->port = 0;
+      this->address[0] = 0;
+      this->connection = INVALID_SOCKET;
+      sock_io_init (&this->io);
+      this->io.handler = tcpclient_handler;
+      this->io.owner = this;
+      sock_timer_init (&this->timer, &this->io, tcpclient_timer);
+      io_stats_reset (&this->stats);
+      io_ring_init (&this->rx);
+      io_mutex_init (&this->lock);
+      frame_config_init (&this->frame);
+      framer_init (&this->framer, &this->frame, tcpclient_emit, this);
+      buffers_init (&this->buffers);
+      send_options_init (&this->send);
+      this->enabled = 0;
+      this->reconfigure = 0;
+      this->state = TCPCLIENT_CLOSED;
+      this->connect_timeout = 3000;
+      this->max_backoff = 10000;
+      this->backoff = TCPCLIENT_BACKOFF_MIN;
+      this->request_time = 0;
+      this->startup_ms = -1;
+      this->recovery_ms = -1;
+      this->connects = 0;
+      this->attempts = 0;
+      
+      // create channel
+      this->id = create_channel_param (context, paramtype, param, 0, 
+                                    (class_rmcios) tcpclient_class_func, this);
+      create_subchannel_str (context, this->id, "_queue",
+                             (class_rmcios) tcpclient_queue_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_frame",
+                             (class_rmcios) tcpclient_frame_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_buffer",
+                             (class_rmcios) tcpclient_buffer_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_stats",
+                             (class_rmcios) tcpclient_stats_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_rx",
+                             (class_rmcios) tcpclient_rx_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_send",
+                             (class_rmcios) tcpclient_send_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_rate",
+                             (class_rmcios) tcpclient_rate_subchan_func, 
+                             this);
+      timestamp_create (&this->timestamp, context, this->id);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+      {
+         this->enabled = 0;
+         sock_timer_start (&this->timer, 0);
+         break;
+      }
+      if (num_params < 2)
+         break;
+      io_mutex_lock (&this->lock);
+      param_to_string (context, paramtype, param, 0,
+                       sizeof (this->address), this->address);
+      this->port = param_to_integer (context, paramtype, param, 1);
+      io_mutex_unlock (&this->lock);
+      if (num_params > 2)
+         this->connect_timeout = param_to_integer (context, paramtype, 
+                                                   param, 2);
+      if (num_params > 3)
+         this->max_backoff = param_to_integer (context, paramtype, param, 3);
+      if (this->max_backoff < TCPCLIENT_BACKOFF_MIN)
+         this->max_backoff = TCPCLIENT_BACKOFF_MIN;
+
+      // Connect from the reactor thread
+      this->request_time = io_clock_ns ();
+      if (!this->enabled)
+      {
+         this->connects = 0;
+         this->startup_ms = -1;
+         this->recovery_ms = -1;
+      }
+      this->reconfigure = this->enabled;
+      this->enabled = 1;
+      this->backoff = TCPCLIENT_BACKOFF_MIN;
+      sock_timer_start (&this->timer, 0);
+      break;
+
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      {
+         char status[96];
+         snprintf (status, sizeof (status), "%d %d %d %d %d",
+                   this->state, this->connects, this->attempts,
+                   this->startup_ms, this->recovery_ms);
+         return_string (context, returnv, status);
+      }
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      {
+         struct param_gather g;
+         int result = -1;
+         if (param_gather (&g, context, paramtype, param, 0, num_params) != 0)
+            ;
+         else if (this->io.outq.high_water > 0 
+                  || send_options_queued (&this->send))
+         {
+            struct sock_chunk *chunk = sock_chunk_new (g.bufs, g.count);
+            if (chunk != NULL)
+            {
+               result = sock_io_enqueue (&this->io, chunk);
+               sock_chunk_release (chunk);
+            }
+            // Dropped messages are counted by the queue
+            if (result <= 0)
+               io_stats_sent (&this->stats, g.length, result == 0);
+         }
+         else
+         {
+            // Never block the caller. Fails without connection, the
+            // rest of what the socket does not take is queued.
+            result = sock_io_send (&this->io, g.bufs, g.count);
+            if (result <= 0)
+               io_stats_sent (&this->stats, g.length, result == 0);
+         }
+         if (result < 0)
+            return_int (context, returnv, -1);
+         param_gather_free (&g);
+      }
+      break;
+   }
+}
+
+/***********************************************************************
+ * UDP client channel
+ **********************************************************************/
+
+// Called with the sender of each datagram before it is delivered
+typedef void (*dgram_sender_func) (void *arg, const struct sockaddr_in *from);
+
+// Deliver queued datagrams to linked channels of id and rearm.
+// Runs in reactor thread.
+static void dgram_receive (struct sock_io *io, struct sock_dgram_batch *batch,
+                           struct recv_buffers *buffers, 
+                           struct io_stats *stats, struct io_ring *rx,
+                           struct rx_timestamp *stamp, int id,
+                           dgram_sender_func sender, void *arg)
+{
+   int batches;
+   if (batch->datagram_size != buffers->recv_size)
+   {
+      sock_batch_free (batch);
+      if (sock_batch_init (batch, SOCK_BATCH_MAX, buffers->recv_size) != 0)
+      {
+         printf ("Could not allocate udp receive buffers\n");
+         batch->datagram_size = 0;
+         sock_reactor_rearm (io);
+         return;
+      }
+   }
+
+   // Drain everything queued, bounded to keep other sockets served
+   for (batches = 0; batches < 16; batches++)
+   {
+      int count = sock_recv_batch (io->s, batch);
+      uint64_t received = io_clock_ns ();
+      int i;
+      for (i = 0; i < count; i++)
+      {
+         uint64_t begin;
+         if (sender != NULL)
+            sender (arg, &batch->dgrams[i].from);
+         if (batch->dgrams[i].truncated)
+         {
+            buffers->truncated++;
+            io_stats_add (&stats->drops, 1);
+         }
+         io_stats_received (stats, batch->dgrams[i].length);
+         begin = io_stats_dispatch_begin (stats, received);
+         timestamp_set (stamp, received);
+         ring_push (rx, stats, batch->dgrams[i].data, batch->dgrams[i].length);
+         write_buffer (module_context, linked_channels (module_context, id),
+                       batch->dgrams[i].data, batch->dgrams[i].length, id);
+         io_stats_dispatch_end (stats, begin);
+      }
+      if (count < batch->capacity)
+         break;
+   }
+   sock_reactor_rearm (io);
+}
+
+// udpclient channel data
+struct client_data
+{
+   int port;
+   char address[50];
+   int id;
+   SOCKET connection;
+   struct sockaddr_in destination;
+   socklen_t slen;
+   struct recv_buffers buffers;
+   struct sock_io io;
+   struct sock_dgram_batch batch;
+   struct io_stats stats;
+   struct rx_timestamp timestamp;
+   struct io_ring rx;           // Pull-mode receive ring
+};
+
+// Replies go to the latest sender
+static void udpclient_sender (void *arg, const struct sockaddr_in *from)
+{
+   struct client_data *this = (struct client_data *) arg;
+   this->destination = *from;
+}
+
+// Receive handler. Runs in reactor thread.
+static void udpclient_handler (struct sock_io *io, int events)
+{
+   struct client_data *this = (struct client_data *) io->owner;
+   dgram_receive (io, &this->batch, &this->buffers, &this->stats, &this->rx,
+                  &this->timestamp, this->id,
+                  udpclient_sender, this);
+}
+
+// Receive buffer subchannel
+void udpclient_buffer_subchan_func (struct client_data *this,
+                                    const struct context_rmcios *context,
+                                    int id, enum function_rmcios function,
+                                    enum type_rmcios paramtype,
+                                    struct combo_rmcios *returnv,
+                                    int num_params,
+                                    const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_buffers (context, returnv, &this->buffers, this->connection);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      buffers_configure (context, &this->buffers, paramtype, param, 
+                         num_params);
+      buffers_apply (&this->buffers, this->connection);
+      break;
+   }
+}
+
+// Statistics subchannel
+void udpclient_stats_subchan_func (struct client_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   long long counters[4] = { 0, 0, 0, 0 };
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_stats (context, returnv, &this->stats, counters);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      io_stats_reset (&this->stats);
+      break;
    }
+}
 
-   ///////////////////////////////////////////////////////////////////
-   // Start litening to incoming connections.
-   ///////////////////////////////////////////////////////////////////
-   listen (s, 3);
-   struct sockaddr_in client;
-   int cs;
-   cs = sizeof (struct sockaddr_in);
-   while ((this->connection =
-           accept (s, (struct sockaddr *) &client, &cs)) != INVALID_SOCKET)
+// Pull-mode receive subchannel
+void udpclient_rx_subchan_func (struct client_data *this,
+                                const struct context_rmcios *context,
+                                int id, enum function_rmcios function,
+                                enum type_rmcios paramtype,
+                                struct combo_rmcios *returnv,
+                                int num_params,
+                                const union param_rmcios param)
+{
+   switch (function)
    {
-      char buffer[1500];
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_ring (context, returnv, &this->rx);
+      break;
 
-      // empty write to signal new connection :
-      write_iv (module_context, 
-                linked_channels (module_context, this->id), 0, NULL) ;
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      io_ring_reset (&this->rx);
+      break;
 
-      // Receive loop:
-      while (1)
-      {
-         int bytes;
-         bytes = recv (this->connection, buffer, sizeof (buffer), 0);
-         if (bytes < 1)
-            break;
-         write_buffer (module_context,
-                       linked_channels (module_context, this->id),
-                       buffer, bytes, this->id);
-      }
-      
-      if (this->connection != 0)
-         shutdown (this->connection, SD_SEND);
-   
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      io_ring_resize (&this->rx, 
+                      param_to_integer (context, paramtype, param, 0));
+      break;
    }
-   printf ("Invalud socket -> closing server.\n");
-
-   closesocket (s);
 }
 
-
-// Tcp server implementation function:
-void tcpserver_class_func (struct tcpserver_data *this,
+// Tcp client implementation function:
+void udpclient_class_func (struct client_data *this,
                            const struct context_rmcios *context, int id,
                            enum function_rmcios function,
                            enum type_rmcios paramtype,
@@ -129,46 +2299,102 @@ void tcpserver_class_func (struct tcpserver_data *this,
                            int num_params,
                            const union param_rmcios param)
 {
-   int plen;
    switch (function)
    {
    case help_rmcios:
       return_string (context, returnv, 
-                     "TCP server channel\n"
-                     "create tcpserver newname\n"
-                     "setup newname port\n"
-                     "write newname data\n"
-                     "link newname channel\n");
+                     "UDP client channel\n"
+                     "create udpclient newname\n"
+                     " setup newname ip port # Set connection destination\r\n"
+                     " write newname data # Send data to the destination \r\n"
+                     " link newname channel # Link received data to channel\r\n"
+                     "creates subchannel: \r\n"
+                     "  newname_buffer for buffer sizes\r\n"
+                     BUFFER_HELP
+                     "  newname_stats for statistics\r\n"
+                     STATS_HELP
+                     "  newname_timestamp for receive time of messages\r\n"
+                     TIMESTAMP_HELP
+                     "  newname_rx for polling received data\r\n"
+                     RX_HELP
+                     );
       break;
 
    case create_rmcios:
       if (num_params < 1)
          break;
-      
+
       // allocate new data
-      this = (struct tcpserver_data *) malloc (sizeof (struct tcpserver_data)); 
-      
+      this = (struct client_data *) malloc (sizeof (struct client_data));       
+      if (this == NULL)
+         break;
+      buffers_init (&this->buffers);
+      sock_io_init (&this->io);
+      io_stats_reset (&this->stats);
+      io_ring_init (&this->rx);
+      this->io.handler = udpclient_handler;
+      this->io.owner = this;
+      this->io.datagram = 1;
+      this->batch.datagram_size = 0;
+      this->batch.storage = NULL;
+
       //default values :
       this->port = 0;
-      this->linked_channels = 0;
-      this->threadID = 0;
+      this->address[0] = 0;
+      this->slen = sizeof (this->destination);
+      memset ((char *) &this->destination, 0, sizeof (this->destination));
+      
       // create channel
       this->id = create_channel_param (context, paramtype, param, 0, 
-                                    (class_rmcios) tcpserver_class_func, this);  
+                           (class_rmcios) udpclient_class_func, this);        
+      create_subchannel_str (context, this->id, "_buffer",
+                             (class_rmcios) udpclient_buffer_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_stats",
+                             (class_rmcios) udpclient_stats_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_rx",
+                             (class_rmcios) udpclient_rx_subchan_func, 
+                             this);
+      timestamp_create (&this->timestamp, context, this->id);
+
+      // Open the socket
+      if ((this->connection =
+           socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
+      {
+         printf ("Could not create socket : %d", WSAGetLastError ());
+         break;
+      }
+      
+      // Bind to ephemeral port so replies can be waited before first send
+      {
+         struct sockaddr_in local;
+         memset (&local, 0, sizeof (local));
+         local.sin_family = AF_INET;
+         local.sin_addr.s_addr = INADDR_ANY;
+         local.sin_port = 0;
+         bind (this->connection, (struct sockaddr *) &local, sizeof (local));
+      }
+
+      // Receive in reactor thread
+      this->io.s = this->connection;
+      if (sock_reactor_add (&this->io) != 0)
+         printf ("Could not register udpclient socket\n");
       break;
 
    case setup_rmcios:
       if (this == NULL)
          break;
-      if (num_params < 1)
-      {
-         if (this->connection != 0)
-            shutdown (this->connection, SD_SEND);
+      if (num_params < 2)
          break;
+      param_to_string (context, paramtype, param, 0,
+                       sizeof (this->address), this->address);
+      this->port = param_to_integer (context, paramtype, param, 1);
+      {
+         this->destination.sin_family = AF_INET;
+         this->destination.sin_addr.s_addr = inet_addr (this->address);
+         this->destination.sin_port = htons (this->port);
       }
-      this->port = param_to_integer (context, paramtype, param, 0);
-      // Start thread
-      CreateThread (0, 0, tcpserver_thread, this, 0, &this->threadID);
       break;
 
    case write_rmcios:
@@ -176,215 +2402,482 @@ void tcpserver_class_func (struct tcpserver_data *this,
          break;
       if (num_params < 1)
          break;
-      plen = param_buffer_alloc_size (context, paramtype, param, 0);    
-      // Determine the needed buffer size
       {
-         // allocate buffer
-         char buffer[plen];     
-         // structure pointer to buffer data
-         struct buffer_rmcios pbuffer;  
-         pbuffer = param_to_buffer (context, paramtype, param, 0, plen, buffer);
-         if (send (this->connection, pbuffer.data, pbuffer.length, 0) < 0)
+         struct param_gather g;
+         //send the parameters as one datagram
+         if (param_gather (&g, context, paramtype, param, 0, num_params) == 0)
          {
-            return_int (context, returnv, -1);
-            closesocket (this->connection);
+            int sent = sock_sendv (this->connection, g.bufs, g.count,
+                                   &this->destination);
+            io_stats_sent (&this->stats, sent, sent >= 0);
+            if (sent < 0)
+               printf ("sendto() failed with error code : %d",
+                       WSAGetLastError ());
          }
+         param_gather_free (&g);
       }
       break;
    }
 }
 
+
 /***********************************************************************
- * Tcp client channel
+ * UDP server channel
  **********************************************************************/
 
-// tcpclient channel data
-struct tcpclient_data
+// Peer handle: slot index in the low bits, slot generation above so that
+// a handle of an expired peer never addresses the next user of the slot.
+#define PEER_INDEX_BITS 20
+#define PEER_INDEX_MASK ((1 << PEER_INDEX_BITS) - 1)
+#define PEER_MAX (1 << PEER_INDEX_BITS)
+#define PEER_IDLE_DEFAULT 60000         // ms
+#define PEER_SWEEP_MAX 1000             // ms between expiry sweeps
+
+struct udp_peer
+{
+   struct sockaddr_in addr;
+   uint64_t last_seen;
+   int generation;
+   int active;
+   int next;                    // Bucket chain or free list. -1 = end
+};
+
+// Hashed table of udp peers with idle expiry
+struct peer_table
+{
+   io_mutex lock;
+   struct udp_peer *peers;
+   int num_slots;
+   int slots_allocated;         // Capacity of peers
+   int *buckets;                // Power of two, at least num_slots
+   int num_buckets;
+   int free_list;
+   int active;
+   int idle_ms;                 // 0 = never expire
+   long long expired;
+};
+
+static void peer_table_init (struct peer_table *t)
+{
+   memset (t, 0, sizeof (*t));
+   io_mutex_init (&t->lock);
+   t->free_list = -1;
+   t->idle_ms = PEER_IDLE_DEFAULT;
+}
+
+static unsigned peer_hash (const struct sockaddr_in *addr)
+{
+   uint64_t key = ((uint64_t) addr->sin_addr.s_addr << 16) ^ addr->sin_port;
+   return (unsigned) ((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static int peer_handle (struct peer_table *t, int slot)
+{
+   return (t->peers[slot].generation << PEER_INDEX_BITS) | slot;
+}
+
+// Slot of an active peer handle or -1. Lock held.
+static int peer_slot (struct peer_table *t, int handle)
+{
+   int slot = handle & PEER_INDEX_MASK;
+   if (handle < 0 || slot >= t->num_slots || !t->peers[slot].active
+       || peer_handle (t, slot) != handle)
+      return -1;
+   return slot;
+}
+
+// Double bucket array and rehash active peers. Lock held.
+static int peer_table_grow (struct peer_table *t)
+{
+   int num_buckets = t->num_buckets > 0 ? t->num_buckets * 2 : 64;
+   int *buckets = (int *) malloc (sizeof (int) * num_buckets);
+   int i;
+   if (buckets == NULL)
+      return -1;
+   for (i = 0; i < num_buckets; i++)
+      buckets[i] = -1;
+   for (i = 0; i < t->num_slots; i++)
+   {
+      if (t->peers[i].active)
+      {
+         int b = peer_hash (&t->peers[i].addr) & (num_buckets - 1);
+         t->peers[i].next = buckets[b];
+         buckets[b] = i;
+      }
+   }
+   free (t->buckets);
+   t->buckets = buckets;
+   t->num_buckets = num_buckets;
+   return 0;
+}
+
+// Handle of the peer with address. Adds new peers. Returns -1 when the
+// table is full. Sets *added for a new peer.
+static int peer_table_lookup (struct peer_table *t,
+                              const struct sockaddr_in *addr, int *added)
+{
+   uint64_t now = io_clock_ns ();
+   int slot, b;
+   *added = 0;
+
+   io_mutex_lock (&t->lock);
+   if (t->num_buckets > 0)
+   {
+      b = peer_hash (addr) & (t->num_buckets - 1);
+      for (slot = t->buckets[b]; slot >= 0; slot = t->peers[slot].next)
+      {
+         struct udp_peer *p = &t->peers[slot];
+         if (p->addr.sin_addr.s_addr == addr->sin_addr.s_addr
+             && p->addr.sin_port == addr->sin_port)
+         {
+            p->last_seen = now;
+            io_mutex_unlock (&t->lock);
+            return peer_handle (t, slot);
+         }
+      }
+   }
+
+   // New peer
+   if (t->num_buckets == 0 && peer_table_grow (t) != 0)
+   {
+      io_mutex_unlock (&t->lock);
+      return -1;
+   }
+   if (t->free_list >= 0)
+   {
+      slot = t->free_list;
+      t->free_list = t->peers[slot].next;
+   }
+   else
+   {
+      if (t->num_slots >= PEER_MAX)
+      {
+         io_mutex_unlock (&t->lock);
+         return -1;
+      }
+      if (t->num_slots >= t->slots_allocated)
+      {
+         // Doubled, so that a burst of new peers is not copied each time
+         int allocate = t->slots_allocated > 0 ? t->slots_allocated * 2 : 64;
+         struct udp_peer *peers;
+         if (allocate > PEER_MAX)
+            allocate = PEER_MAX;
+         peers = (struct udp_peer *)
+                 realloc (t->peers, sizeof (*peers) * allocate);
+         if (peers == NULL)
+         {
+            io_mutex_unlock (&t->lock);
+            return -1;
+         }
+         t->peers = peers;
+         t->slots_allocated = allocate;
+      }
+      slot = t->num_slots++;
+      t->peers[slot].generation = 0;
+   }
+   t->peers[slot].addr = *addr;
+   t->peers[slot].last_seen = now;
+   t->peers[slot].active = 1;
+   t->active++;
+   // Rehash links also the new peer
+   if (t->num_slots <= t->num_buckets || peer_table_grow (t) != 0)
+   {
+      b = peer_hash (addr) & (t->num_buckets - 1);
+      t->peers[slot].next = t->buckets[b];
+      t->buckets[b] = slot;
+   }
+   *added = 1;
+   io_mutex_unlock (&t->lock);
+   return peer_handle (t, slot);
+}
+
+// Remove peers idle longer than idle_ms. Returns active peers left.
+static int peer_table_expire (struct peer_table *t)
+{
+   uint64_t now = io_clock_ns ();
+   uint64_t idle_ns;
+   int b, active;
+
+   io_mutex_lock (&t->lock);
+   idle_ns = (uint64_t) t->idle_ms * 1000000;
+   for (b = 0; b < t->num_buckets && t->idle_ms > 0; b++)
+   {
+      int *link = &t->buckets[b];
+      while (*link >= 0)
+      {
+         struct udp_peer *p = &t->peers[*link];
+         int slot = *link;
+         if (now - p->last_seen <= idle_ns)
+         {
+            link = &p->next;
+            continue;
+         }
+         *link = p->next;
+         p->active = 0;
+         p->generation = (p->generation + 1) & 0x3ff;
+         p->next = t->free_list;
+         t->free_list = slot;
+         t->active--;
+         t->expired++;
+      }
+   }
+   active = t->active;
+   io_mutex_unlock (&t->lock);
+   return active;
+}
+
+// Address of peer. Returns -1 when the handle is not active.
+static int peer_table_address (struct peer_table *t, int handle,
+                               struct sockaddr_in *addr)
+{
+   int slot;
+   io_mutex_lock (&t->lock);
+   slot = peer_slot (t, handle);
+   if (slot >= 0)
+      *addr = t->peers[slot].addr;
+   io_mutex_unlock (&t->lock);
+   return slot >= 0 ? 0 : -1;
+}
+
+// Copy addresses of all active peers. Caller frees *addrs.
+static int peer_table_addresses (struct peer_table *t,
+                                 struct sockaddr_in **addrs)
+{
+   int i, n = 0;
+   io_mutex_lock (&t->lock);
+   *addrs = (struct sockaddr_in *) 
+            malloc (sizeof (struct sockaddr_in) * (t->active + 1));
+   for (i = 0; *addrs != NULL && i < t->num_slots; i++)
+   {
+      if (t->peers[i].active)
+         (*addrs)[n++] = t->peers[i].addr;
+   }
+   io_mutex_unlock (&t->lock);
+   return n;
+}
+
+// udpserver channel data
+struct udpserver_data
 {
    int port;
-   char address[50];
    int id;
-   DWORD threadID;
    SOCKET connection;
+   struct sockaddr_in server, last_client;
+   socklen_t slen;
+   struct recv_buffers buffers;
+   struct sock_io io;
+   struct sock_dgram_batch batch;
+   struct io_stats stats;
+   struct rx_timestamp timestamp;
+   struct io_ring rx;           // Pull-mode receive ring
+
+   // Peers that have sent datagrams
+   struct peer_table peers;
+   int current_peer;            // Sender of datagram being delivered
+   struct sock_timer expiry;
 };
 
-// TCP Client reception thread
-DWORD WINAPI tcpclient_thread (LPVOID lpvParam)
+// Time between idle peer sweeps
+static int udpserver_sweep_ms (struct udpserver_data *this)
+{
+   int ms = this->peers.idle_ms / 2 + 1;
+   return ms < PEER_SWEEP_MAX ? ms : PEER_SWEEP_MAX;
+}
+
+// Expire idle peers. Runs in reactor thread.
+static void udpserver_expiry (struct sock_timer *timer)
+{
+   struct udpserver_data *this = (struct udpserver_data *) timer->io->owner;
+   // Sweep only while there are peers
+   if (peer_table_expire (&this->peers) > 0 && this->peers.idle_ms > 0)
+      sock_timer_start (timer, udpserver_sweep_ms (this) * 1000);
+}
+
+static void udpserver_sender (void *arg, const struct sockaddr_in *from)
+{
+   struct udpserver_data *this = (struct udpserver_data *) arg;
+   int added;
+   this->last_client = *from;
+   this->current_peer = peer_table_lookup (&this->peers, from, &added);
+   if (added && this->peers.idle_ms > 0)
+      sock_timer_start (&this->expiry, udpserver_sweep_ms (this) * 1000);
+}
+
+// Receive handler. Runs in reactor thread.
+static void udpserver_handler (struct sock_io *io, int events)
+{
+   struct udpserver_data *this = (struct udpserver_data *) io->owner;
+   dgram_receive (io, &this->batch, &this->buffers, &this->stats, &this->rx,
+                  &this->timestamp, this->id,
+                  udpserver_sender, this);
+}
+
+// Send datagram to peer or to all active peers when handle < 0
+static int udpserver_send (struct udpserver_data *this, int handle,
+                           const sock_buf * bufs, int count)
 {
-   struct tcpclient_data *this = (struct tcpclient_data *) lpvParam;
-   char buffer[1500];
-   while (1)
+   struct sockaddr_in *addrs;
+   struct sockaddr_in addr;
+   int result = 0;
+   int i, n;
+
+   if (handle >= 0)
    {
-      int bytes;
-      if (this->connection != 0)
-         bytes = recv (this->connection, buffer, sizeof (buffer), 0);
-      else
-         Sleep (10);
-      write_buffer (module_context,
-                    linked_channels (module_context, this->id), buffer,
-                    bytes, this->id);
+      if (peer_table_address (&this->peers, handle, &addr) != 0)
+         return -1;
+      n = sock_sendv (this->connection, bufs, count, &addr);
+      io_stats_sent (&this->stats, n, n >= 0);
+      return n < 0 ? -1 : 0;
+   }
+   n = peer_table_addresses (&this->peers, &addrs);
+   for (i = 0; i < n; i++)
+   {
+      int sent = sock_sendv (this->connection, bufs, count, &addrs[i]);
+      io_stats_sent (&this->stats, sent, sent >= 0);
+      if (sent < 0)
+         result = -1;
    }
+   free (addrs);
+   return result;
 }
 
-// Tcp client implementation function:
-void tcpclient_class_func (struct tcpclient_data *this,
-                           const struct context_rmcios *context, int id,
-                           enum function_rmcios function,
-                           enum type_rmcios paramtype,
-                           struct combo_rmcios *returnv,
-                           int num_params,
-                           const union param_rmcios param)
+// Peer addressing subchannel
+void udpserver_peer_subchan_func (struct udpserver_data *this,
+                                  const struct context_rmcios *context,
+                                  int id, enum function_rmcios function,
+                                  enum type_rmcios paramtype,
+                                  struct combo_rmcios *returnv,
+                                  int num_params,
+                                  const union param_rmcios param)
 {
    switch (function)
    {
-   case help_rmcios:
-      return_string (context, returnv, 
-                     "TCP client channel\n"
-                     "create tcpclient newname\n"
-                     " setup newname ip port "
-                     "  # Open connection\r\n"
-                     " setup newname \r\n"
-                     "  # Close connection\r\n"
-                     " write newname data \r\n"
-                     "  # -Write data to the connection. Reconnect if needed\r\n"
-                     " link newname channel # Link received data to channel\r\n"
-                     );
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_int (context, returnv, this->current_peer);
       break;
 
-   case create_rmcios:
+   case setup_rmcios:
+      if (this == NULL)
+         break;
       if (num_params < 1)
          break;
-      // allocate new data
-      this = (struct tcpclient_data *) malloc (sizeof (struct tcpclient_data)); 
-      
-      //default values :
-      this->port = 0;
-      this->address[0] = 0;
-      this->threadID = 0;
-      
-      // create channel
-      this->id = create_channel_param (context, paramtype, param, 0, 
-                                    (class_rmcios) tcpclient_class_func, this);
+      this->peers.idle_ms = param_to_integer (context, paramtype, param, 0);
+      if (this->peers.idle_ms > 0)
+         sock_timer_start (&this->expiry, udpserver_sweep_ms (this) * 1000);
+      break;
 
-      // Open the socket
-      if ((this->connection =
-           socket (AF_INET, SOCK_STREAM, IPPROTO_TCP)) == INVALID_SOCKET)
-      {
-         printf ("Could not create socket : %d", WSAGetLastError ());
+   case write_rmcios:
+      if (this == NULL)
          break;
+      if (num_params < 2)
+         break;
+      {
+         struct param_gather g;
+         if (param_gather (&g, context, paramtype, param, 1, num_params) == 0
+             && udpserver_send (this, 
+                                param_to_integer (context, paramtype, 
+                                                  param, 0),
+                                g.bufs, g.count) < 0)
+            return_int (context, returnv, -1);
+         param_gather_free (&g);
       }
+      break;
+   }
+}
 
-      // Create receiving thread.
-      CreateThread (0, 0, tcpclient_thread, this, 0, &this->threadID);
+// Receive buffer subchannel
+void udpserver_buffer_subchan_func (struct udpserver_data *this,
+                                    const struct context_rmcios *context,
+                                    int id, enum function_rmcios function,
+                                    enum type_rmcios paramtype,
+                                    struct combo_rmcios *returnv,
+                                    int num_params,
+                                    const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_buffers (context, returnv, &this->buffers, this->connection);
       break;
 
    case setup_rmcios:
       if (this == NULL)
          break;
       if (num_params < 1)
-      {
-         if (this->connection != 0)
-            shutdown (this->connection, SD_SEND);
-         break;
-      }
-      if (num_params < 2)
          break;
-      param_to_string (context, paramtype, param, 0,
-                       sizeof (this->address), this->address);
-      this->port = param_to_integer (context, paramtype, param, 1);
-      {
-         struct sockaddr_in server;
-
-         server.sin_family = AF_INET;
-         server.sin_addr.s_addr = inet_addr (this->address);
-         server.sin_port = htons (this->port);
+      buffers_configure (context, &this->buffers, paramtype, param, 
+                         num_params);
+      buffers_apply (&this->buffers, this->connection);
+      break;
+   }
+}
 
-         //Connect to remote server
-         if (connect
-             (this->connection, (struct sockaddr *) &server,
-              sizeof (server)) < 0)
-         {
-            puts ("TCP client connect error!\n");
-         }
-      }
+// Statistics subchannel
+void udpserver_stats_subchan_func (struct udpserver_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   long long counters[4] = { 0, 0, 0, 0 };
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_stats (context, returnv, &this->stats, counters);
       break;
 
-   case write_rmcios:
+   case setup_rmcios:
       if (this == NULL)
          break;
-      if (num_params < 1)
-         break;
-      int plen = param_buffer_alloc_size (context, paramtype, param, 0);
-      // Determine the needed buffer size
-      {
-         char buffer[plen];     
-         // allocate buffer
-         struct buffer_rmcios pbuffer;  
-         
-         // structure pointer to buffer data
-         pbuffer = param_to_buffer (context, paramtype, param, 0, plen, buffer);
-         if (send (this->connection, pbuffer.data, pbuffer.length, 0) < 0)
-         {
-            return_int (context, returnv, -1);
-            closesocket (this->connection);
-         }
-      }
+      io_stats_reset (&this->stats);
       break;
    }
 }
 
-/***********************************************************************
- * UDP client channel
- **********************************************************************/
-
-// udpclient channel data
-struct client_data
-{
-   int port;
-   char address[50];
-   int id;
-   DWORD threadID;
-   SOCKET connection;
-   struct sockaddr_in destination;
-   int slen;
-};
-
-// UDP Client reception thread
-DWORD WINAPI udpclient_thread (LPVOID lpvParam)
+// Pull-mode receive subchannel
+void udpserver_rx_subchan_func (struct udpserver_data *this,
+                                const struct context_rmcios *context,
+                                int id, enum function_rmcios function,
+                                enum type_rmcios paramtype,
+                                struct combo_rmcios *returnv,
+                                int num_params,
+                                const union param_rmcios param)
 {
-   struct client_data *this = (struct client_data *) lpvParam;
-   char buffer[1500];
-   while (1)
+   switch (function)
    {
-      int bytes = 0;
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_ring (context, returnv, &this->rx);
+      break;
 
-      if (this->connection != 0)
-      {
-         if ((bytes =
-              recvfrom (this->connection, buffer, sizeof (buffer), 0,
-                        (struct sockaddr *) &this->destination,
-                        &this->slen)) == SOCKET_ERROR)
-         {
-            Sleep (10);
-         }
-         else
-         {
-            write_buffer (module_context,
-                          linked_channels (module_context,
-                                           this->id), buffer, bytes, this->id);
-         }
-         Sleep (10);
-      }
-      else
-      {
-         printf ("No connection\n");
-         Sleep (10);
-      }
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      io_ring_reset (&this->rx);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      io_ring_resize (&this->rx, 
+                      param_to_integer (context, paramtype, param, 0));
+      break;
    }
 }
 
-// Tcp client implementation function:
-void udpclient_class_func (struct client_data *this,
+// Tcp client implementation functiona
+void udpserver_class_func (struct udpserver_data *this,
                            const struct context_rmcios *context, int id,
                            enum function_rmcios function,
                            enum type_rmcios paramtype,
@@ -396,57 +2889,102 @@ void udpclient_class_func (struct client_data *this,
    {
    case help_rmcios:
       return_string (context, returnv, 
-                     "UDP client channel\n"
+                     "UDP server channel\n"
                      "create udpclient newname\n"
-                     " setup newname ip port # Set connection destination\r\n"
-                     " write newname data # Send data to the destination \r\n"
-                     " link newname channel # Link received data to channel\r\n"
+                     " setup newname port # Set receiving port\r\n"
+                     " write newname data # Send data to the latest clienta\r\n"
+                     " link newname channel # Link received data to channel.\r\n"
+                     "creates subchannel: \r\n"
+                     "  newname_buffer for buffer sizes\r\n"
+                     BUFFER_HELP
+                     "  newname_peer for addressing peers\r\n"
+                     "   read newname_peer\r\n"
+                     "    # Handle of the peer whose data is being received\r\n"
+                     "   write newname_peer handle data\r\n"
+                     "    # Send to peer. Handle -1 sends to all peers.\r\n"
+                     "   setup newname_peer idle_ms\r\n"
+                     "    # Forget peers idle for idle_ms (60000). 0=never\r\n"
+                     "  newname_stats for statistics\r\n"
+                     STATS_HELP
+                     "  newname_timestamp for receive time of messages\r\n"
+                     TIMESTAMP_HELP
+                     "  newname_rx for polling received data\r\n"
+                     RX_HELP
                      );
       break;
 
    case create_rmcios:
       if (num_params < 1)
          break;
-
+      
       // allocate new data
-      this = (struct client_data *) malloc (sizeof (struct client_data));       
+      this = (struct udpserver_data *) malloc (sizeof (struct udpserver_data)); 
+      if (this == NULL)
+         break;
+      buffers_init (&this->buffers);
+      sock_io_init (&this->io);
+      io_stats_reset (&this->stats);
+      io_ring_init (&this->rx);
+      this->io.handler = udpserver_handler;
+      this->io.owner = this;
+      this->io.datagram = 1;
+      this->batch.datagram_size = 0;
+      this->batch.storage = NULL;
+      peer_table_init (&this->peers);
+      this->current_peer = -1;
+      sock_timer_init (&this->expiry, &this->io, udpserver_expiry);
 
       //default values :
       this->port = 0;
-      this->address[0] = 0;
-      this->threadID = 0;
-      this->slen = sizeof (this->destination);
-      memset ((char *) &this->destination, 0, sizeof (this->destination));
-      
-      // create channel
+      this->slen = sizeof (this->server);
+      memset ((char *) &this->server, 0, sizeof (this->server));
       this->id = create_channel_param (context, paramtype, param, 0, 
-                           (class_rmcios) udpclient_class_func, this);        
+                                 (class_rmcios) udpserver_class_func, this);
+      create_subchannel_str (context, this->id, "_buffer",
+                             (class_rmcios) udpserver_buffer_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_stats",
+                             (class_rmcios) udpserver_stats_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_rx",
+                             (class_rmcios) udpserver_rx_subchan_func, 
+                             this);
+      create_subchannel_str (context, this->id, "_peer",
+                             (class_rmcios) udpserver_peer_subchan_func, 
+                             this);
+      timestamp_create (&this->timestamp, context, this->id);
+      // create channel
 
       // Open the socket
       if ((this->connection =
-           socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == SOCKET_ERROR)
+           socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
       {
          printf ("Could not create socket : %d", WSAGetLastError ());
          break;
       }
-
-      // Create receiving thread.
-      CreateThread (0, 0, udpclient_thread, this, 0, &this->threadID);
       break;
 
    case setup_rmcios:
       if (this == NULL)
          break;
-      if (num_params < 2)
+      if (num_params < 1)
          break;
-      param_to_string (context, paramtype, param, 0,
-                       sizeof (this->address), this->address);
-      this->port = param_to_integer (context, paramtype, param, 1);
+      this->port = param_to_integer (context, paramtype, param, 0);
+      this->server.sin_family = AF_INET;
+      this->server.sin_addr.s_addr = INADDR_ANY;
+      this->server.sin_port = htons (this->port);
+      //Bind
+      if (bind
+          (this->connection, (struct sockaddr *) &this->server,
+           sizeof (this->server)) == SOCKET_ERROR)
       {
-         this->destination.sin_family = AF_INET;
-         this->destination.sin_addr.S_un.S_addr = inet_addr (this->address);
-         this->destination.sin_port = htons (this->port);
+         printf ("Bind failed with error code : %d", WSAGetLastError ());
+         break;
       }
+      // Receive in reactor thread
+      this->io.s = this->connection;
+      if (sock_reactor_add (&this->io) != 0)
+         printf ("Could not register udpserver socket\n");
       break;
 
    case write_rmcios:
@@ -454,175 +2992,427 @@ void udpclient_class_func (struct client_data *this,
          break;
       if (num_params < 1)
          break;
-      int plen = param_buffer_alloc_size (context, paramtype, param, 0);       
-      // Determine the needed buffer size
       {
-         // allocate buffer
-         char buffer[plen];     
-         struct buffer_rmcios pbuffer;  
-         // structure pointer to buffer data
-         pbuffer = param_to_buffer (context, paramtype, param, 0, plen, buffer);
-         //send the message
-         if (sendto
-             (this->connection, pbuffer.data, pbuffer.length, 0,
-              (struct sockaddr *) &this->destination,
-              this->slen) == SOCKET_ERROR)
+         struct param_gather g;
+         // send the parameters as one datagram
+         if (param_gather (&g, context, paramtype, param, 0, num_params) == 0)
          {
-            printf ("sendto() failed with error code : %d", WSAGetLastError ());
+            int sent = sock_sendv (this->connection, g.bufs, g.count,
+                                   &this->last_client);
+            io_stats_sent (&this->stats, sent, sent >= 0);
+            if (sent < 0)
+               printf ("sendto() failed with error code : %d",
+                       WSAGetLastError ());
          }
+         param_gather_free (&g);
       }
       break;
    }
 }
 
-
 /***********************************************************************
- * UDP server channel
+ * UDP multicast channel
  **********************************************************************/
 
-// udpserver channel data
-struct udpserver_data
+#define MULTICAST_MAX_GROUPS 16
+
+// udpmulticast channel data
+struct multicast_data
 {
    int port;
    int id;
-   DWORD threadID;
    SOCKET connection;
-   struct sockaddr_in server, last_client;
-   int slen;
+   struct in_addr groups[MULTICAST_MAX_GROUPS];
+   int num_groups;
+   struct in_addr interface_addr;
+   int ttl;
+   int loopback;
+   struct sockaddr_in destination;  // First group
+   struct recv_buffers buffers;
+   struct sock_io io;
+   struct sock_dgram_batch batch;
+   struct io_stats stats;
+   struct rx_timestamp timestamp;
+   struct io_ring rx;           // Pull-mode receive ring
 };
 
-// UDP Client reception thread
-DWORD WINAPI udpserver_thread (LPVOID lpvParam)
+// Receive handler. Runs in reactor thread.
+static void multicast_handler (struct sock_io *io, int events)
+{
+   struct multicast_data *this = (struct multicast_data *) io->owner;
+   dgram_receive (io, &this->batch, &this->buffers, &this->stats, &this->rx,
+                  &this->timestamp, this->id,
+                  NULL, NULL);
+}
+
+// Join or leave all configured groups
+static void multicast_membership (struct multicast_data *this, int option)
 {
-   struct udpserver_data *this = (struct udpserver_data *) lpvParam;
-   char buffer[1500];
-   while (1)
+   int i;
+   for (i = 0; i < this->num_groups; i++)
    {
-      int bytes = 0;
+      struct ip_mreq mreq;
+      mreq.imr_multiaddr = this->groups[i];
+      mreq.imr_interface = this->interface_addr;
+      if (setsockopt (this->connection, IPPROTO_IP, option,
+                      (const char *) &mreq, sizeof (mreq)) != 0
+          && option == IP_ADD_MEMBERSHIP)
+         printf ("Could not join multicast group %s : %d\n",
+                 inet_ntoa (this->groups[i]), WSAGetLastError ());
+   }
+}
 
-      if (this->connection != 0)
-      {
-         if ((bytes = recvfrom (this->connection,
-                                buffer,
-                                sizeof (buffer),
-                                0,
-                                (struct sockaddr *) &this->last_client,
-                                &this->slen)) == SOCKET_ERROR)
-         {
-            Sleep (10);
-         }
-         else
-         {
-            write_buffer (module_context,
-                          linked_channels (module_context,
-                                           this->id), buffer, bytes, this->id);
-         }
-      }
-      else
-         Sleep (10);
+// Open socket and bind it to port. Several sockets may share the port.
+static int multicast_open (struct multicast_data *this, int port)
+{
+   struct sockaddr_in local;
+   int reuse = 1;
+   if ((this->connection =
+        socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
+   {
+      printf ("Could not create socket : %d\n", WSAGetLastError ());
+      return -1;
+   }
+   setsockopt (this->connection, SOL_SOCKET, SO_REUSEADDR, 
+               (const char *) &reuse, sizeof (reuse));
+#ifdef SO_REUSEPORT
+   setsockopt (this->connection, SOL_SOCKET, SO_REUSEPORT, 
+               (const char *) &reuse, sizeof (reuse));
+#endif
+   buffers_apply (&this->buffers, this->connection);
+
+   memset (&local, 0, sizeof (local));
+   local.sin_family = AF_INET;
+   local.sin_addr.s_addr = INADDR_ANY;
+   local.sin_port = htons (port);
+   if (bind (this->connection, (struct sockaddr *) &local, 
+             sizeof (local)) == SOCKET_ERROR)
+   {
+      printf ("Bind failed with error code : %d\n", WSAGetLastError ());
+      closesocket (this->connection);
+      this->connection = INVALID_SOCKET;
+      return -1;
    }
+   this->port = port;
+
+   // Receive in reactor thread
+   this->io.s = this->connection;
+   if (sock_reactor_add (&this->io) != 0)
+   {
+      printf ("Could not register udpmulticast socket\n");
+      closesocket (this->connection);
+      this->connection = INVALID_SOCKET;
+      return -1;
+   }
+   return 0;
 }
 
-// Tcp client implementation functiona
-void udpserver_class_func (struct udpserver_data *this,
-                           const struct context_rmcios *context, int id,
-                           enum function_rmcios function,
-                           enum type_rmcios paramtype,
-                           struct combo_rmcios *returnv,
-                           int num_params,
-                           const union param_rmcios param)
+// Receive buffer subchannel
+void udpmulticast_buffer_subchan_func (struct multicast_data *this,
+                                       const struct context_rmcios *context,
+                                       int id, enum function_rmcios function,
+                                       enum type_rmcios paramtype,
+                                       struct combo_rmcios *returnv,
+                                       int num_params,
+                                       const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_buffers (context, returnv, &this->buffers, this->connection);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      buffers_configure (context, &this->buffers, paramtype, param, 
+                         num_params);
+      buffers_apply (&this->buffers, this->connection);
+      break;
+   }
+}
+
+// Statistics subchannel
+void udpmulticast_stats_subchan_func (struct multicast_data *this,
+                                      const struct context_rmcios *context,
+                                      int id, enum function_rmcios function,
+                                      enum type_rmcios paramtype,
+                                      struct combo_rmcios *returnv,
+                                      int num_params,
+                                      const union param_rmcios param)
+{
+   long long counters[4] = { 0, 0, 0, 0 };
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_stats (context, returnv, &this->stats, counters);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      io_stats_reset (&this->stats);
+      break;
+   }
+}
+
+// Pull-mode receive subchannel
+void udpmulticast_rx_subchan_func (struct multicast_data *this,
+                                   const struct context_rmcios *context,
+                                   int id, enum function_rmcios function,
+                                   enum type_rmcios paramtype,
+                                   struct combo_rmcios *returnv,
+                                   int num_params,
+                                   const union param_rmcios param)
+{
+   switch (function)
+   {
+   case read_rmcios:
+      if (this == NULL)
+         break;
+      return_ring (context, returnv, &this->rx);
+      break;
+
+   case write_rmcios:
+      if (this == NULL)
+         break;
+      io_ring_reset (&this->rx);
+      break;
+
+   case setup_rmcios:
+      if (this == NULL)
+         break;
+      if (num_params < 1)
+         break;
+      io_ring_resize (&this->rx, 
+                      param_to_integer (context, paramtype, param, 0));
+      break;
+   }
+}
+
+// UDP multicast implementation function
+void udpmulticast_class_func (struct multicast_data *this,
+                              const struct context_rmcios *context, int id,
+                              enum function_rmcios function,
+                              enum type_rmcios paramtype,
+                              struct combo_rmcios *returnv,
+                              int num_params,
+                              const union param_rmcios param)
 {
    switch (function)
    {
    case help_rmcios:
       return_string (context, returnv, 
-                     "UDP server channel\n"
-                     "create udpclient newname\n"
-                     " setup newname port # Set receiving port\r\n"
-                     " write newname data # Send data to the latest clienta\r\n"
-                     " link newname channel # Link received data to channel.\r\n"
+                     "UDP multicast channel\n"
+                     "create udpmulticast newname\n"
+                     " setup newname port groups | interface(0.0.0.0)"
+                     " | ttl(1) | loopback(1)\r\n"
+                     "  # Join groups (separated by comma) on interface.\r\n"
+                     "  # Port is shared with other listeners and fixed\r\n"
+                     "  # by the first setup. Later setups replace the\r\n"
+                     "  # groups and send options.\r\n"
+                     " setup newname # Leave all groups\r\n"
+                     " write newname data # Send data to the first group\r\n"
+                     " read newname # port and joined groups\r\n"
+                     " link newname channel # Link received data to channel\r\n"
+                     "creates subchannel: \r\n"
+                     "  newname_buffer for buffer sizes\r\n"
+                     BUFFER_HELP
+                     "  newname_stats for statistics\r\n"
+                     STATS_HELP
+                     "  newname_timestamp for receive time of messages\r\n"
+                     TIMESTAMP_HELP
+                     "  newname_rx for polling received data\r\n"
+                     RX_HELP
                      );
       break;
 
    case create_rmcios:
       if (num_params < 1)
          break;
-      
+
       // allocate new data
-      this = (struct udpserver_data *) malloc (sizeof (struct udpserver_data)); 
+      this = (struct multicast_data *) 
+             calloc (1, sizeof (struct multicast_data));
+      if (this == NULL)
+         break;
 
       //default values :
-      this->port = 0;
-      this->threadID = 0;
-      this->slen = sizeof (this->server);
-      memset ((char *) &this->server, 0, sizeof (this->server));
-      this->id = create_channel_param (context, paramtype, param, 0, 
-                                 (class_rmcios) udpserver_class_func, this);
+      this->connection = INVALID_SOCKET;
+      this->interface_addr.s_addr = htonl (INADDR_ANY);
+      this->ttl = 1;
+      this->loopback = 1;
+      buffers_init (&this->buffers);
+      sock_io_init (&this->io);
+      io_stats_reset (&this->stats);
+      io_ring_init (&this->rx);
+      this->io.handler = multicast_handler;
+      this->io.owner = this;
+      this->io.datagram = 1;
+
       // create channel
+      this->id = create_channel_param (context, paramtype, param, 0, 
+                           (class_rmcios) udpmulticast_class_func, this);
+      create_subchannel_str (context, this->id, "_buffer",
+                             (class_rmcios) udpmulticast_buffer_subchan_func,
+                             this);
+      create_subchannel_str (context, this->id, "_stats",
+                             (class_rmcios) udpmulticast_stats_subchan_func,
+                             this);
+      create_subchannel_str (context, this->id, "_rx",
+                             (class_rmcios) udpmulticast_rx_subchan_func,
+                             this);
+      timestamp_create (&this->timestamp, context, this->id);
+      break;
 
-      // Open the socket
-      if ((this->connection =
-           socket (AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == INVALID_SOCKET)
-      {
-         printf ("Could not create socket : %d", WSAGetLastError ());
+   case setup_rmcios:
+      if (this == NULL)
          break;
+      if (this->connection != INVALID_SOCKET)
+         multicast_membership (this, IP_DROP_MEMBERSHIP);
+      this->num_groups = 0;
+      if (num_params < 2)
+         break;
+      {
+         char groups[256];
+         char address[50];
+         char *group;
+         int port = param_to_integer (context, paramtype, param, 0);
+
+         param_to_string (context, paramtype, param, 1, sizeof (groups), 
+                          groups);
+         for (group = strtok (groups, ", "); 
+              group != NULL && this->num_groups < MULTICAST_MAX_GROUPS;
+              group = strtok (NULL, ", "))
+         {
+            this->groups[this->num_groups].s_addr = inet_addr (group);
+            this->num_groups++;
+         }
+         if (num_params > 2)
+         {
+            param_to_string (context, paramtype, param, 2, 
+                             sizeof (address), address);
+            this->interface_addr.s_addr = inet_addr (address);
+         }
+         if (num_params > 3)
+            this->ttl = param_to_integer (context, paramtype, param, 3);
+         if (num_params > 4)
+            this->loopback = param_to_integer (context, paramtype, param, 4);
+
+         if (this->connection == INVALID_SOCKET
+             && multicast_open (this, port) != 0)
+         {
+            // Writes need an open socket
+            this->num_groups = 0;
+            break;
+         }
+         if (port != this->port)
+            printf ("udpmulticast port stays %d\n", this->port);
       }
+      multicast_membership (this, IP_ADD_MEMBERSHIP);
 
-      // Create receiving thread.
-      CreateThread (0, 0, udpserver_thread, this, 0, &this->threadID);
+      // Sending
+      setsockopt (this->connection, IPPROTO_IP, IP_MULTICAST_IF,
+                  (const char *) &this->interface_addr,
+                  sizeof (this->interface_addr));
+      setsockopt (this->connection, IPPROTO_IP, IP_MULTICAST_TTL,
+                  (const char *) &this->ttl, sizeof (this->ttl));
+      setsockopt (this->connection, IPPROTO_IP, IP_MULTICAST_LOOP,
+                  (const char *) &this->loopback, sizeof (this->loopback));
+      memset (&this->destination, 0, sizeof (this->destination));
+      this->destination.sin_family = AF_INET;
+      this->destination.sin_addr = this->groups[0];
+      this->destination.sin_port = htons (this->port);
       break;
 
-   case setup_rmcios:
+   case read_rmcios:
       if (this == NULL)
          break;
-      if (num_params < 1)
-         break;
-      this->port = param_to_integer (context, paramtype, param, 0);
-      this->server.sin_family = AF_INET;
-      this->server.sin_addr.s_addr = INADDR_ANY;
-      this->server.sin_port = htons (this->port);
-      //Bind
-      if (bind
-          (this->connection, (struct sockaddr *) &this->server,
-           sizeof (this->server)) == SOCKET_ERROR)
       {
-         printf ("Bind failed with error code : %d", WSAGetLastError ());
+         char status[32 + MULTICAST_MAX_GROUPS * 16];
+         int length, i;
+         length = snprintf (status, sizeof (status), "%d", this->port);
+         for (i = 0; i < this->num_groups; i++)
+            length += snprintf (status + length, sizeof (status) - length,
+                                " %s", inet_ntoa (this->groups[i]));
+         return_string (context, returnv, status);
       }
       break;
 
    case write_rmcios:
       if (this == NULL)
          break;
-      if (num_params < 1)
+      if (num_params < 1 || this->num_groups == 0)
          break;
-      int plen = param_buffer_alloc_size (context, paramtype, param, 0);
-      // Determine the needed buffer size
       {
-         // allocate buffer
-         char buffer[plen]; 
-         
-         // structure pointer to buffer data
-         struct buffer_rmcios pbuffer; 
-         pbuffer = param_to_buffer (context, paramtype, param, 0, plen, buffer);
-         
-         // send the message
-         if (sendto
-             (this->connection, pbuffer.data, pbuffer.length, 0,
-              (struct sockaddr *) &this->last_client,
-              this->slen) == SOCKET_ERROR)
+         struct param_gather g;
+         // send the parameters as one datagram
+         if (param_gather (&g, context, paramtype, param, 0, num_params) == 0)
          {
-            printf ("sendto() failed with error code : %d", WSAGetLastError ());
+            int sent = sock_sendv (this->connection, g.bufs, g.count,
+                                   &this->destination);
+            io_stats_sent (&this->stats, sent, sent >= 0);
+            if (sent < 0)
+               printf ("sendto() failed with error code : %d",
+                       WSAGetLastError ());
          }
+         param_gather_free (&g);
       }
       break;
    }
 }
 
+/***********************************************************************
+ * Socket reactor channel
+ **********************************************************************/
+
+// Reactor thread configuration
+void socketreactor_class_func (void *this,
+                               const struct context_rmcios *context, int id,
+                               enum function_rmcios function,
+                               enum type_rmcios paramtype,
+                               struct combo_rmcios *returnv,
+                               int num_params,
+                               const union param_rmcios param)
+{
+   switch (function)
+   {
+   case help_rmcios:
+      return_string (context, returnv,
+                     "Socket reactor channel\n"
+                     " I/O threads shared by all socket channels.\r\n"
+                     " setup socketreactor threads\r\n"
+                     "  # Number of I/O threads. 0 = processor cores.\r\n"
+                     "  # Applies to sockets opened afterwards.\r\n"
+                     " read socketreactor # Number of I/O threads\r\n");
+      break;
+
+   case setup_rmcios:
+      if (num_params < 1)
+         break;
+      if (sock_reactor_start (param_to_integer (context, paramtype, 
+                                                param, 0)) != 0)
+         printf ("Could not start socket reactor threads\n");
+      break;
+
+   case read_rmcios:
+      return_int (context, returnv, sock_reactor_threads ());
+      break;
+   }
+}
+
 void init_socket_channels (const struct context_rmcios *context)
 {
    printf ("Windows socket channel module\r\n[" VERSION_STR "]\r\n");
    module_context = context;
 
+#ifdef _WIN32
    WSADATA wsa;
    //Initialize the socket system
    if (WSAStartup (MAKEWORD (2, 2), &wsa) != 0)
@@ -630,6 +3420,14 @@ void init_socket_channels (const struct context_rmcios *context)
       printf ("Failed. Error Code : %d", WSAGetLastError ());
       return;
    }
+#endif
+
+   // Start the I/O threads shared by all socket channels
+   if (sock_reactor_start (0) != 0)
+   {
+      printf ("Could not start socket reactor\n");
+      return;
+   }
 
    create_channel_str (context, "tcpserver",
                        (class_rmcios) tcpserver_class_func, NULL);
@@ -639,6 +3437,10 @@ void init_socket_channels (const struct context_rmcios *context)
                        (class_rmcios) udpserver_class_func, NULL);
    create_channel_str (context, "udpclient",
                        (class_rmcios) udpclient_class_func, NULL);
+   create_channel_str (context, "udpmulticast",
+                       (class_rmcios) udpmulticast_class_func, NULL);
+   create_channel_str (context, "socketreactor",
+                       (class_rmcios) socketreactor_class_func, NULL);
 }
 
 #ifdef INDEPENDENT_CHANNEL_MODULE
@@ -0,0 +1,1595 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Socket reactor implementation.
+ *
+ * Windows: sockets are associated with an I/O completion port. Readiness
+ * is detected with a zero byte overlapped WSARecv (MSG_PEEK for datagram
+ * sockets so that the datagram is not consumed) and with AcceptEx for
+ * listening sockets.
+ *
+ * Linux: one-shot epoll registrations.
+ *
+ * Each reactor thread (loop) has its own completion port or epoll
+ * instance, timer list and flush requests.
+ *
+ * Changelog: (date,who,description)
+ */
+#ifndef _WIN32
+#define _GNU_SOURCE             // recvmmsg
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "socket_reactor.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#define REACTOR_MAX_EVENTS 64
+#define REACTOR_MAX_LOOPS 64
+
+// Buffers sent with one call when flushing outbound queue
+#define SOCK_FLUSH_BUFS 64
+
+// One reactor thread
+struct sock_loop
+{
+#ifdef _WIN32
+   HANDLE iocp;
+#else
+   int epfd;
+   int wake_fd;                 // eventfd for flush requests
+   io_mutex flush_lock;
+   struct sock_io *flush_list;
+   int timer_fd;
+#endif
+   io_mutex timer_lock;
+   struct sock_timer *timer_list;
+   uint64_t timer_deadline;     // Earliest deadline. 0 = none
+};
+
+static struct
+{
+   int started;
+   io_mutex lock;
+   int num_loops;               // Running threads
+   int active_loops;            // Threads new sockets are assigned to
+   unsigned next_loop;
+   struct sock_loop loops[REACTOR_MAX_LOOPS];
+#ifdef _WIN32
+   LPFN_ACCEPTEX accept_ex;
+   LPFN_CONNECTEX connect_ex;
+   LPFN_WSARECVMSG recv_msg;
+#endif
+} reactor;
+
+// Loop of the current reactor thread. NULL in other threads.
+static __thread struct sock_loop *current_loop;
+
+static void sock_io_flush_timer (struct sock_timer *timer);
+
+////////////////////////////////////////////////////////////////////////
+// Socket helpers
+////////////////////////////////////////////////////////////////////////
+int sock_set_nonblocking (SOCKET s)
+{
+#ifdef _WIN32
+   u_long mode = 1;
+   return ioctlsocket (s, FIONBIO, &mode);
+#else
+   int flags = fcntl (s, F_GETFL, 0);
+   if (flags < 0)
+      return -1;
+   return fcntl (s, F_SETFL, flags | O_NONBLOCK);
+#endif
+}
+
+int sock_would_block (void)
+{
+#ifdef _WIN32
+   return WSAGetLastError () == WSAEWOULDBLOCK;
+#else
+   return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+int sock_wait (SOCKET s, int events, int timeout_ms)
+{
+#ifdef _WIN32
+   fd_set rset, wset;
+   struct timeval tv;
+   FD_ZERO (&rset);
+   FD_ZERO (&wset);
+   if (events & SOCK_IO_READ)
+      FD_SET (s, &rset);
+   if (events & SOCK_IO_WRITE)
+      FD_SET (s, &wset);
+   tv.tv_sec = timeout_ms / 1000;
+   tv.tv_usec = (timeout_ms % 1000) * 1000;
+   return select (0, &rset, &wset, NULL, timeout_ms < 0 ? NULL : &tv);
+#else
+   struct pollfd p;
+   p.fd = s;
+   p.events = 0;
+   p.revents = 0;
+   if (events & SOCK_IO_READ)
+      p.events |= POLLIN;
+   if (events & SOCK_IO_WRITE)
+      p.events |= POLLOUT;
+   return poll (&p, 1, timeout_ms);
+#endif
+}
+
+int sock_recvfrom (SOCKET s, char *buffer, int size,
+                   struct sockaddr_in *from, int *truncated)
+{
+   socklen_t slen = sizeof (*from);
+   int bytes;
+   *truncated = 0;
+#ifdef _WIN32
+   bytes = recvfrom (s, buffer, size, 0, (struct sockaddr *) from, &slen);
+   if (bytes == SOCKET_ERROR)
+   {
+      // Buffer is filled with the start of the datagram
+      if (WSAGetLastError () != WSAEMSGSIZE)
+         return -1;
+      *truncated = 1;
+      bytes = size;
+   }
+#else
+   // MSG_TRUNC returns the real datagram length
+   bytes = recvfrom (s, buffer, size, MSG_TRUNC,
+                     (struct sockaddr *) from, &slen);
+   if (bytes < 0)
+      return -1;
+   if (bytes > size)
+   {
+      *truncated = 1;
+      bytes = size;
+   }
+#endif
+   return bytes;
+}
+
+int sock_set_nodelay (SOCKET s, int nodelay)
+{
+   return setsockopt (s, IPPROTO_TCP, TCP_NODELAY, (const char *) &nodelay,
+                      sizeof (nodelay));
+}
+
+int sock_set_buffers (SOCKET s, int rcvbuf, int sndbuf)
+{
+   int result = 0;
+   if (rcvbuf > 0 && setsockopt (s, SOL_SOCKET, SO_RCVBUF,
+                                 (const char *) &rcvbuf,
+                                 sizeof (rcvbuf)) != 0)
+      result = -1;
+   if (sndbuf > 0 && setsockopt (s, SOL_SOCKET, SO_SNDBUF,
+                                 (const char *) &sndbuf,
+                                 sizeof (sndbuf)) != 0)
+      result = -1;
+   return result;
+}
+
+int sock_sendv (SOCKET s, const sock_buf * bufs, int count,
+                const struct sockaddr_in *to)
+{
+#ifdef _WIN32
+   DWORD sent = 0;
+   int result;
+   if (to == NULL)
+      result = WSASend (s, (LPWSABUF) bufs, count, &sent, 0, NULL, NULL);
+   else
+      result = WSASendTo (s, (LPWSABUF) bufs, count, &sent, 0,
+                          (const struct sockaddr *) to, sizeof (*to),
+                          NULL, NULL);
+   return result == SOCKET_ERROR ? -1 : (int) sent;
+#else
+   struct msghdr msg;
+   memset (&msg, 0, sizeof (msg));
+   msg.msg_name = (void *) to;
+   msg.msg_namelen = to != NULL ? sizeof (*to) : 0;
+   msg.msg_iov = (struct iovec *) bufs;
+   msg.msg_iovlen = count;
+   return sendmsg (s, &msg, SOCK_SEND_FLAGS);
+#endif
+}
+
+int sock_sendv_all (SOCKET s, const sock_buf * bufs, int count)
+{
+   sock_buf pending[count > 0 ? count : 1];
+   sock_buf *p = pending;
+   memcpy (pending, bufs, sizeof (sock_buf) * count);
+
+   // Skip empty buffers
+   while (count > 0 && SOCK_BUF_LEN (p[0]) == 0)
+   {
+      p++;
+      count--;
+   }
+   while (count > 0)
+   {
+      int sent = sock_sendv (s, p, count, NULL);
+      if (sent < 0)
+      {
+         if (sock_would_block ())
+         {
+            if (sock_wait (s, SOCK_IO_WRITE, -1) < 0)
+               return -1;
+            continue;
+         }
+         return -1;
+      }
+      // Advance past sent data
+      while (count > 0 && sent >= SOCK_BUF_LEN (p[0]))
+      {
+         sent -= SOCK_BUF_LEN (p[0]);
+         p++;
+         count--;
+      }
+      if (count > 0 && sent > 0)
+         SOCK_BUF_SET (p[0], SOCK_BUF_DATA (p[0]) + sent,
+                       SOCK_BUF_LEN (p[0]) - sent);
+   }
+   return 0;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Outbound queue
+////////////////////////////////////////////////////////////////////////
+#ifdef SOCK_COUNT_COPIES
+static long long copied_bytes;
+
+void sock_count_copy (long bytes)
+{
+   __atomic_fetch_add (&copied_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+long long sock_copied_bytes (void)
+{
+   return __atomic_load_n (&copied_bytes, __ATOMIC_RELAXED);
+}
+#endif
+
+struct sock_chunk *sock_chunk_new (const sock_buf * bufs, int count)
+{
+   struct sock_chunk *chunk;
+   int length = 0;
+   int i;
+   for (i = 0; i < count; i++)
+      length += SOCK_BUF_LEN (bufs[i]);
+   chunk = (struct sock_chunk *) malloc (sizeof (struct sock_chunk) + length);
+   if (chunk == NULL)
+      return NULL;
+   chunk->refs = 1;
+   chunk->length = 0;
+   for (i = 0; i < count; i++)
+   {
+      memcpy (chunk->data + chunk->length, SOCK_BUF_DATA (bufs[i]),
+              SOCK_BUF_LEN (bufs[i]));
+      chunk->length += SOCK_BUF_LEN (bufs[i]);
+   }
+   SOCK_COUNT_COPY (chunk->length);
+   return chunk;
+}
+
+void sock_chunk_release (struct sock_chunk *chunk)
+{
+   if (__atomic_sub_fetch (&chunk->refs, 1, __ATOMIC_ACQ_REL) == 0)
+      free (chunk);
+}
+
+// Remove node following prev (or head when prev is NULL). Lock held.
+static void outq_unlink (struct sock_outq *q, struct sock_qnode *prev)
+{
+   struct sock_qnode *node = prev != NULL ? prev->next : q->head;
+   if (prev != NULL)
+      prev->next = node->next;
+   else
+      q->head = node->next;
+   if (q->tail == node)
+      q->tail = prev;
+   q->depth_msgs--;
+   q->depth_bytes -= node->chunk->length - node->offset;
+   sock_chunk_release (node->chunk);
+   free (node);
+}
+
+// Consume sent bytes from head of queue. Lock held.
+static void outq_consume (struct sock_outq *q, long bytes)
+{
+   while (bytes > 0 && q->head != NULL)
+   {
+      struct sock_qnode *node = q->head;
+      int remaining = node->chunk->length - node->offset;
+      if (bytes >= remaining)
+      {
+         bytes -= remaining;
+         outq_unlink (q, NULL);
+      }
+      else
+      {
+         node->offset += bytes;
+         q->depth_bytes -= bytes;
+         bytes = 0;
+      }
+   }
+}
+
+// Release queued data that is not being sent. Lock held.
+static void outq_clear (struct sock_outq *q)
+{
+   struct sock_qnode *prev = NULL;
+   int i;
+   for (i = 0; i < q->inflight && q->head != NULL; i++)
+      prev = prev != NULL ? prev->next : q->head;
+   while ((prev != NULL ? prev->next : q->head) != NULL)
+      outq_unlink (q, prev);
+}
+
+// Add tokens for the time since last refill. Lock held.
+static void shaper_refill (struct sock_shaper *sh, uint64_t now)
+{
+   double elapsed = (now - sh->refilled) / 1e9;
+   sh->refilled = now;
+   if (sh->bytes_per_s > 0)
+   {
+      sh->byte_tokens += elapsed * sh->bytes_per_s;
+      if (sh->byte_tokens > sh->burst_bytes)
+         sh->byte_tokens = sh->burst_bytes;
+   }
+   if (sh->msgs_per_s > 0)
+   {
+      sh->msg_tokens += elapsed * sh->msgs_per_s;
+      if (sh->msg_tokens > sh->burst_msgs)
+         sh->msg_tokens = sh->burst_msgs;
+   }
+}
+
+// Microseconds until the buckets are out of debt. Lock held.
+static int shaper_wait_us (struct sock_shaper *sh)
+{
+   double wait = 0;
+   if (sh->bytes_per_s > 0 && sh->byte_tokens < 0)
+      wait = -sh->byte_tokens / sh->bytes_per_s;
+   if (sh->msgs_per_s > 0 && sh->msg_tokens < 0
+       && -sh->msg_tokens / sh->msgs_per_s > wait)
+      wait = -sh->msg_tokens / sh->msgs_per_s;
+   return wait > 0 ? (int) (wait * 1e6) + 1 : 0;
+}
+
+// Collect buffers from queue head. With a rate limit collection stops
+// at the first message the limit does not release yet and *wait_us is
+// set to the time until it can be released. Lock held.
+static int outq_collect (struct sock_io *io, sock_buf * bufs, int max,
+                         int *wait_us)
+{
+   struct sock_outq *q = &io->outq;
+   struct sock_shaper *sh = &io->shaper;
+   int shaped = sock_io_shaped (io);
+   uint64_t now = 0;
+   struct sock_qnode *node;
+   int n = 0;
+
+   *wait_us = 0;
+   if (shaped)
+   {
+      now = io_clock_ns ();
+      shaper_refill (sh, now);
+   }
+   for (node = q->head; node != NULL && n < max; node = node->next, n++)
+   {
+      if (shaped && !node->shaped)
+      {
+         *wait_us = shaper_wait_us (sh);
+         if (*wait_us > 0)
+            break;
+         sh->byte_tokens -= node->chunk->length;
+         sh->msg_tokens -= 1;
+         if (sh->hold != NULL && node->queued != 0)
+            io_histogram_record (sh->hold, now - node->queued);
+      }
+      node->shaped = 1;
+      SOCK_BUF_SET (bufs[n], node->chunk->data + node->offset,
+                    node->chunk->length - node->offset);
+   }
+   q->inflight = n;
+   return n;
+}
+
+void sock_io_init (struct sock_io *io)
+{
+   memset (io, 0, sizeof (*io));
+   io->s = INVALID_SOCKET;
+   io_mutex_init (&io->outq.lock);
+   io_event_init (&io->outq.space);
+   sock_timer_init (&io->flush_timer, io, sock_io_flush_timer);
+#ifdef _WIN32
+   io->accepted = INVALID_SOCKET;
+#endif
+}
+
+int sock_io_busy (struct sock_io *io)
+{
+#ifdef _WIN32
+   int busy;
+   io_mutex_lock (&io->outq.lock);
+   busy = io->write_pending
+          || __atomic_load_n (&io->read_pending, __ATOMIC_ACQUIRE);
+   io_mutex_unlock (&io->outq.lock);
+   return busy;
+#else
+   (void) io;
+   return 0;
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////
+// Reactor threads
+////////////////////////////////////////////////////////////////////////
+
+// Thread of the socket. Assigned round-robin on first use.
+static struct sock_loop *sock_io_loop (struct sock_io *io)
+{
+   struct sock_loop *loop = __atomic_load_n (&io->loop, __ATOMIC_ACQUIRE);
+   if (loop == NULL)
+   {
+      struct sock_loop *expected = NULL;
+      unsigned next = __atomic_fetch_add (&reactor.next_loop, 1,
+                                          __ATOMIC_RELAXED);
+      int active = __atomic_load_n (&reactor.active_loops, __ATOMIC_ACQUIRE);
+      loop = &reactor.loops[active > 0 ? next % active : 0];
+      if (!__atomic_compare_exchange_n (&io->loop, &expected, loop, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+         loop = expected;
+   }
+   return loop;
+}
+
+void sock_io_share_loop (struct sock_io *io, struct sock_io *other)
+{
+   __atomic_store_n (&io->loop, sock_io_loop (other), __ATOMIC_RELEASE);
+}
+
+int sock_reactor_threads (void)
+{
+   return __atomic_load_n (&reactor.active_loops, __ATOMIC_ACQUIRE);
+}
+
+static void sock_io_request_flush (struct sock_io *io)
+{
+   struct sock_loop *loop = sock_io_loop (io);
+#ifdef _WIN32
+   PostQueuedCompletionStatus (loop->iocp, 0, (ULONG_PTR) io, &io->flush_ov);
+#else
+   uint64_t one = 1;
+   io_mutex_lock (&loop->flush_lock);
+   if (!io->flush_queued)
+   {
+      io->flush_queued = 1;
+      io->flush_next = loop->flush_list;
+      loop->flush_list = io;
+   }
+   io_mutex_unlock (&loop->flush_lock);
+   if (write (loop->wake_fd, &one, sizeof (one)) < 0)
+      printf ("Could not wake socket reactor : %d\n", errno);
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////
+// Timers
+////////////////////////////////////////////////////////////////////////
+
+// Program wakeup of reactor thread at deadline. timer_lock held.
+static void sock_timer_program (struct sock_loop *loop, uint64_t deadline)
+{
+#ifndef _WIN32
+   struct itimerspec its;
+   memset (&its, 0, sizeof (its));
+   its.it_value.tv_sec = deadline / 1000000000ULL;
+   its.it_value.tv_nsec = deadline % 1000000000ULL;
+   timerfd_settime (loop->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+#endif
+   loop->timer_deadline = deadline;
+#ifdef _WIN32
+   // Reactor thread recomputes its wait timeout
+   if (current_loop != loop && deadline != 0)
+      PostQueuedCompletionStatus (loop->iocp, 0, 0, NULL);
+#endif
+}
+
+void sock_timer_init (struct sock_timer *timer, struct sock_io *io,
+                      sock_timer_func func)
+{
+   memset (timer, 0, sizeof (*timer));
+   timer->io = io;
+   timer->func = func;
+}
+
+void sock_timer_start (struct sock_timer *timer, int delay_us)
+{
+   struct sock_loop *loop = sock_io_loop (timer->io);
+   uint64_t deadline = io_clock_ns () + (uint64_t) delay_us * 1000;
+
+   io_mutex_lock (&loop->timer_lock);
+   if (!timer->armed)
+   {
+      timer->armed = 1;
+      timer->next = loop->timer_list;
+      loop->timer_list = timer;
+   }
+   else if (deadline >= timer->deadline)
+   {
+      io_mutex_unlock (&loop->timer_lock);
+      return;
+   }
+   timer->deadline = deadline;
+   if (loop->timer_deadline == 0 || deadline < loop->timer_deadline)
+      sock_timer_program (loop, deadline);
+   io_mutex_unlock (&loop->timer_lock);
+}
+
+void sock_timer_stop (struct sock_timer *timer)
+{
+   struct sock_loop *loop = sock_io_loop (timer->io);
+   struct sock_timer **link;
+   io_mutex_lock (&loop->timer_lock);
+   if (timer->armed)
+   {
+      for (link = &loop->timer_list; *link != NULL; link = &(*link)->next)
+      {
+         if (*link == timer)
+         {
+            *link = timer->next;
+            break;
+         }
+      }
+      timer->armed = 0;
+   }
+   io_mutex_unlock (&loop->timer_lock);
+}
+
+// Run expired timers and program the next deadline.
+// Runs in reactor thread.
+static void sock_loop_run_timers (struct sock_loop *loop)
+{
+   struct sock_timer *expired[REACTOR_MAX_EVENTS];
+   struct sock_timer **link;
+   uint64_t now = io_clock_ns ();
+   uint64_t next = 0;
+   int n = 0;
+   int i;
+
+   io_mutex_lock (&loop->timer_lock);
+   link = &loop->timer_list;
+   while (*link != NULL)
+   {
+      struct sock_timer *timer = *link;
+      if (timer->deadline <= now && n < REACTOR_MAX_EVENTS)
+      {
+         *link = timer->next;
+         timer->armed = 0;
+         expired[n++] = timer;
+         continue;
+      }
+      if (next == 0 || timer->deadline < next)
+         next = timer->deadline;
+      link = &timer->next;
+   }
+   sock_timer_program (loop, next);
+   io_mutex_unlock (&loop->timer_lock);
+
+   for (i = 0; i < n; i++)
+      expired[i]->func (expired[i]);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Outbound queue sending
+////////////////////////////////////////////////////////////////////////
+void sock_io_coalesce (struct sock_io *io, int window_us, long bytes)
+{
+   io_mutex_lock (&io->outq.lock);
+   io->coalesce_us = window_us > 0 ? window_us : 0;
+   io->coalesce_bytes = bytes;
+   io_mutex_unlock (&io->outq.lock);
+}
+
+void sock_io_shape (struct sock_io *io, long bytes_per_s, long msgs_per_s,
+                    long burst_bytes, long burst_msgs,
+                    struct io_histogram *hold)
+{
+   struct sock_shaper *sh = &io->shaper;
+   int queued;
+   io_mutex_lock (&io->outq.lock);
+   sh->bytes_per_s = bytes_per_s > 0 ? bytes_per_s : 0;
+   sh->msgs_per_s = msgs_per_s > 0 ? msgs_per_s : 0;
+   sh->burst_bytes = burst_bytes > 0 ? burst_bytes : 0;
+   sh->burst_msgs = burst_msgs > 0 ? burst_msgs : 0;
+   sh->byte_tokens = sh->burst_bytes;
+   sh->msg_tokens = sh->burst_msgs;
+   sh->refilled = io_clock_ns ();
+   sh->hold = hold;
+   queued = io->outq.head != NULL;
+   io_mutex_unlock (&io->outq.lock);
+   // Held messages may be released by the new limit
+   if (queued)
+      sock_timer_start (&io->flush_timer, 0);
+}
+
+int sock_io_shaped (struct sock_io *io)
+{
+   return io->shaper.bytes_per_s > 0 || io->shaper.msgs_per_s > 0;
+}
+
+static struct sock_qnode *sock_qnode_new (struct sock_io *io,
+                                          struct sock_chunk *chunk)
+{
+   struct sock_qnode *node;
+   node = (struct sock_qnode *) malloc (sizeof (struct sock_qnode));
+   if (node == NULL)
+      return NULL;
+   node->next = NULL;
+   node->chunk = chunk;
+   node->offset = 0;
+   node->shaped = 0;
+   node->queued = sock_io_shaped (io) ? io_clock_ns () : 0;
+   return node;
+}
+
+// Queue node after the high-water policy. A partially sent message is
+// always queued, dropping its rest would break the stream. Called with
+// the queue lock held, returns with it released.
+static int outq_push (struct sock_io *io, struct sock_qnode *node)
+{
+   struct sock_outq *q = &io->outq;
+   struct sock_chunk *chunk = node->chunk;
+   int was_empty;
+   int window_full;
+
+   while (!io->closed && node->offset == 0 && q->depth_bytes > 0
+          && q->high_water > 0
+          && q->depth_bytes + chunk->length > q->high_water)
+   {
+      // Blocking on a disconnected socket would never end
+      if (q->policy == SOCK_QUEUE_DROP_NEWEST
+          || (q->policy == SOCK_QUEUE_BLOCK && io->s == INVALID_SOCKET))
+      {
+         q->dropped_msgs++;
+         q->dropped_bytes += chunk->length;
+         io_mutex_unlock (&q->lock);
+         free (node);
+         return 1;
+      }
+      else if (q->policy == SOCK_QUEUE_DROP_OLDEST)
+      {
+         // Oldest message that is not being sent and not partially sent
+         struct sock_qnode *prev = NULL;
+         struct sock_qnode *victim = q->head;
+         int i;
+         for (i = 0; victim != NULL && (i < q->inflight || victim->offset);
+              i++)
+         {
+            prev = victim;
+            victim = victim->next;
+         }
+         if (victim == NULL)
+            break;
+         q->dropped_msgs++;
+         q->dropped_bytes += victim->chunk->length;
+         outq_unlink (q, prev);
+      }
+      else
+      {
+         // Never block a thread that drains queues
+         if (current_loop != NULL)
+            break;
+         io_mutex_unlock (&q->lock);
+         io_event_wait (&q->space, 100);
+         io_mutex_lock (&q->lock);
+      }
+   }
+   if (io->closed)
+   {
+      io_mutex_unlock (&q->lock);
+      free (node);
+      return -1;
+   }
+   __atomic_add_fetch (&chunk->refs, 1, __ATOMIC_RELAXED);
+   was_empty = q->head == NULL;
+   if (q->tail != NULL)
+      q->tail->next = node;
+   else
+      q->head = node;
+   q->tail = node;
+   q->depth_msgs++;
+   q->depth_bytes += chunk->length - node->offset;
+   window_full = io->coalesce_bytes > 0
+                 && q->depth_bytes >= io->coalesce_bytes;
+   io_mutex_unlock (&q->lock);
+
+   if (io->coalesce_us == 0)
+   {
+      if (was_empty)
+         sock_io_request_flush (io);
+   }
+   else if (window_full)
+      sock_io_request_flush (io);
+   else if (was_empty)
+      sock_timer_start (&io->flush_timer, io->coalesce_us);
+   return 0;
+}
+
+int sock_io_enqueue (struct sock_io *io, struct sock_chunk *chunk)
+{
+   struct sock_qnode *node = sock_qnode_new (io, chunk);
+   if (node == NULL)
+      return -1;
+   io_mutex_lock (&io->outq.lock);
+   return outq_push (io, node);
+}
+
+int sock_io_send (struct sock_io *io, const sock_buf * bufs, int count)
+{
+   struct sock_outq *q = &io->outq;
+   struct sock_chunk *chunk;
+   struct sock_qnode *node;
+   sock_buf pending[count > 0 ? count : 1];
+   sock_buf *p = pending;
+   int left = count;
+   int sent_total = 0;
+   int result;
+
+   memcpy (pending, bufs, sizeof (sock_buf) * count);
+   // Lock keeps the socket open and other writers out of the message
+   io_mutex_lock (&q->lock);
+   if (io->closed || io->connecting || io->s == INVALID_SOCKET)
+   {
+      io_mutex_unlock (&q->lock);
+      return -1;
+   }
+   // Queued data, write window and rate limit go first
+   if (q->head == NULL && io->coalesce_us == 0 && !sock_io_shaped (io))
+   {
+      while (left > 0)
+      {
+         int sent;
+         if (SOCK_BUF_LEN (p[0]) == 0)
+         {
+            p++;
+            left--;
+            continue;
+         }
+         sent = sock_sendv (io->s, p, left, NULL);
+         if (sent < 0)
+         {
+            if (sock_would_block ())
+               break;
+            // Reactor thread notices the shutdown and closes the socket
+            shutdown (io->s, SD_BOTH);
+            io_mutex_unlock (&q->lock);
+            return -1;
+         }
+         sent_total += sent;
+         // Advance past sent data
+         while (left > 0 && sent >= SOCK_BUF_LEN (p[0]))
+         {
+            sent -= SOCK_BUF_LEN (p[0]);
+            p++;
+            left--;
+         }
+         if (left > 0 && sent > 0)
+            SOCK_BUF_SET (p[0], SOCK_BUF_DATA (p[0]) + sent,
+                          SOCK_BUF_LEN (p[0]) - sent);
+      }
+      if (left == 0)
+      {
+         io_mutex_unlock (&q->lock);
+         return 0;
+      }
+   }
+
+   // Rest is sent by the reactor thread. Whole message is queued so
+   // that a disconnect drops the partially sent message.
+   chunk = sock_chunk_new (bufs, count);
+   node = chunk != NULL ? sock_qnode_new (io, chunk) : NULL;
+   if (node == NULL)
+   {
+      io_mutex_unlock (&q->lock);
+      if (chunk != NULL)
+         sock_chunk_release (chunk);
+      return -1;
+   }
+   node->offset = sent_total;
+   result = outq_push (io, node);
+   sock_chunk_release (chunk);
+   return result;
+}
+
+#ifdef _WIN32
+// Post overlapped send of queued data. Runs in reactor thread.
+static void sock_io_flush (struct sock_io *io)
+{
+   struct sock_outq *q = &io->outq;
+   sock_buf bufs[SOCK_FLUSH_BUFS];
+   int n, wait_us;
+
+   io_mutex_lock (&q->lock);
+   if (io->write_pending || io->closed || io->connecting
+       || io->s == INVALID_SOCKET)
+   {
+      io_mutex_unlock (&q->lock);
+      return;
+   }
+   n = outq_collect (io, bufs, SOCK_FLUSH_BUFS, &wait_us);
+   if (n > 0)
+      io->write_pending = 1;
+   io_mutex_unlock (&q->lock);
+   if (wait_us > 0)
+      sock_timer_start (&io->flush_timer, wait_us);
+   if (n == 0)
+      return;
+
+   memset (&io->write_ov, 0, sizeof (io->write_ov));
+   if (WSASend (io->s, bufs, n, NULL, 0, &io->write_ov, NULL)
+       == SOCKET_ERROR && WSAGetLastError () != WSA_IO_PENDING)
+   {
+      io_mutex_lock (&q->lock);
+      io->write_pending = 0;
+      q->inflight = 0;
+      io_mutex_unlock (&q->lock);
+   }
+}
+
+// Overlapped send completed. Runs in reactor thread.
+static void sock_io_write_done (struct sock_io *io, int ok, DWORD bytes)
+{
+   struct sock_outq *q = &io->outq;
+   int closed;
+   io_mutex_lock (&q->lock);
+   io->write_pending = 0;
+   q->inflight = 0;
+   if (ok)
+      outq_consume (q, bytes);
+   closed = io->closed;
+   if (closed)
+      outq_clear (q);
+   io_mutex_unlock (&q->lock);
+   io_event_set (&q->space);
+   if (ok && !closed)
+      sock_io_flush (io);
+}
+#else
+// Send queued data until queue is empty or socket would block.
+// Runs in reactor thread. Sets io->want_write when blocked.
+static void sock_io_flush (struct sock_io *io)
+{
+   struct sock_outq *q = &io->outq;
+   sock_buf bufs[SOCK_FLUSH_BUFS];
+   struct msghdr msg;
+   int n, sent;
+   int wait_us = 0;
+
+   io->want_write = 0;
+   while (1)
+   {
+      io_mutex_lock (&q->lock);
+      n = io->closed || io->connecting || io->s == INVALID_SOCKET ? 0 :
+          outq_collect (io, bufs, SOCK_FLUSH_BUFS, &wait_us);
+      io_mutex_unlock (&q->lock);
+      if (n == 0)
+      {
+         // Rate limit holds the next message
+         if (wait_us > 0)
+            sock_timer_start (&io->flush_timer, wait_us);
+         return;
+      }
+
+      memset (&msg, 0, sizeof (msg));
+      msg.msg_iov = bufs;
+      msg.msg_iovlen = n;
+      sent = sendmsg (io->s, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+      io_mutex_lock (&q->lock);
+      q->inflight = 0;
+      if (sent > 0)
+         outq_consume (q, sent);
+      io_mutex_unlock (&q->lock);
+      io_event_set (&q->space);
+
+      if (sent < 0)
+      {
+         if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            io->want_write = 1;
+         // Other errors are noticed by the receive side
+         return;
+      }
+   }
+}
+
+static uint32_t sock_io_epoll_mask (struct sock_io *io)
+{
+   return EPOLLONESHOT | (io->no_read ? 0 : EPOLLIN) |
+          (io->want_write ? EPOLLOUT : 0);
+}
+
+// Flush and wait for writability if the socket would block.
+// Runs in reactor thread.
+static void sock_io_flush_now (struct sock_io *io)
+{
+   sock_io_flush (io);
+   if (io->want_write)
+   {
+      struct epoll_event ev;
+      ev.events = sock_io_epoll_mask (io);
+      ev.data.ptr = io;
+      epoll_ctl (io->loop->epfd, EPOLL_CTL_MOD, io->s, &ev);
+   }
+}
+
+// Flush requests from other threads. Runs in reactor thread.
+static void sock_loop_flush_requests (struct sock_loop *loop)
+{
+   struct sock_io *list;
+   uint64_t count;
+   if (read (loop->wake_fd, &count, sizeof (count)) < 0)
+      count = 0;
+
+   io_mutex_lock (&loop->flush_lock);
+   list = loop->flush_list;
+   loop->flush_list = NULL;
+   while (list != NULL)
+   {
+      struct sock_io *io = list;
+      list = io->flush_next;
+      io->flush_queued = 0;
+      io_mutex_unlock (&loop->flush_lock);
+
+      sock_io_flush_now (io);
+      io_mutex_lock (&loop->flush_lock);
+   }
+   io_mutex_unlock (&loop->flush_lock);
+}
+#endif
+
+// Coalescing window expired or rate limit releases messages
+static void sock_io_flush_timer (struct sock_timer *timer)
+{
+#ifdef _WIN32
+   sock_io_flush (timer->io);
+#else
+   sock_io_flush_now (timer->io);
+#endif
+}
+
+// Connect finished. Runs in reactor thread.
+static void sock_io_connect_done (struct sock_io *io, int ok)
+{
+   int queued;
+   io_mutex_lock (&io->outq.lock);
+   io->connecting = 0;
+   queued = io->outq.head != NULL;
+   io_mutex_unlock (&io->outq.lock);
+   io->handler (io, SOCK_IO_CONNECT | (ok ? 0 : SOCK_IO_ERROR));
+   // Data queued while connecting
+   if (ok && queued)
+      sock_io_request_flush (io);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Reactor thread
+////////////////////////////////////////////////////////////////////////
+static IO_THREAD_FUNC (sock_loop_thread, arg)
+{
+   struct sock_loop *loop = (struct sock_loop *) arg;
+   current_loop = loop;
+#ifdef _WIN32
+   while (1)
+   {
+      DWORD bytes = 0;
+      ULONG_PTR key = 0;
+      LPOVERLAPPED ov = NULL;
+      DWORD timeout = INFINITE;
+      uint64_t deadline = loop->timer_deadline;
+      BOOL ok;
+      struct sock_io *io;
+
+      if (deadline != 0)
+      {
+         uint64_t now = io_clock_ns ();
+         timeout = deadline > now ?
+                   (DWORD) ((deadline - now + 999999) / 1000000) : 0;
+      }
+      ok = GetQueuedCompletionStatus (loop->iocp, &bytes, &key, &ov,
+                                      timeout);
+      io = (struct sock_io *) key;
+      if (loop->timer_deadline != 0
+          && io_clock_ns () >= loop->timer_deadline)
+         sock_loop_run_timers (loop);
+      if (ov == NULL || io == NULL)
+         continue;
+
+      if (ov == &io->write_ov)
+      {
+         sock_io_write_done (io, ok, bytes);
+         continue;
+      }
+      if (ov == &io->flush_ov)
+      {
+         sock_io_flush (io);
+         continue;
+      }
+
+      __atomic_store_n (&io->read_pending, 0, __ATOMIC_RELEASE);
+      if (io->connecting)
+      {
+         ok = ok && io->s != INVALID_SOCKET
+              && setsockopt (io->s, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT,
+                             NULL, 0) == 0;
+         sock_io_connect_done (io, ok);
+         continue;
+      }
+      // Completion of a socket closed by its owner
+      if (io->s == INVALID_SOCKET)
+         continue;
+      io->failed = !ok || io->arm_failed;
+      io->arm_failed = 0;
+      io->handler (io, SOCK_IO_READ | (io->failed ? SOCK_IO_ERROR : 0));
+   }
+#else
+   struct epoll_event events[REACTOR_MAX_EVENTS];
+   while (1)
+   {
+      int i;
+      int n = epoll_wait (loop->epfd, events, REACTOR_MAX_EVENTS, -1);
+      for (i = 0; i < n; i++)
+      {
+         struct sock_io *io = (struct sock_io *) events[i].data.ptr;
+         int flags = 0;
+         if (io == NULL)
+         {
+            sock_loop_flush_requests (loop);
+            continue;
+         }
+         if (events[i].data.ptr == &loop->timer_fd)
+         {
+            uint64_t count;
+            if (read (loop->timer_fd, &count, sizeof (count)) < 0)
+               count = 0;
+            sock_loop_run_timers (loop);
+            continue;
+         }
+         // Event of a socket closed earlier in this batch
+         if (io->s == INVALID_SOCKET)
+            continue;
+         if (io->connecting)
+         {
+            int error = 0;
+            socklen_t elen = sizeof (error);
+            // Event left from an aborted earlier connect
+            if (sock_wait (io->s, SOCK_IO_WRITE, 0) == 0)
+            {
+               sock_reactor_rearm (io);
+               continue;
+            }
+            if (getsockopt (io->s, SOL_SOCKET, SO_ERROR, &error, &elen) != 0)
+               error = errno;
+            sock_io_connect_done (io, error == 0);
+            continue;
+         }
+         if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+            flags |= SOCK_IO_READ;
+         if (events[i].events & EPOLLOUT)
+            flags |= SOCK_IO_WRITE;
+         if (events[i].events & (EPOLLHUP | EPOLLERR))
+            flags |= SOCK_IO_ERROR;
+
+         if (flags & SOCK_IO_WRITE)
+            sock_io_flush (io);
+         if ((flags & SOCK_IO_READ) && !io->no_read)
+            io->handler (io, flags);
+         else
+            sock_reactor_rearm (io);
+      }
+   }
+#endif
+   IO_THREAD_RETURN;
+}
+
+static int sock_loop_start (struct sock_loop *loop)
+{
+#ifdef _WIN32
+   loop->iocp = CreateIoCompletionPort (INVALID_HANDLE_VALUE, NULL, 0, 1);
+   if (loop->iocp == NULL)
+   {
+      printf ("Could not create completion port : %d\n",
+              (int) GetLastError ());
+      return -1;
+   }
+#else
+   struct epoll_event ev;
+   loop->epfd = epoll_create1 (EPOLL_CLOEXEC);
+   if (loop->epfd < 0)
+   {
+      printf ("Could not create epoll instance : %d\n", errno);
+      return -1;
+   }
+   loop->wake_fd = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (loop->wake_fd < 0)
+   {
+      printf ("Could not create eventfd : %d\n", errno);
+      return -1;
+   }
+   io_mutex_init (&loop->flush_lock);
+   ev.events = EPOLLIN;
+   ev.data.ptr = NULL;
+   epoll_ctl (loop->epfd, EPOLL_CTL_ADD, loop->wake_fd, &ev);
+
+   loop->timer_fd = timerfd_create (CLOCK_MONOTONIC,
+                                    TFD_NONBLOCK | TFD_CLOEXEC);
+   if (loop->timer_fd < 0)
+   {
+      printf ("Could not create timerfd : %d\n", errno);
+      return -1;
+   }
+   ev.events = EPOLLIN;
+   ev.data.ptr = &loop->timer_fd;
+   epoll_ctl (loop->epfd, EPOLL_CTL_ADD, loop->timer_fd, &ev);
+#endif
+   io_mutex_init (&loop->timer_lock);
+   return io_thread_start (sock_loop_thread, loop);
+}
+
+int sock_reactor_start (int threads)
+{
+   int result = 0;
+   if (threads <= 0)
+      threads = io_cpu_count ();
+   if (threads > REACTOR_MAX_LOOPS)
+      threads = REACTOR_MAX_LOOPS;
+   // First call is from module init
+   if (!reactor.started)
+   {
+      io_mutex_init (&reactor.lock);
+      reactor.started = 1;
+   }
+
+   io_mutex_lock (&reactor.lock);
+   while (reactor.num_loops < threads)
+   {
+      if (sock_loop_start (&reactor.loops[reactor.num_loops]) != 0)
+      {
+         result = -1;
+         break;
+      }
+      reactor.num_loops++;
+   }
+   if (reactor.num_loops == 0)
+      result = -1;
+   else
+      __atomic_store_n (&reactor.active_loops,
+                        threads < reactor.num_loops ?
+                        threads : reactor.num_loops, __ATOMIC_RELEASE);
+   io_mutex_unlock (&reactor.lock);
+   return result;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Registration
+////////////////////////////////////////////////////////////////////////
+#ifdef _WIN32
+static int sock_io_associate (struct sock_io *io)
+{
+   io->arm_failed = 0;
+   io->failed = 0;
+   io->accepted = INVALID_SOCKET;
+   if (CreateIoCompletionPort ((HANDLE) io->s, sock_io_loop (io)->iocp,
+                               (ULONG_PTR) io, 0) == NULL)
+   {
+      printf ("Could not associate socket with completion port : %d\n",
+              (int) GetLastError ());
+      return -1;
+   }
+   return 0;
+}
+
+static int sock_io_post_accept (struct sock_io *io)
+{
+   DWORD bytes = 0;
+   if (reactor.accept_ex == NULL)
+   {
+      GUID guid = WSAID_ACCEPTEX;
+      if (WSAIoctl (io->s, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                    &guid, sizeof (guid),
+                    &reactor.accept_ex, sizeof (reactor.accept_ex),
+                    &bytes, NULL, NULL) == SOCKET_ERROR)
+      {
+         printf ("Could not load AcceptEx : %d\n", WSAGetLastError ());
+         return -1;
+      }
+   }
+
+   io->accepted = WSASocket (AF_INET, SOCK_STREAM, IPPROTO_TCP, NULL, 0,
+                             WSA_FLAG_OVERLAPPED);
+   if (io->accepted == INVALID_SOCKET)
+      return -1;
+
+   memset (&io->read_ov, 0, sizeof (io->read_ov));
+   __atomic_store_n (&io->read_pending, 1, __ATOMIC_RELEASE);
+   if (!reactor.accept_ex (io->s, io->accepted, io->accept_addresses, 0,
+                           sizeof (struct sockaddr_in) + 16,
+                           sizeof (struct sockaddr_in) + 16,
+                           &bytes, &io->read_ov)
+       && WSAGetLastError () != ERROR_IO_PENDING)
+   {
+      __atomic_store_n (&io->read_pending, 0, __ATOMIC_RELEASE);
+      closesocket (io->accepted);
+      io->accepted = INVALID_SOCKET;
+      return -1;
+   }
+   return 0;
+}
+
+static int sock_io_post_read (struct sock_io *io)
+{
+   WSABUF buf;
+   DWORD flags = io->datagram ? MSG_PEEK : 0;
+   DWORD bytes = 0;
+   buf.buf = NULL;
+   buf.len = 0;
+   memset (&io->read_ov, 0, sizeof (io->read_ov));
+   __atomic_store_n (&io->read_pending, 1, __ATOMIC_RELEASE);
+   if (WSARecv (io->s, &buf, 1, &bytes, &flags, &io->read_ov, NULL)
+       == SOCKET_ERROR && WSAGetLastError () != WSA_IO_PENDING)
+   {
+      // Deliver the error through the reactor thread so that the
+      // handler notices it on its next receive call.
+      io->arm_failed = 1;
+      PostQueuedCompletionStatus (io->loop->iocp, 0, (ULONG_PTR) io,
+                                  &io->read_ov);
+   }
+   return 0;
+}
+#endif
+
+int sock_reactor_rearm (struct sock_io *io)
+{
+#ifdef _WIN32
+   if (io->no_read)
+      return 0;
+   if (io->listening)
+      return sock_io_post_accept (io);
+   return sock_io_post_read (io);
+#else
+   struct epoll_event ev;
+   ev.events = io->connecting ? EPOLLOUT | EPOLLONESHOT :
+               sock_io_epoll_mask (io);
+   ev.data.ptr = io;
+   return epoll_ctl (sock_io_loop (io)->epfd, EPOLL_CTL_MOD, io->s, &ev);
+#endif
+}
+
+int sock_reactor_add (struct sock_io *io)
+{
+   int queued;
+   int result;
+   // Sockets read by other threads stay blocking. Queued writes use
+   // overlapped or MSG_DONTWAIT sends.
+   if (!io->no_read && sock_set_nonblocking (io->s) != 0)
+      return -1;
+   io_mutex_lock (&io->outq.lock);
+   io->closed = 0;
+   io->connecting = 0;
+   queued = io->outq.head != NULL;
+   io_mutex_unlock (&io->outq.lock);
+#ifdef _WIN32
+   if (sock_io_associate (io) != 0)
+      return -1;
+   result = sock_reactor_rearm (io);
+#else
+   struct epoll_event ev;
+   io->want_write = 0;
+   ev.events = sock_io_epoll_mask (io);
+   ev.data.ptr = io;
+   result = epoll_ctl (sock_io_loop (io)->epfd, EPOLL_CTL_ADD, io->s, &ev);
+#endif
+   if (result == 0 && queued)
+      sock_io_request_flush (io);
+   return result;
+}
+
+int sock_io_connect (struct sock_io *io, const struct sockaddr_in *addr)
+{
+#ifdef _WIN32
+   struct sockaddr_in local;
+   DWORD bytes = 0;
+   if (reactor.connect_ex == NULL)
+   {
+      GUID guid = WSAID_CONNECTEX;
+      if (WSAIoctl (io->s, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                    &guid, sizeof (guid),
+                    &reactor.connect_ex, sizeof (reactor.connect_ex),
+                    &bytes, NULL, NULL) == SOCKET_ERROR)
+      {
+         printf ("Could not load ConnectEx : %d\n", WSAGetLastError ());
+         return -1;
+      }
+   }
+   // ConnectEx requires a bound socket
+   memset (&local, 0, sizeof (local));
+   local.sin_family = AF_INET;
+   local.sin_addr.s_addr = htonl (INADDR_ANY);
+   if (bind (io->s, (struct sockaddr *) &local, sizeof (local)) != 0
+       || sock_set_nonblocking (io->s) != 0 || sock_io_associate (io) != 0)
+      return -1;
+   io_mutex_lock (&io->outq.lock);
+   io->closed = 0;
+   io->connecting = 1;
+   io_mutex_unlock (&io->outq.lock);
+
+   memset (&io->read_ov, 0, sizeof (io->read_ov));
+   __atomic_store_n (&io->read_pending, 1, __ATOMIC_RELEASE);
+   if (!reactor.connect_ex (io->s, (const struct sockaddr *) addr,
+                            sizeof (*addr), NULL, 0, NULL, &io->read_ov)
+       && WSAGetLastError () != ERROR_IO_PENDING)
+   {
+      __atomic_store_n (&io->read_pending, 0, __ATOMIC_RELEASE);
+      io->connecting = 0;
+      return -1;
+   }
+   return 0;
+#else
+   struct epoll_event ev;
+   if (sock_set_nonblocking (io->s) != 0)
+      return -1;
+   if (connect (io->s, (const struct sockaddr *) addr, sizeof (*addr)) != 0
+       && errno != EINPROGRESS)
+      return -1;
+   io_mutex_lock (&io->outq.lock);
+   io->closed = 0;
+   io->connecting = 1;
+   io_mutex_unlock (&io->outq.lock);
+   io->want_write = 0;
+
+   // Writability reports the result also when connect completed at once
+   ev.events = EPOLLOUT | EPOLLONESHOT;
+   ev.data.ptr = io;
+   if (epoll_ctl (sock_io_loop (io)->epfd, EPOLL_CTL_ADD, io->s, &ev) != 0)
+   {
+      io->connecting = 0;
+      return -1;
+   }
+   return 0;
+#endif
+}
+
+void sock_io_abort_connect (struct sock_io *io)
+{
+   if (!io->connecting || io->s == INVALID_SOCKET)
+      return;
+#ifdef _WIN32
+   // Cancels ConnectEx. The completion reports the failure.
+   closesocket (io->s);
+   io->s = INVALID_SOCKET;
+#else
+   epoll_ctl (sock_io_loop (io)->epfd, EPOLL_CTL_DEL, io->s, NULL);
+   closesocket (io->s);
+   io->s = INVALID_SOCKET;
+   sock_io_connect_done (io, 0);
+#endif
+}
+
+void sock_reactor_remove (struct sock_io *io)
+{
+#ifdef _WIN32
+   // Closing the socket cancels the pending overlapped operation.
+   (void) io;
+#else
+   if (io->s != INVALID_SOCKET)
+      epoll_ctl (sock_io_loop (io)->epfd, EPOLL_CTL_DEL, io->s, NULL);
+#endif
+}
+
+void sock_reactor_disconnect (struct sock_io *io)
+{
+   struct sock_outq *q = &io->outq;
+   sock_reactor_remove (io);
+   io_mutex_lock (&q->lock);
+   if (q->head != NULL && q->inflight == 0 && q->head->offset > 0)
+   {
+      q->dropped_msgs++;
+      q->dropped_bytes += q->head->chunk->length;
+      outq_unlink (q, NULL);
+   }
+   if (io->s != INVALID_SOCKET)
+      closesocket (io->s);
+   io->s = INVALID_SOCKET;
+   io_mutex_unlock (&q->lock);
+}
+
+void sock_reactor_close (struct sock_io *io)
+{
+   sock_reactor_remove (io);
+   sock_timer_stop (&io->flush_timer);
+   io_mutex_lock (&io->outq.lock);
+   io->closed = 1;
+   outq_clear (&io->outq);
+   if (io->s != INVALID_SOCKET)
+      closesocket (io->s);
+   io->s = INVALID_SOCKET;
+   io_mutex_unlock (&io->outq.lock);
+   // Release writers waiting for queue space
+   io_event_set (&io->outq.space);
+}
+
+SOCKET sock_io_accept (struct sock_io *io, struct sockaddr_in *peer)
+{
+   socklen_t plen = sizeof (struct sockaddr_in);
+   SOCKET s;
+#ifdef _WIN32
+   s = io->accepted;
+   io->accepted = INVALID_SOCKET;
+   if (s == INVALID_SOCKET)
+      return INVALID_SOCKET;
+   if (io->failed)
+   {
+      closesocket (s);
+      return INVALID_SOCKET;
+   }
+   setsockopt (s, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
+               (char *) &io->s, sizeof (io->s));
+   getpeername (s, (struct sockaddr *) peer, &plen);
+#else
+   s = accept (io->s, (struct sockaddr *) peer, &plen);
+   if (s == INVALID_SOCKET)
+      return INVALID_SOCKET;
+#endif
+   return s;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Batched datagram receive
+////////////////////////////////////////////////////////////////////////
+int sock_batch_init (struct sock_dgram_batch *batch, int capacity,
+                     int datagram_size)
+{
+   int i;
+   if (capacity > SOCK_BATCH_MAX)
+      capacity = SOCK_BATCH_MAX;
+   if (capacity < 1)
+      capacity = 1;
+   batch->storage = (char *) malloc ((size_t) capacity * datagram_size);
+   if (batch->storage == NULL)
+   {
+      batch->capacity = 0;
+      return -1;
+   }
+   batch->capacity = capacity;
+   batch->datagram_size = datagram_size;
+   for (i = 0; i < capacity; i++)
+      batch->dgrams[i].data = batch->storage + (size_t) i * datagram_size;
+   return 0;
+}
+
+void sock_batch_free (struct sock_dgram_batch *batch)
+{
+   free (batch->storage);
+   batch->storage = NULL;
+   batch->capacity = 0;
+}
+
+int sock_recv_batch (SOCKET s, struct sock_dgram_batch *batch)
+{
+#ifdef _WIN32
+   int count = 0;
+   if (reactor.recv_msg == NULL)
+   {
+      GUID guid = WSAID_WSARECVMSG;
+      DWORD bytes = 0;
+      if (WSAIoctl (s, SIO_GET_EXTENSION_FUNCTION_POINTER,
+                    &guid, sizeof (guid),
+                    &reactor.recv_msg, sizeof (reactor.recv_msg),
+                    &bytes, NULL, NULL) == SOCKET_ERROR)
+      {
+         printf ("Could not load WSARecvMsg : %d\n", WSAGetLastError ());
+         return -1;
+      }
+   }
+
+   while (count < batch->capacity)
+   {
+      struct sock_dgram *d = &batch->dgrams[count];
+      WSAMSG msg;
+      WSABUF buf;
+      DWORD bytes = 0;
+
+      buf.buf = d->data;
+      buf.len = batch->datagram_size;
+      memset (&msg, 0, sizeof (msg));
+      msg.name = (LPSOCKADDR) &d->from;
+      msg.namelen = sizeof (d->from);
+      msg.lpBuffers = &buf;
+      msg.dwBufferCount = 1;
+      d->truncated = 0;
+      if (reactor.recv_msg (s, &msg, &bytes, NULL, NULL) == SOCKET_ERROR)
+      {
+         int error = WSAGetLastError ();
+         if (error == WSAEMSGSIZE)
+         {
+            bytes = batch->datagram_size;
+            d->truncated = 1;
+         }
+         else if (error == WSAECONNRESET)
+            // ICMP port unreachable from earlier send. Skip.
+            continue;
+         else if (error == WSAEWOULDBLOCK)
+            break;
+         else
+            return count > 0 ? count : -1;
+      }
+      if (msg.dwFlags & MSG_TRUNC)
+         d->truncated = 1;
+      d->length = bytes;
+      count++;
+   }
+   return count;
+#else
+   struct mmsghdr msgs[SOCK_BATCH_MAX];
+   struct iovec iovs[SOCK_BATCH_MAX];
+   int i, count;
+
+   for (i = 0; i < batch->capacity; i++)
+   {
+      iovs[i].iov_base = batch->dgrams[i].data;
+      iovs[i].iov_len = batch->datagram_size;
+      memset (&msgs[i], 0, sizeof (msgs[i]));
+      msgs[i].msg_hdr.msg_name = &batch->dgrams[i].from;
+      msgs[i].msg_hdr.msg_namelen = sizeof (batch->dgrams[i].from);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+   }
+   count = recvmmsg (s, msgs, batch->capacity, MSG_DONTWAIT, NULL);
+   if (count < 0)
+      return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR
+              || errno == ECONNREFUSED) ? 0 : -1;
+   for (i = 0; i < count; i++)
+   {
+      batch->dgrams[i].length = msgs[i].msg_len;
+      batch->dgrams[i].truncated = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+                                   != 0;
+   }
+   return count;
+#endif
+}
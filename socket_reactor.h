@@ -0,0 +1,380 @@
+/*
+RMCIOS - Reactive Multipurpose Control Input Output System
+Copyright (c) 2018 Frans Korhonen
+
+RMCIOS was originally developed at Institute for Atmospheric
+and Earth System Research / Physics, Faculty of Science,
+University of Helsinki, Finland
+
+Assistance, experience and feedback from following persons have been
+critical for development of RMCIOS: Erkki Siivola, Juha Kangasluoma,
+Lauri Ahonen, Ella Häkkinen, Pasi Aalto, Joonas Enroth, Runlong Cai,
+Markku Kulmala and Tuukka Petäjä.
+
+This file is part of RMCIOS. This notice was encoded using utf-8.
+
+RMCIOS is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+RMCIOS is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public Licenses
+along with RMCIOS.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Readiness based socket reactor.
+ * IOCP backend on windows, epoll backend on linux.
+ *
+ * The reactor runs a configurable number of I/O threads. Each thread
+ * has its own completion port or epoll instance and every socket is
+ * bound to one thread when first registered, so the handlers, timers
+ * and queue flushes of a socket always run in the same thread.
+ *
+ * Every registered socket has at most one pending readiness
+ * notification. The handler is called from the reactor thread when the
+ * socket can be read (or accepted). The handler drains the socket with
+ * non-blocking calls and then calls sock_reactor_rearm to receive the
+ * next notification.
+ *
+ * Sockets may also have an outbound queue. Writers enqueue data from any
+ * thread and the reactor thread sends it (overlapped WSASend on windows,
+ * non-blocking sendmsg + EPOLLOUT on linux). With a coalescing window the
+ * queue is sent when the window expires or enough bytes are queued.
+ *
+ * Changelog: (date,who,description)
+ */
+#ifndef SOCKET_REACTOR_H
+#define SOCKET_REACTOR_H
+
+#include "io_platform.h"
+#include "io_stats.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#include <windows.h>
+
+#define SOCK_SEND_FLAGS 0
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define SD_SEND SHUT_WR
+#define SD_BOTH SHUT_RDWR
+#define closesocket close
+#define WSAGetLastError() errno
+
+#define SOCK_SEND_FLAGS MSG_NOSIGNAL
+#endif
+
+// Event bits passed to the handler
+#define SOCK_IO_READ 1
+#define SOCK_IO_WRITE 2
+#define SOCK_IO_ERROR 4
+#define SOCK_IO_CONNECT 8       // Result of sock_io_connect
+
+// Outbound queue policies when the high-water mark is reached
+#define SOCK_QUEUE_BLOCK 0
+#define SOCK_QUEUE_DROP_OLDEST 1
+#define SOCK_QUEUE_DROP_NEWEST 2
+
+// Reference counted message data. Shared by the queues of all
+// connections a message is broadcast to.
+struct sock_chunk
+{
+   int refs;
+   int length;
+   char data[];
+};
+
+struct sock_qnode
+{
+   struct sock_qnode *next;
+   struct sock_chunk *chunk;
+   int offset;
+   int shaped;                  // Released by the rate limit
+   uint64_t queued;             // Enqueue time when rate limited
+};
+
+struct sock_outq
+{
+   io_mutex lock;
+   io_event space;              // Signaled when queued data is sent
+   struct sock_qnode *head, *tail;
+   int inflight;                // Nodes at head being sent
+   int depth_msgs;
+   long depth_bytes;
+   long high_water;             // Bytes. 0 = no limit
+   int policy;
+   long long dropped_msgs;
+   long long dropped_bytes;
+};
+
+struct sock_io;
+struct sock_loop;
+typedef void (*sock_io_handler) (struct sock_io *io, int events);
+
+// One-shot timer run in the reactor thread of a socket
+struct sock_timer;
+typedef void (*sock_timer_func) (struct sock_timer *timer);
+
+struct sock_timer
+{
+   struct sock_io *io;
+   sock_timer_func func;
+   uint64_t deadline;
+   int armed;
+   struct sock_timer *next;
+};
+
+// Token bucket rate limit of the outbound queue. A bucket releases a
+// message when it is not in debt and is charged the message afterwards.
+struct sock_shaper
+{
+   long bytes_per_s;            // 0 = unlimited
+   long msgs_per_s;             // 0 = unlimited
+   long burst_bytes;            // Tokens collected while idle
+   long burst_msgs;
+   double byte_tokens;
+   double msg_tokens;
+   uint64_t refilled;           // Time of last refill
+   struct io_histogram *hold;   // Enqueue to release times. May be NULL
+};
+
+struct sock_io
+{
+   SOCKET s;
+   sock_io_handler handler;
+   void *owner;
+   int listening;
+   int datagram;
+   int no_read;                 // Registered only for queued writes
+   int closed;
+   int connecting;
+   struct sock_loop *loop;      // Reactor thread of the socket
+   struct sock_outq outq;
+
+   // Write coalescing window
+   int coalesce_us;
+   long coalesce_bytes;
+   struct sock_timer flush_timer;
+
+   // Send rate limit
+   struct sock_shaper shaper;
+#ifdef _WIN32
+   WSAOVERLAPPED read_ov;
+   WSAOVERLAPPED write_ov;
+   WSAOVERLAPPED flush_ov;
+   int read_pending;
+   int write_pending;
+   int arm_failed;
+   int failed;
+   SOCKET accepted;
+   char accept_addresses[2 * (sizeof (struct sockaddr_in) + 16)];
+#else
+   int want_write;
+   int flush_queued;
+   struct sock_io *flush_next;
+#endif
+};
+
+// Start reactor threads. threads <= 0 uses the number of processor
+// cores. Calling again with more threads starts the missing ones.
+// Sockets registered afterwards are spread over the first threads.
+int sock_reactor_start (int threads);
+
+// Number of threads new sockets are spread over
+int sock_reactor_threads (void);
+
+// Initialize sock_io structure once before first use.
+void sock_io_init (struct sock_io *io);
+
+// Run io in the same reactor thread as other. Call before registering.
+// Handlers of both are then never run concurrently.
+void sock_io_share_loop (struct sock_io *io, struct sock_io *other);
+
+// Nonzero while the reactor still has operations pending on io.
+// The structure must not be reused for a new socket until this is 0.
+int sock_io_busy (struct sock_io *io);
+
+// Register socket and arm the first notification.
+// io->s, io->handler and io->owner must be set by the caller.
+// Data already in the outbound queue is sent.
+int sock_reactor_add (struct sock_io *io);
+
+// Arm the next notification. Call from the handler after draining.
+int sock_reactor_rearm (struct sock_io *io);
+
+// Remove socket from the reactor. Call from the handler before closing.
+void sock_reactor_remove (struct sock_io *io);
+
+// Start non-blocking connect of io->s and register it. The handler is
+// called with SOCK_IO_CONNECT, with SOCK_IO_ERROR added on failure.
+// On success the handler calls sock_reactor_rearm to start reading.
+int sock_io_connect (struct sock_io *io, const struct sockaddr_in *addr);
+
+// Abort connect in progress and close the socket. The handler gets the
+// failure, possibly before this returns. Call from the reactor thread.
+void sock_io_abort_connect (struct sock_io *io);
+
+// Remove, close the socket and release queued data.
+void sock_reactor_close (struct sock_io *io);
+
+// Remove and close the socket but keep queued messages for the next
+// connection. A partially sent message is dropped.
+void sock_reactor_disconnect (struct sock_io *io);
+
+// Accept next pending connection of listening socket.
+// Returns INVALID_SOCKET when there is nothing more to accept.
+SOCKET sock_io_accept (struct sock_io *io, struct sockaddr_in *peer);
+
+int sock_set_nonblocking (SOCKET s);
+int sock_would_block (void);
+
+// Receive one datagram. Sets *truncated when the datagram did not fit
+// into buffer. Returns bytes stored in buffer or -1.
+int sock_recvfrom (SOCKET s, char *buffer, int size,
+                   struct sockaddr_in *from, int *truncated);
+
+// Enable or disable TCP_NODELAY.
+int sock_set_nodelay (SOCKET s, int nodelay);
+
+// Set kernel SO_RCVBUF/SO_SNDBUF sizes. Values <= 0 are left unchanged.
+int sock_set_buffers (SOCKET s, int rcvbuf, int sndbuf);
+
+// Wait until socket is readable/writable (SOCK_IO_READ/SOCK_IO_WRITE).
+// Returns >0 when ready, 0 on timeout, <0 on error.
+int sock_wait (SOCKET s, int events, int timeout_ms);
+
+////////////////////////////////////////////////////////////////////////
+// Scatter/gather send.
+// WSABUF on windows, struct iovec on POSIX systems.
+////////////////////////////////////////////////////////////////////////
+#ifdef _WIN32
+typedef WSABUF sock_buf;
+#define SOCK_BUF_DATA(b) ((b).buf)
+#define SOCK_BUF_LEN(b) ((int) (b).len)
+#define SOCK_BUF_SET(b, ptr, length) \
+   ((b).buf = (char *) (ptr), (b).len = (ULONG) (length))
+#else
+typedef struct iovec sock_buf;
+#define SOCK_BUF_DATA(b) ((char *) (b).iov_base)
+#define SOCK_BUF_LEN(b) ((int) (b).iov_len)
+#define SOCK_BUF_SET(b, ptr, length) \
+   ((b).iov_base = (void *) (ptr), (b).iov_len = (size_t) (length))
+#endif
+
+// Send buffers with one system call. Sends datagram to address when
+// to is not NULL. Returns bytes sent or -1.
+int sock_sendv (SOCKET s, const sock_buf * bufs, int count,
+                const struct sockaddr_in *to);
+
+// Send all buffers on stream socket. Waits without limit on would-block,
+// so not for sockets of the reactor. Use sock_io_send.
+int sock_sendv_all (SOCKET s, const sock_buf * bufs, int count);
+
+////////////////////////////////////////////////////////////////////////
+// Outbound queue
+////////////////////////////////////////////////////////////////////////
+
+// Copy buffers into new chunk with one reference.
+struct sock_chunk *sock_chunk_new (const sock_buf * bufs, int count);
+
+// Bytes of written data copied before sending. Only counted in
+// benchmark builds with SOCK_COUNT_COPIES defined.
+#ifdef SOCK_COUNT_COPIES
+void sock_count_copy (long bytes);
+long long sock_copied_bytes (void);
+#define SOCK_COUNT_COPY(bytes) sock_count_copy (bytes)
+#else
+#define SOCK_COUNT_COPY(bytes) ((void) 0)
+#endif
+void sock_chunk_release (struct sock_chunk *chunk);
+
+////////////////////////////////////////////////////////////////////////
+// Timers
+////////////////////////////////////////////////////////////////////////
+
+// Timer function runs in the reactor thread of io.
+void sock_timer_init (struct sock_timer *timer, struct sock_io *io,
+                      sock_timer_func func);
+
+// Run timer function after delay_us. An armed timer is only moved
+// earlier.
+void sock_timer_start (struct sock_timer *timer, int delay_us);
+void sock_timer_stop (struct sock_timer *timer);
+
+// Delay sending of queued data until window_us has passed from the first
+// queued message or bytes are queued. 0 window sends immediately.
+// Window resolution is the system timer resolution on windows.
+void sock_io_coalesce (struct sock_io *io, int window_us, long bytes);
+
+// Limit send rate of queued data with token buckets. Messages are
+// released in order and the time from enqueue to release is recorded in
+// hold. Rates <= 0 are unlimited. Writes must go through the queue.
+void sock_io_shape (struct sock_io *io, long bytes_per_s, long msgs_per_s,
+                    long burst_bytes, long burst_msgs,
+                    struct io_histogram *hold);
+
+// Nonzero when the send rate of io is limited
+int sock_io_shaped (struct sock_io *io);
+
+// Queue chunk for sending by the reactor thread. Applies the
+// high-water policy of the queue. Returns 0 when queued, 1 when dropped
+// and -1 when the socket is closed.
+int sock_io_enqueue (struct sock_io *io, struct sock_chunk *chunk);
+
+// Send on connected stream socket without waiting. Sends directly when
+// nothing is queued. What the socket does not take is queued for the
+// reactor thread under the high-water policy. Returns as
+// sock_io_enqueue, also -1 when not connected. Any thread.
+int sock_io_send (struct sock_io *io, const sock_buf * bufs, int count);
+
+////////////////////////////////////////////////////////////////////////
+// Batched datagram receive.
+// recvmmsg on linux, WSARecvMsg loop on windows.
+////////////////////////////////////////////////////////////////////////
+#define SOCK_BATCH_MAX 32
+
+struct sock_dgram
+{
+   char *data;
+   int length;
+   int truncated;
+   struct sockaddr_in from;
+};
+
+struct sock_dgram_batch
+{
+   int capacity;
+   int datagram_size;
+   char *storage;
+   struct sock_dgram dgrams[SOCK_BATCH_MAX];
+};
+
+// Allocate storage for capacity datagrams of datagram_size bytes.
+int sock_batch_init (struct sock_dgram_batch *batch, int capacity,
+                     int datagram_size);
+void sock_batch_free (struct sock_dgram_batch *batch);
+
+// Receive all queued datagrams without blocking, up to batch capacity.
+// Returns number of received datagrams, 0 when none queued, -1 on error.
+int sock_recv_batch (SOCKET s, struct sock_dgram_batch *batch);
+
+#endif
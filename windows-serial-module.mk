@@ -1,6 +1,7 @@
 include RMCIOS-build-scripts/utilities.mk
 
-SOURCES:=serial_channels.c
+SOURCES:=serial_channels.c serial_port.c serial_engine.c io_ring.c \
+         framing.c serial_hotplug.c
 FILENAME?=windows-serial-module
 CFLAGS+= -lwinmm
 CFLAGS+= -mwindows
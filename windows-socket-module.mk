@@ -1,6 +1,6 @@
 include RMCIOS-build-scripts/utilities.mk
 
-SOURCES:=socket_channels.c
+SOURCES:=socket_channels.c socket_reactor.c framing.c io_stats.c io_ring.c
 FILENAME?=windows-socket-module
 CFLAGS+=-lwinmm
 CFLAGS+=-mwindows